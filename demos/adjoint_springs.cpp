@@ -0,0 +1,110 @@
+#include <iostream>
+#include <chrono>
+#include <nonlinfunc.hpp>
+#include <adjoint.hpp>
+#include <sensitivity.hpp>
+#include <RungeKutta.hpp>
+
+
+using namespace ASC_ode;
+
+
+// hardening spring between two masses, force on both
+struct Spring
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    T d = x(1) - x(0);
+    T force = d + d*d*d;
+    f(0) = force;
+    f(1) = -force;
+  }
+};
+
+// the same spring between the wall and the first mass
+struct WallSpring
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = -(x(0) + x(0)*x(0)*x(0));
+  }
+};
+
+
+/*
+  Chain of m unit masses, y = (x, v). Every spring has its own stiffness
+  Parameter; we want dL/dk for L = |x(T)|^2 / 2.
+*/
+int main (int argc, char ** argv)
+{
+  size_t m = argc > 1 ? std::stoul(argv[1]) : 100;
+  size_t checkpoints = argc > 2 ? std::stoul(argv[2]) : 8;
+  size_t steps = 200;
+  double tau = 0.02;
+
+  std::vector<std::shared_ptr<Parameter>> stiffness;
+  std::shared_ptr<NonlinearFunction> rhs =
+    std::make_shared<EmbedFunction>(std::make_shared<IdentityFunction>(m), m, 2*m, 0, 2*m);
+  for (size_t i = 0; i < m; i++)
+    {
+      auto k = std::make_shared<Parameter>(1.0 + 0.01*i);
+      stiffness.push_back(k);
+      std::shared_ptr<NonlinearFunction> spring;
+      if (i == 0)
+        spring = std::make_shared<EmbedFunction>(std::make_shared<AutoDiffFunction<WallSpring,1>>(WallSpring()),
+                                                 0, 2*m, m, 2*m);
+      else
+        spring = std::make_shared<EmbedFunction>(std::make_shared<AutoDiffFunction<Spring,2>>(Spring()),
+                                                 i-1, 2*m, m+i-1, 2*m);
+      rhs = rhs + k * spring;
+    }
+
+  Matrix<> a(4,4);
+  a = 0.0;
+  a(1,0) = 0.5; a(2,1) = 0.5; a(3,2) = 1;
+  Vector<> b(4), c(4);
+  b(0) = 1.0/6; b(1) = 1.0/3; b(2) = 1.0/3; b(3) = 1.0/6;
+  c(0) = 0; c(1) = 0.5; c(2) = 0.5; c(3) = 1;
+
+  Vector<> y0(2*m);
+  y0 = 0.0;
+  y0(m-1) = 0.3;
+
+  auto start = std::chrono::steady_clock::now();
+  AdjointRungeKutta adjoint(rhs, stiffness, a, b, checkpoints);
+  Vector<> y = y0;
+  adjoint.Forward(tau, steps, y);
+  Vector<> lambda(2*m), grad(m);
+  lambda = 0.0;
+  lambda.range(0, m) = y.range(0, m);
+  adjoint.Backward(lambda, grad);
+  std::chrono::duration<double> tadj = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  SensitivityStepper forward(rhs, stiffness, [&](auto f)
+  {
+    return std::make_unique<ExplicitRungeKutta>(f, a, b, c);
+  });
+  Vector<> ys = y0;
+  for (size_t i = 0; i < steps; i++)
+    forward.DoStep(tau, ys);
+  std::chrono::duration<double> tfwd = std::chrono::steady_clock::now() - start;
+
+  double diff = 0;
+  for (size_t k = 0; k < m; k++)
+    {
+      double gk = 0;
+      for (size_t i = 0; i < m; i++)
+        gk += ys(i) * forward.sensitivity(k)(i);
+      diff = std::max(diff, std::abs(gk - grad(k)));
+    }
+
+  std::cout << m << " stiffness parameters, " << steps << " RK4 steps" << std::endl;
+  std::cout << "adjoint:   " << tadj.count() << " s, " << checkpoints << " checkpoints, "
+            << adjoint.numForwardSteps() << " forward steps" << std::endl;
+  std::cout << "forward:   " << tfwd.count() << " s" << std::endl;
+  std::cout << "max difference of the gradients: " << diff << std::endl;
+  std::cout << "dL/dk_" << m-2 << " = " << grad(m-2) << ", dL/dk_" << m-1 << " = " << grad(m-1) << std::endl;
+}
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <ExplicitRK.hpp>
+#include <lincomb.hpp>
+
+
+using namespace ASC_ode;
+
+
+// harmonic oscillator, the cheapest rhs: tableau overhead dominates
+class MassSpring : public NonlinearFunction
+{
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -1;
+  }
+};
+
+
+// y' = -y for large n, a memory bandwidth bound rhs
+class Decay : public NonlinearFunction
+{
+  size_t m_n;
+public:
+  Decay (size_t n) : m_n(n) { }
+  size_t dimX() const override { return m_n; }
+  size_t dimF() const override { return m_n; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    for (size_t i = 0; i < m_n; i++)
+      f(i) = -x(i);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    for (size_t i = 0; i < m_n; i++)
+      df(i,i) = -1;
+  }
+};
+
+
+template <typename TStepper>
+void Run (const char * name, TStepper & stepper, size_t steps)
+{
+  double tau = 2 * M_PI / steps;
+  Vector<> y(2);
+  y(0) = 1; y(1) = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < steps; i++)
+    stepper.DoStep(tau, y);
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end-start).count() / steps;
+  std::cout << std::setw(24) << name << std::setw(14) << ns
+            << std::setw(16) << std::hypot(y(0)-1, y(1)) << std::endl;
+}
+
+
+int main()
+{
+  auto rhs = std::make_shared<MassSpring>();
+  size_t steps = 1000000;
+
+  Matrix<> a(4,4);
+  a = 0.0;
+  a(1,0) = 0.5; a(2,1) = 0.5; a(3,2) = 1;
+  Vector<> b(4), c(4);
+  b(0) = 1.0/6; b(1) = 1.0/3; b(2) = 1.0/3; b(3) = 1.0/6;
+  c(0) = 0; c(1) = 0.5; c(2) = 0.5; c(3) = 1;
+
+  std::cout << std::setw(24) << "method" << std::setw(14) << "ns/step"
+            << std::setw(16) << "error" << std::endl;
+
+  ExplicitRungeKutta rk4runtime(rhs, a, b, c);
+  Run("ExplicitRungeKutta RK4", rk4runtime, steps);
+
+  RK4 rk4(rhs);
+  Run("ExplicitRK<RK4>", rk4, steps);
+
+  BS3 bs3(rhs);
+  Run("ExplicitRK<BS3>", bs3, steps);
+
+  DOPRI5 dopri5(rhs);
+  Run("ExplicitRK<DOPRI5>", dopri5, steps);
+
+  Tsit5 tsit5(rhs);
+  Run("ExplicitRK<Tsit5>", tsit5, steps);
+
+  std::cout << "rhs evaluations per step, DOPRI5: "
+            << double(dopri5.numEvaluations()) / steps << std::endl;
+
+  // embedded error estimate: adaptive steps over one period
+  for (double tol : { 1e-6, 1e-10 })
+    {
+      DOPRI5 adaptive(rhs, tol);
+      Vector<> y(2);
+      y(0) = 1; y(1) = 0;
+      adaptive.DoStep(2 * M_PI, y);
+      std::cout << "adaptive DOPRI5, tol " << tol << ": " << adaptive.numSteps() << " steps, "
+                << adaptive.numRejected() << " rejected, error " << std::hypot(y(0)-1, y(1)) << std::endl;
+    }
+
+  // the fused kernel alone, y + sum of three k's; the parallel call stays
+  // serial below 2^17 entries per thread and on a single thread
+  std::cout << "LinearCombination, " << ThreadPool::global().numThreads() << " threads" << std::endl;
+  for (size_t n : { size_t(1) << 16, size_t(1) << 18, size_t(1) << 20, size_t(10000000) })
+    {
+      std::vector<double> y(n, 1.0), out(n), k0(n, 0.5), k1(n, 0.25), k2(n, 0.125);
+      const double * k[3] = { k0.data(), k1.data(), k2.data() };
+      double coefs[3] = { 0.1, 0.2, 0.3 };
+      int reps = std::max<int>(3, 40000000 / n);
+      std::cout << "n = " << std::setw(8) << n;
+      for (bool parallel : { false, true })
+        {
+          auto start = std::chrono::steady_clock::now();
+          for (int r = 0; r < reps; r++)
+            LinearCombination(n, out.data(), y.data(), 3, coefs, k, parallel);
+          auto end = std::chrono::steady_clock::now();
+          std::cout << (parallel ? ", parallel " : ", serial ") << std::setw(10)
+                    << std::chrono::duration<double, std::micro>(end-start).count() / reps << " us";
+        }
+      std::cout << std::endl;
+    }
+
+  // stage combinations of a large system, serial and on the thread pool
+  size_t n = 10000000;
+  auto decay = std::make_shared<Decay>(n);
+  for (bool parallel : { false, true })
+    {
+      ExplicitRungeKutta stepper(decay, a, b, c, parallel);
+      Vector<> y(n);
+      y = 1.0;
+      int nsteps = 10;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < nsteps; i++)
+        stepper.DoStep(0.01, y);
+      auto end = std::chrono::steady_clock::now();
+      std::cout << "n = " << n << (parallel ? ", parallel: " : ", serial:   ")
+                << std::chrono::duration<double, std::milli>(end-start).count() / nsteps
+                << " ms/step, error " << std::abs(y(0) - std::exp(-0.1)) << std::endl;
+    }
+}
@@ -0,0 +1,149 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <ExplicitRK.hpp>
+#include <Radau.hpp>
+#include <Extrapolation.hpp>
+
+
+using namespace ASC_ode;
+
+
+// chain of N nonlinear (Duffing) springs, y = (positions, velocities)
+template <size_t N>
+struct DuffingChain
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i < N; i++)
+      {
+        T left = x(i);
+        if (i > 0) left = x(i) - x(i-1);
+        T right = -x(i);
+        if (i+1 < N) right = x(i+1) - x(i);
+        f(i) = x(N+i);
+        f(N+i) = right + right*right*right - left - left*left*left;
+      }
+  }
+};
+
+// one-dimensional Brusselator with diffusion on N grid points,
+// y = (u_1, v_1, ..., u_N, v_N), stiff by the diffusion
+template <size_t N>
+struct Brusselator
+{
+  double alpha = 0.02;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    double c = alpha * (N+1) * (N+1);
+    for (size_t i = 0; i < N; i++)
+      {
+        T u = x(2*i), v = x(2*i+1);
+        T ul = i > 0 ? x(2*i-2) : T(1.0), vl = i > 0 ? x(2*i-1) : T(3.0);
+        T ur = i+1 < N ? x(2*i+2) : T(1.0), vr = i+1 < N ? x(2*i+3) : T(3.0);
+        f(2*i) = 1 + u*u*v - 4*u + c * (ul - 2*u + ur);
+        f(2*i+1) = 3*u - u*u*v + c * (vl - 2*v + vr);
+      }
+  }
+};
+
+
+double Error (VectorView<double> y, VectorView<double> yref)
+{
+  double err = 0;
+  for (size_t i = 0; i < y.size(); i++)
+    err = std::max(err, std::abs(y(i) - yref(i)));
+  return err;
+}
+
+
+void Run (std::shared_ptr<NonlinearFunction> rhs, VectorView<double> y0, VectorView<double> yref,
+          double tend, ExtrapolationBase base, std::initializer_list<double> tols)
+{
+  for (double tol : tols)
+    for (bool parallel : { false, true })
+      {
+        Extrapolation stepper(rhs, tol, tol, base, 10, parallel);
+        Vector<> y = y0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 10; i++)
+          stepper.DoStep(tend / 10, y);
+        auto end = std::chrono::steady_clock::now();
+
+        std::cout << std::setw(8) << tol
+                  << std::setw(10) << (base == ExtrapolationBase::Midpoint ? "midpoint" : "lin.impl")
+                  << std::setw(10) << (parallel ? "parallel" : "serial")
+                  << std::setw(8) << stepper.numSteps() << std::setw(6) << stepper.numRejected()
+                  << std::setw(8) << stepper.numEvaluations() << std::setw(6) << stepper.numJacobians()
+                  << std::setw(7) << stepper.numFactorizations()
+                  << std::setw(14) << Error(y, yref)
+                  << std::setw(12) << std::chrono::duration<double, std::milli>(end-start).count()
+                  << std::endl;
+      }
+}
+
+
+/*
+  Extrapolation with both bases against reference solutions: a
+  non-stiff chain of Duffing springs (reference: RK4 with 20000 steps)
+  and the stiff Brusselator (reference: AdaptiveRadau at 1e-12), where
+  the explicit midpoint rule is limited by stability. Columns: steps,
+  rejected steps, rhs evaluations, Jacobians, factorizations (inverses
+  of I - h/n_j J), max error, time.
+*/
+int main()
+{
+  std::cout << "threads: " << ThreadPool::global().numThreads() << std::endl;
+  auto header = [] ()
+  {
+    std::cout << std::setw(8) << "tol" << std::setw(10) << "base" << std::setw(10) << "mode"
+              << std::setw(8) << "steps" << std::setw(6) << "rej" << std::setw(8) << "evals"
+              << std::setw(6) << "jac" << std::setw(7) << "fact"
+              << std::setw(14) << "error" << std::setw(12) << "time [ms]" << std::endl;
+  };
+
+  {
+    constexpr size_t N = 50;
+    auto rhs = std::make_shared<AutoDiffFunction<DuffingChain<N>, 2*N>>(DuffingChain<N>(), 2*N);
+    Vector<> y0(2*N), yref(2*N);
+    y0 = 0.0;
+    for (size_t i = 0; i < N; i++)
+      y0(i) = 0.3 * std::sin(10 * M_PI * (i+1) / (N+1));
+
+    double tend = 10;
+    RK4 reference(rhs);
+    yref = y0;
+    for (int i = 0; i < 20000; i++)
+      reference.DoStep(tend / 20000, yref);
+
+    std::cout << "Duffing chain, N = " << N << ", t = " << tend << std::endl;
+    header();
+    Run(rhs, y0, yref, tend, ExtrapolationBase::Midpoint, { 1e-6, 1e-9, 1e-12 });
+    Run(rhs, y0, yref, tend, ExtrapolationBase::LinearlyImplicitEuler, { 1e-4, 1e-6, 1e-8 });
+  }
+
+  {
+    constexpr size_t N = 40;
+    auto rhs = std::make_shared<AutoDiffFunction<Brusselator<N>, 2*N>>(Brusselator<N>(), 2*N);
+    Vector<> y0(2*N), yref(2*N);
+    for (size_t i = 0; i < N; i++)
+      {
+        y0(2*i) = 1 + std::sin(2 * M_PI * (i+1) / (N+1));
+        y0(2*i+1) = 3;
+      }
+
+    double tend = 10;
+    AdaptiveRadau reference(rhs, 1e-12, 1e-12);
+    yref = y0;
+    reference.DoStep(tend, yref);
+
+    std::cout << "Brusselator, N = " << N << ", t = " << tend << std::endl;
+    header();
+    Run(rhs, y0, yref, tend, ExtrapolationBase::Midpoint, { 1e-4 });
+    Run(rhs, y0, yref, tend, ExtrapolationBase::LinearlyImplicitEuler, { 1e-4, 1e-6, 1e-8 });
+  }
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <ParallelIRK.hpp>
+
+
+using namespace ASC_ode;
+
+
+// chain of N nonlinear (Duffing) springs, y = (positions, velocities)
+template <size_t N>
+struct DuffingChain
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i < N; i++)
+      {
+        T left = x(i);
+        if (i > 0) left = x(i) - x(i-1);
+        T right = -x(i);
+        if (i+1 < N) right = x(i+1) - x(i);
+        f(i) = x(N+i);
+        f(N+i) = right + right*right*right - left - left*left*left;
+      }
+  }
+};
+
+
+double TimePerStep (TimeStepper & stepper, VectorView<double> y0, int steps)
+{
+  Vector<> y = y0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++)
+    stepper.DoStep(0.05, y);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end-start).count() / steps;
+}
+
+
+/*
+  Time per step of Radau IIA on the Duffing chain: full Newton
+  (ImplicitRungeKutta), the decoupled stages on one thread, and the
+  decoupled stages on the pool with 1, 2, 4, ... threads, with the
+  speedup over the serial decoupled version. Newton against serial is
+  the gain of the decoupling, serial against parallel that of the
+  threads.
+*/
+int main()
+{
+  constexpr size_t N = 50;
+  auto rhs = std::make_shared<AutoDiffFunction<DuffingChain<N>, 2*N>>(DuffingChain<N>(), 2*N);
+
+  Vector<> y0(2*N);
+  y0 = 0.0;
+  for (size_t i = 0; i < N; i++)
+    y0(i) = 0.1 * std::sin(M_PI * (i+1) / (N+1));
+
+  // thread counts 1, 2, 4, ... up to the hardware
+  size_t hardware = ThreadPool::global().numThreads();
+  std::vector<size_t> threads;
+  for (size_t t = 1; t < hardware; t *= 2)
+    threads.push_back(t);
+  threads.push_back(hardware);
+
+  std::cout << "hardware threads: " << hardware << std::endl;
+  std::cout << std::setw(8) << "stages" << std::setw(14) << "Newton [ms]"
+            << std::setw(14) << "serial [ms]";
+  for (size_t t : threads)
+    std::cout << std::setw(10) << t << " thr" << std::setw(9) << "speedup";
+  std::cout << std::endl;
+
+  for (size_t s : { 2, 4, 6, 8 })
+    {
+      const ButcherTableau & tab = GetTableau(TableauFamily::RadauIIA, s);
+      ImplicitRungeKutta newton(rhs, tab.a, tab.b, tab.c);
+      ParallelImplicitRungeKutta serial(rhs, tab, false);
+
+      int steps = 5;
+      double tserial = TimePerStep(serial, y0, steps);
+      std::cout << std::setw(8) << s
+                << std::setw(14) << TimePerStep(newton, y0, steps)
+                << std::setw(14) << tserial;
+      for (size_t t : threads)
+        {
+          ThreadPool::global().setNumThreads(t);
+          ParallelImplicitRungeKutta parallel(rhs, tab, true);
+          double tpar = TimePerStep(parallel, y0, steps);
+          std::cout << std::setw(14) << tpar << std::setw(9) << std::setprecision(3)
+                    << tserial / tpar << std::setprecision(6);
+        }
+      std::cout << std::endl;
+    }
+  ThreadPool::global().setNumThreads(hardware);
+}
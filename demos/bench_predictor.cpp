@@ -0,0 +1,75 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <ParallelIRK.hpp>
+
+
+using namespace ASC_ode;
+
+
+struct VanDerPol
+{
+  double mu;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = x(1);
+    f(1) = mu * (1 - x(0)*x(0)) * x(1) - x(0);
+  }
+};
+
+
+// Newton iterations per step over 100 steps of tau = 0.02 from (2, 0)
+template <typename Stepper>
+double IterationsPerStep (Stepper & stepper, VectorView<double> y)
+{
+  y(0) = 2; y(1) = 0;
+  size_t iterations = 0, steps = 100;
+  for (size_t i = 0; i < steps; i++)
+    {
+      stepper.DoStep(0.02, y);
+      iterations += stepper.numIterations();
+    }
+  return double(iterations) / steps;
+}
+
+
+/*
+  Newton iterations per step of Radau IIA on Van der Pol, with the stage
+  value predictor (usePredictor(true), the default) and from K = 0, for
+  ImplicitRungeKutta (full Newton) and ParallelImplicitRungeKutta
+  (simplified Newton on the diagonalized system). The last column is the
+  difference of the results, which stays at the Newton tolerance.
+*/
+int main()
+{
+  std::cout << std::setw(6) << "mu" << std::setw(4) << "s" << std::setw(10) << "stepper"
+            << std::setw(12) << "K = 0" << std::setw(12) << "predictor"
+            << std::setw(14) << "difference" << std::endl;
+  for (double mu : { 1.0, 10.0, 100.0 })
+    for (size_t s : { 2, 3, 5 })
+      {
+        auto rhs = std::make_shared<AutoDiffFunction<VanDerPol,2>>(VanDerPol{mu}, 2);
+        const ButcherTableau & tab = GetTableau(TableauFamily::RadauIIA, s);
+
+        auto run = [&] (const char * name, auto make)
+        {
+          double iter[2];
+          Vector<> y[2] = { Vector<>(2), Vector<>(2) };
+          for (int predict = 0; predict < 2; predict++)
+            {
+              auto stepper = make();
+              stepper.usePredictor(predict);
+              iter[predict] = IterationsPerStep(stepper, y[predict]);
+            }
+          std::cout << std::setw(6) << mu << std::setw(4) << s << std::setw(10) << name
+                    << std::setw(12) << iter[0] << std::setw(12) << iter[1]
+                    << std::setw(14) << std::max(std::abs(y[0](0) - y[1](0)), std::abs(y[0](1) - y[1](1)))
+                    << std::endl;
+        };
+        run("full", [&] { return ImplicitRungeKutta(rhs, tab.a, tab.b, tab.c); });
+        run("simpl.", [&] { return ParallelImplicitRungeKutta(rhs, tab, false); });
+      }
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <SDC.hpp>
+
+
+using namespace ASC_ode;
+
+
+// chain of N nonlinear (Duffing) springs, y = (positions, velocities)
+template <size_t N>
+struct DuffingChain
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i < N; i++)
+      {
+        T left = x(i);
+        if (i > 0) left = x(i) - x(i-1);
+        T right = -x(i);
+        if (i+1 < N) right = x(i+1) - x(i);
+        f(i) = x(N+i);
+        f(N+i) = right + right*right*right - left - left*left*left;
+      }
+  }
+};
+
+
+// Van der Pol oscillator x' = v, v' = mu (1 - x^2) v - x, stiff for large mu
+struct VanDerPol
+{
+  double mu;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = x(1);
+    f(1) = mu * (1 - x(0)*x(0)) * x(1) - x(0);
+  }
+};
+
+
+/*
+  Non-stiff Duffing chain: pipelined slices against the serial ones.
+  Stiff Van der Pol (mu = 1000, t in [0, 1]): serial and pipelined
+  slices against a fine Radau IIA reference, for several step counts.
+*/
+int main()
+{
+  constexpr size_t N = 50;
+  auto rhs = std::make_shared<AutoDiffFunction<DuffingChain<N>, 2*N>>(DuffingChain<N>(), 2*N);
+
+  Vector<> y0(2*N);
+  y0 = 0.0;
+  for (size_t i = 0; i < N; i++)
+    y0(i) = 0.3 * std::sin(M_PI * (i+1) / (N+1));
+
+  size_t slices = std::max<size_t>(4, ThreadPool::global().numThreads());
+  std::cout << "threads: " << ThreadPool::global().numThreads() << ", slices: " << slices << std::endl;
+  std::cout << std::setw(10) << "sweeper" << std::setw(10) << "mode" << std::setw(10) << "evals"
+            << std::setw(14) << "residual" << std::setw(14) << "|y - y_ser|" << std::setw(12) << "time [ms]" << std::endl;
+
+  for (SDCSweeper sweeper : { SDCSweeper::ExplicitEuler, SDCSweeper::ImplicitEuler })
+    {
+      Vector<> yserial(2*N);
+      for (bool parallel : { false, true })
+        {
+          SpectralDeferredCorrection sdc(rhs, TableauFamily::RadauIIA, 3, 0, sweeper, slices, parallel);
+          Vector<> y = y0;
+          auto start = std::chrono::steady_clock::now();
+          for (int i = 0; i < 20; i++)
+            sdc.DoStep(0.5, y);
+          auto end = std::chrono::steady_clock::now();
+          if (!parallel) yserial = y;
+
+          std::cout << std::setw(10) << (sweeper == SDCSweeper::ExplicitEuler ? "explicit" : "implicit")
+                    << std::setw(10) << (parallel ? "parallel" : "serial")
+                    << std::setw(10) << sdc.numEvaluations() << std::setw(14) << sdc.residual()
+                    << std::setw(14) << norm(y - yserial)
+                    << std::setw(12) << std::chrono::duration<double, std::milli>(end-start).count()
+                    << std::endl;
+        }
+    }
+
+  std::cout << std::endl << "stiff Van der Pol, mu = 1000, t in [0,1], Radau IIA nodes 3, implicit sweeps" << std::endl;
+  auto vdp = std::make_shared<AutoDiffFunction<VanDerPol,2>>(VanDerPol{1000}, 2);
+  Vector<> v0(2), vref(2);
+  v0(0) = 2;
+  v0(1) = 0;
+  {
+    const ButcherTableau & radau = GetTableau(TableauFamily::RadauIIA, 5);
+    ImplicitRungeKutta reference(vdp, radau.a, radau.b, radau.c);
+    vref = v0;
+    for (int i = 0; i < 2000; i++)
+      reference.DoStep(1.0 / 2000, vref);
+  }
+
+  std::cout << std::setw(8) << "slices" << std::setw(8) << "steps" << std::setw(14) << "serial err"
+            << std::setw(14) << "parallel err" << std::setw(12) << "fallbacks" << std::endl;
+  bool ok = true;
+  for (size_t sl : { 4, 8 })
+    for (int steps : { 5, 10, 20, 40 })
+      {
+        double err[2];
+        size_t fallbacks = 0;
+        for (bool parallel : { false, true })
+          {
+            SpectralDeferredCorrection sdc(vdp, TableauFamily::RadauIIA, 3, 0, SDCSweeper::ImplicitEuler, sl, parallel);
+            Vector<> v = v0;
+            try
+              {
+                for (int i = 0; i < steps; i++)
+                  sdc.DoStep(1.0 / steps, v);
+                err[parallel] = norm(v - vref);
+              }
+            catch (const std::domain_error & e)
+              {
+                err[parallel] = std::numeric_limits<double>::infinity();
+              }
+            if (parallel) fallbacks = sdc.numFallbacks();
+          }
+        std::cout << std::setw(8) << sl << std::setw(8) << steps << std::setw(14) << err[0]
+                  << std::setw(14) << err[1] << std::setw(12) << fallbacks << std::endl;
+        // the pipelined slices must be as accurate as the serial ones
+        if (!(err[1] <= 10 * err[0] + 1e-8))
+          ok = false;
+      }
+
+  if (!ok)
+    {
+      std::cout << "pipelined slices fail where the serial ones succeed" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
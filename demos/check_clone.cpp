@@ -0,0 +1,134 @@
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+
+
+using namespace ASC_ode;
+
+
+// forces of two masses on a chain of three (cubic) springs between walls
+struct Springs
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    T s0 = x(0), s1 = x(1) - x(0), s2 = -x(1);
+    f(0) = -s0 - 0.3*s0*s0*s0 + s1 + 0.3*s1*s1*s1;
+    f(1) = -s1 - 0.3*s1*s1*s1 + s2 + 0.3*s2*s2*s2;
+  }
+};
+
+// velocity dependent force, a van der Pol-like drive of the first mass
+struct Drive
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = (1 - x(0)*x(0)) * x(2);
+    f(1) = T(0.0);
+  }
+};
+
+
+// y = (x_1, x_2, v_1, v_2): x' = v, v' = k springs(x) + k drive(x, v),
+// with the same Parameter k in both terms
+std::shared_ptr<NonlinearFunction> MakeRhs (std::shared_ptr<Parameter> k)
+{
+  auto vel = std::make_shared<EmbedFunction>(std::make_shared<IdentityFunction>(2), 2, 4, 0, 4);
+  auto springs = std::make_shared<EmbedFunction>(std::make_shared<AutoDiffFunction<Springs,2>>(Springs()), 0, 4, 2, 4);
+  auto drive = std::make_shared<EmbedFunction>(std::make_shared<AutoDiffFunction<Drive,4>>(Drive(), 2), 0, 4, 2, 4);
+  return vel + (k * springs + k * drive);
+}
+
+void Run (TimeStepper & stepper, VectorView<double> y)
+{
+  y(0) = 0.5; y(1) = -0.2; y(2) = 0; y(3) = 0.1;
+  for (int i = 0; i < 200; i++)
+    stepper.DoStep(0.01, y);
+}
+
+
+/*
+  Clones of a composed rhs (sums, embeddings, a Parameter used twice)
+  run concurrently in a ParallelFor on 4 threads:
+  - copies by TimeStepper::clone() of an implicit Euler stepper, whose
+    Newton equation holds a ConstantFunction and a Parameter of its
+    own, must reproduce the serial result exactly, also after the
+    Parameter of the original has been changed;
+  - an ensemble of cloned graphs with its own value of k each, set
+    through the CloneMap of the clone, must reproduce serial runs of
+    freshly built graphs, which shows that both uses of k still share
+    one Parameter in every clone.
+  Returns 1 on any difference.
+*/
+int main()
+{
+  ThreadPool::global().setNumThreads(4);
+  constexpr size_t copies = 16;
+  bool ok = true;
+
+  auto k = std::make_shared<Parameter>(2.0);
+  auto rhs = MakeRhs(k);
+  ImplicitEuler stepper(rhs);
+
+  Vector<> yref(4);
+  {
+    auto serial = stepper.clone();
+    Run(*serial, yref);
+  }
+
+  std::vector<std::unique_ptr<TimeStepper>> steppers;
+  for (size_t i = 0; i < copies; i++)
+    steppers.push_back(stepper.clone());
+  k->set(3.0);    // the clones keep k = 2
+
+  std::vector<Vector<>> results(copies, Vector<>(4));
+  ParallelFor(copies, [&](size_t i) { Run(*steppers[i], results[i]); });
+
+  Vector<> ychanged(4);
+  Run(stepper, ychanged);
+
+  double diff = 0;
+  for (auto & y : results)
+    for (size_t j = 0; j < 4; j++)
+      diff = std::max(diff, std::abs(y(j) - yref(j)));
+  std::cout << "TimeStepper::clone, " << copies << " copies: max difference to serial " << diff
+            << ", original after k = 3 differs by " << std::abs(ychanged(0) - yref(0)) << std::endl;
+  if (diff != 0 || ychanged(0) == yref(0))
+    ok = false;
+
+  // ensemble over k, each task with its own clone
+  std::vector<Vector<>> ensemble(copies, Vector<>(4));
+  auto kvalue = [](size_t i) { return 0.5 + 0.25 * i; };
+  ParallelFor(copies, [&](size_t i)
+  {
+    CloneMap map;
+    auto rhsCopy = CloneShared(rhs, map);
+    auto kCopy = CloneShared(k, map);    // the copy made for the graph
+    kCopy->set(kvalue(i));
+    ImplicitEuler s(rhsCopy);
+    Run(s, ensemble[i]);
+  });
+
+  double ediff = 0;
+  for (size_t i = 0; i < copies; i++)
+    {
+      ImplicitEuler fresh(MakeRhs(std::make_shared<Parameter>(kvalue(i))));
+      Vector<> y(4);
+      Run(fresh, y);
+      for (size_t j = 0; j < 4; j++)
+        ediff = std::max(ediff, std::abs(ensemble[i](j) - y(j)));
+    }
+  std::cout << "ensemble over k, " << copies << " cloned graphs: max difference to fresh graphs " << ediff << std::endl;
+  if (ediff != 0)
+    ok = false;
+
+  if (!ok)
+    {
+      std::cout << "clones do not reproduce the serial results" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
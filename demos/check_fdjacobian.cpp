@@ -0,0 +1,86 @@
+#include <iostream>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <fdjacobian.hpp>
+
+
+using namespace ASC_ode;
+
+
+// one-dimensional Brusselator with diffusion on N grid points,
+// y = (u_1, v_1, ..., u_N, v_N); the Jacobian has bandwidth 2
+template <size_t N>
+struct Brusselator
+{
+  double alpha = 0.02;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    double c = alpha * (N+1) * (N+1);
+    for (size_t i = 0; i < N; i++)
+      {
+        T u = x(2*i), v = x(2*i+1);
+        T ul = i > 0 ? x(2*i-2) : T(1.0), vl = i > 0 ? x(2*i-1) : T(3.0);
+        T ur = i+1 < N ? x(2*i+2) : T(1.0), vr = i+1 < N ? x(2*i+3) : T(3.0);
+        f(2*i) = 1 + u*u*v - 4*u + c * (ul - 2*u + ur);
+        f(2*i+1) = 3*u - u*u*v + c * (vl - 2*v + vr);
+      }
+  }
+};
+
+
+/*
+  The coloured finite difference Jacobian of the Brusselator (serial and
+  on the thread pool, repeated at new points with the pattern kept)
+  against the exact Jacobian by AutoDiff. Returns 1 if an entry differs
+  by more than 1e-6 relative to the largest entry, or if the colouring
+  needs more than 5 colours (the bandwidth is 2).
+*/
+int main()
+{
+  constexpr size_t N = 40;
+  auto exact = std::make_shared<AutoDiffFunction<Brusselator<N>, 2*N>>(Brusselator<N>(), 2*N);
+
+  bool ok = true;
+  for (bool parallel : { false, true })
+    {
+      FiniteDifferenceJacobian fd(exact, parallel);
+      for (int point = 0; point < 3; point++)
+        {
+          Vector<> x(2*N), f(2*N), fex(2*N);
+          for (size_t i = 0; i < N; i++)
+            {
+              x(2*i) = 1 + (0.5 + point) * std::sin(2 * M_PI * (i+1) / (N+1));
+              x(2*i+1) = 3 - 0.3 * point * std::cos(M_PI * (i+1) / (N+1));
+            }
+
+          Matrix<> jac(2*N, 2*N), jacex(2*N, 2*N);
+          fd.evaluateWithDeriv(x, f, jac);
+          exact->evaluateWithDeriv(x, fex, jacex);
+
+          double err = 0, scale = 0, ferr = 0;
+          for (size_t i = 0; i < 2*N; i++)
+            {
+              ferr = std::max(ferr, std::abs(f(i) - fex(i)));
+              for (size_t j = 0; j < 2*N; j++)
+                {
+                  err = std::max(err, std::abs(jac(i,j) - jacex(i,j)));
+                  scale = std::max(scale, std::abs(jacex(i,j)));
+                }
+            }
+
+          std::cout << (parallel ? "parallel" : "serial  ") << ", point " << point
+                    << ": colours " << fd.numColors()
+                    << ", max |J_fd - J| = " << err << ", max |J| = " << scale << std::endl;
+          if (err > 1e-6 * scale || ferr != 0 || fd.numColors() > 5)
+            ok = false;
+        }
+    }
+
+  if (!ok)
+    {
+      std::cout << "coloured finite differences do not match the AutoDiff Jacobian" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
@@ -0,0 +1,118 @@
+#include <iostream>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <tape.hpp>
+
+
+using namespace ASC_ode;
+
+
+// 6 functions of 19 unknowns using all elementary functions of the
+// AutoDiff types; T_energy is the weighted sum w . f
+struct Elementary
+{
+  static constexpr size_t n = 19, m = 6;
+  double w[m] = { 1.0, -0.5, 0.3, 2.0, -1.2, 0.7 };
+
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i < m; i++)
+      f(i) = T(0.0);
+    for (size_t j = 0; j < n; j++)
+      {
+        T xj = x(j), xk = x((j+7) % n), xl = x((j+12) % n);
+        f(0) = f(0) + sin(xj * xk) + cos(xl) / (2 + xj*xj);
+        f(1) = f(1) + exp(0.3 * xj - 0.2 * xl) * tan(0.2 * xk);
+        f(2) = f(2) + log(3 + xj * xk) + sqrt(1 + xl*xl);
+        f(3) = f(3) + pow(1.5 + xj, 2.5) * xk - pow(2.0, xl) / (1 + xk*xk);
+      }
+    f(4) = x(0) * x(18) - x(9) / (1.5 + x(3));
+    f(5) = -sin(x(5) + x(11) * x(17));
+  }
+
+  template <typename T>
+  T T_energy (VectorView<T> x) const
+  {
+    Vector<T> f(m);
+    T_evaluate<T>(x, f);
+    T sum = 0;
+    for (size_t i = 0; i < m; i++)
+      sum = sum + w[i] * f(i);
+    return sum;
+  }
+};
+
+
+/*
+  Hessian of w . f for 19 unknowns (three seeding blocks of 8) by the
+  HyperDual forward mode (evaluateHessian), by forward-over-reverse on
+  the tape (EvaluateHessian), and by central differences of the AutoDiff
+  Jacobian. Returns 1 if the two exact Hessians differ by more than
+  1e-12, a Hessian is not symmetric, or the central differences deviate
+  by more than 1e-6, all relative to the largest entry.
+*/
+int main()
+{
+  constexpr size_t n = Elementary::n, m = Elementary::m;
+  Elementary model;
+  DynAutoDiffFunction<Elementary> func(model, n, m);
+
+  Vector<> x(n), w(m);
+  for (size_t j = 0; j < n; j++)
+    x(j) = 0.4 * std::sin(1.3 * j + 0.2);
+  for (size_t i = 0; i < m; i++)
+    w(i) = model.w[i];
+
+  Matrix<> hyperdual(n, n), tape(n, n), fd(n, n);
+  func.evaluateHessian(x, w, hyperdual);
+  double energy = EvaluateHessian(model, x, tape);
+
+  // column j: (w^T J(x + eps e_j) - w^T J(x - eps e_j)) / (2 eps)
+  double eps = 1e-5;
+  Vector<> xp(n), f(m);
+  Matrix<> jp(m, n), jm(m, n);
+  for (size_t j = 0; j < n; j++)
+    {
+      xp = x; xp(j) += eps;
+      func.evaluateWithDeriv(xp, f, jp);
+      xp = x; xp(j) -= eps;
+      func.evaluateWithDeriv(xp, f, jm);
+      for (size_t k = 0; k < n; k++)
+        {
+          double sum = 0;
+          for (size_t i = 0; i < m; i++)
+            sum += w(i) * (jp(i,k) - jm(i,k));
+          fd(k,j) = sum / (2 * eps);
+        }
+    }
+
+  double scale = 0, diff = 0, asym = 0, fderr = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      {
+        scale = std::max(scale, std::abs(hyperdual(i,j)));
+        diff = std::max(diff, std::abs(hyperdual(i,j) - tape(i,j)));
+        asym = std::max({ asym, std::abs(hyperdual(i,j) - hyperdual(j,i)), std::abs(tape(i,j) - tape(j,i)) });
+        fderr = std::max(fderr, std::abs(hyperdual(i,j) - fd(i,j)));
+      }
+
+  Vector<> fx(m);
+  func.evaluate(x, fx);
+  double wf = 0;
+  for (size_t i = 0; i < m; i++)
+    wf += w(i) * fx(i);
+
+  std::cout << "n = " << n << ", w . f = " << wf << " (tape " << energy << "), max |H| = " << scale << std::endl
+            << "max |H_hyperdual - H_tape| = " << diff << std::endl
+            << "max |H - H^T| = " << asym << std::endl
+            << "max |H_hyperdual - H_fd| = " << fderr << std::endl;
+
+  if (diff > 1e-12 * scale || asym > 1e-12 * scale || fderr > 1e-6 * scale
+      || std::abs(energy - wf) > 1e-12 * std::abs(wf))
+    {
+      std::cout << "Hessians do not match" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
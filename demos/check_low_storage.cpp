@@ -0,0 +1,307 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+#include <nonlinfunc.hpp>
+#include <LowStorageRK.hpp>
+
+
+using namespace ASC_ode;
+
+
+// Kepler problem y = (q1, q2, p1, p2), period 2 pi
+struct Kepler
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    T r2 = x(0)*x(0) + x(1)*x(1);
+    T r3inv = 1.0 / (r2 * sqrt(r2));
+    f(0) = x(2);
+    f(1) = x(3);
+    f(2) = -x(0) * r3inv;
+    f(3) = -x(1) * r3inv;
+  }
+};
+
+
+// start in the pericenter of an orbit with eccentricity e
+void InitialValue (double e, VectorView<double> y)
+{
+  y(0) = 1 - e;
+  y(1) = 0;
+  y(2) = 0;
+  y(3) = std::sqrt((1 + e) / (1 - e));
+}
+
+double Error (VectorView<double> y, VectorView<double> y0)
+{
+  double err = 0;
+  for (size_t i = 0; i < y.size(); i++)
+    err = std::max(err, std::abs(y(i) - y0(i)));
+  return err;
+}
+
+
+/*
+  Order conditions. A low-storage step is run on coefficient vectors
+  (y_n, k_0, ..., k_s-1) instead of values, which gives its Butcher
+  tableau; then sum_i b_i Phi_i(t) = 1 / gamma(t) is checked for every
+  rooted tree t up to the order, with the elementary weights
+    Phi_i(t) = prod over the subtrees t_k of sum_j a_ij Phi_j(t_k).
+*/
+struct Tableau
+{
+  std::vector<std::vector<double>> A;
+  std::vector<double> b, bhat;    // bhat empty without estimate
+  double stageConsistency = 0;    // max |coefficient of y_n in a stage - 1|
+};
+
+Tableau ButcherOf (const LowStorageScheme & s)
+{
+  size_t st = s.A.size();
+  Tableau t;
+  std::vector<double> y(st+1, 0.0), dy(st+1, 0.0);
+  y[0] = 1;
+  for (size_t i = 0; i < st; i++)
+    {
+      t.A.emplace_back(y.begin()+1, y.end());
+      for (size_t j = 0; j <= st; j++)
+        {
+          dy[j] = (i > 0 ? s.A[i] * dy[j] : 0) + (j == i+1 ? 1 : 0);
+          y[j] += s.B[i] * dy[j];
+        }
+    }
+  t.b.assign(y.begin()+1, y.end());
+  if (!s.e.empty())
+    for (size_t i = 0; i < st; i++)
+      t.bhat.push_back(t.b[i] - s.e[i]);
+  return t;
+}
+
+Tableau ButcherOf (const ThreeSStarScheme & s)
+{
+  size_t st = s.beta.size();
+  Tableau t;
+  std::vector<double> s1(st+1, 0.0), s2(st+1, 0.0), s3(st+1, 0.0);
+  s1[0] = s3[0] = 1;
+  for (size_t i = 0; i < st; i++)
+    {
+      t.stageConsistency = std::max(t.stageConsistency, std::abs(s1[0] - 1));
+      t.A.emplace_back(s1.begin()+1, s1.end());
+      for (size_t j = 0; j <= st; j++)
+        {
+          s2[j] += s.delta[i] * s1[j];
+          s1[j] = s.gamma1[i] * s1[j] + s.gamma2[i] * s2[j] + s.gamma3[i] * s3[j]
+            + (j == i+1 ? s.beta[i] : 0);
+        }
+    }
+  t.b.assign(s1.begin()+1, s1.end());
+  if (s.delta.size() == st+2)
+    {
+      double sum = 0;
+      for (double d : s.delta)
+        sum += d;
+      for (size_t i = 0; i < st; i++)
+        t.bhat.push_back((s2[i+1] + s.delta[st] * s1[i+1] + s.delta[st+1] * s3[i+1]) / sum);
+    }
+  return t;
+}
+
+// rooted trees as lists of subtrees (indices into the list), with their order
+struct Tree
+{
+  std::vector<size_t> children;
+  int order;
+};
+
+std::vector<Tree> TreesUpTo (int p)
+{
+  std::vector<Tree> trees { { {}, 1 } };
+  for (int n = 2; n <= p; n++)
+    {
+      // children in non-decreasing index order, so each tree appears once
+      std::function<void(std::vector<size_t>&, size_t, int)> extend =
+        [&](std::vector<size_t> & ch, size_t first, int rest)
+      {
+        if (rest == 0)
+          {
+            trees.push_back({ ch, n });
+            return;
+          }
+        for (size_t k = first; k < trees.size() && trees[k].order < n; k++)
+          if (trees[k].order <= rest)
+            {
+              ch.push_back(k);
+              extend(ch, k, rest - trees[k].order);
+              ch.pop_back();
+            }
+      };
+      std::vector<size_t> ch;
+      extend(ch, 0, n-1);
+    }
+  return trees;
+}
+
+// max over trees of order <= p of |b . Phi(t) - 1/gamma(t)|
+double OrderResidual (const Tableau & t, const std::vector<double> & b, int p)
+{
+  auto trees = TreesUpTo(p);
+  size_t s = b.size();
+  std::vector<std::vector<double>> phi(trees.size());
+  std::vector<double> gamma(trees.size());
+  double res = 0;
+  for (size_t k = 0; k < trees.size(); k++)
+    {
+      phi[k].assign(s, 1.0);
+      gamma[k] = trees[k].order;
+      for (size_t c : trees[k].children)
+        {
+          gamma[k] *= gamma[c];
+          for (size_t i = 0; i < s; i++)
+            {
+              double sum = 0;
+              for (size_t j = 0; j < s; j++)
+                sum += t.A[i][j] * phi[c][j];
+              phi[k][i] *= sum;
+            }
+        }
+      double bphi = 0;
+      for (size_t i = 0; i < s; i++)
+        bphi += b[i] * phi[k][i];
+      res = std::max(res, std::abs(bphi - 1 / gamma[k]));
+    }
+  return res;
+}
+
+
+struct Method
+{
+  std::string name;
+  int order;
+  bool estimate;
+  std::function<std::unique_ptr<TimeStepper>(std::shared_ptr<NonlinearFunction>, double)> make;
+  Tableau tableau;
+};
+
+
+/*
+  The order conditions of the coefficients, for the solution up to the
+  order and for the embedded solution up to one order less, then the
+  observed orders of the low-storage schemes on one period of the Kepler
+  orbit: the global error with N, 2N, 4N steps, and the local error
+  estimate of one step with h, h/2, h/4 from the pericenter, which must
+  shrink like h^order for an embedded method of one order less.
+  Returns 1 if an order condition is violated by more than 1e-12, or if
+  an observed order is more than 0.3 below the nominal one.
+*/
+int main()
+{
+  std::vector<Method> methods {
+    { "Williamson3 (2N)", 3, true, [](auto f, double tol) {
+        return std::make_unique<LowStorageRungeKutta>(f, Williamson3Scheme(), tol); },
+      ButcherOf(Williamson3Scheme()) },
+    { "CarpenterKennedy4 (2N)", 4, true, [](auto f, double tol) {
+        return std::make_unique<LowStorageRungeKutta>(f, CarpenterKennedy4Scheme(), tol); },
+      ButcherOf(CarpenterKennedy4Scheme()) },
+    { "3S* 4", 4, false, [](auto f, double tol) {
+        return std::make_unique<LowStorage3SRungeKutta>(f, ThreeSStar4Scheme(), tol); },
+      ButcherOf(ThreeSStar4Scheme()) },
+    { "3S*+ 4(3)", 4, true, [](auto f, double tol) {
+        return std::make_unique<LowStorage3SRungeKutta>(f, ThreeSStarPlus43Scheme(), tol); },
+      ButcherOf(ThreeSStarPlus43Scheme()) },
+    { "3S*+ 5(4)", 5, true, [](auto f, double tol) {
+        return std::make_unique<LowStorage3SRungeKutta>(f, ThreeSStarPlus54Scheme(), tol); },
+      ButcherOf(ThreeSStarPlus54Scheme()) },
+  };
+
+  bool ok = true;
+  std::cout << "order conditions: max |b . Phi(t) - 1/gamma(t)| over trees up to the order" << std::endl;
+  std::cout << std::setw(24) << "method" << std::setw(8) << "order" << std::setw(14) << "solution"
+            << std::setw(14) << "embedded" << std::setw(14) << "stages" << std::endl;
+  for (auto & m : methods)
+    {
+      const Tableau & t = m.tableau;
+      double res = OrderResidual(t, t.b, m.order);
+      double resHat = t.bhat.empty() ? 0 : OrderResidual(t, t.bhat, m.order-1);
+      std::cout << std::setw(24) << m.name << std::setw(8) << m.order << std::setw(14) << res
+                << std::setw(14) << resHat << std::setw(14) << t.stageConsistency << std::endl;
+      if (!(res < 1e-12 && resHat < 1e-12 && t.stageConsistency < 1e-12))
+        ok = false;
+    }
+
+  double e = 0.5;
+  auto rhs = std::make_shared<AutoDiffFunction<Kepler,4>>(Kepler(), 4);
+  Vector<> y0(4);
+  InitialValue(e, y0);
+
+  auto estimate = [](TimeStepper & stepper) -> double
+  {
+    if (auto s = dynamic_cast<LowStorageRungeKutta*>(&stepper)) return s->error();
+    return dynamic_cast<LowStorage3SRungeKutta&>(stepper).error();
+  };
+
+  std::cout << std::endl << "Kepler orbit, e = " << e << std::endl;
+  std::cout << std::setw(24) << "method" << std::setw(8) << "order"
+            << std::setw(14) << "error(800)" << std::setw(10) << "observed"
+            << std::setw(14) << "estimate" << std::setw(10) << "observed" << std::endl;
+
+  for (auto & m : methods)
+    {
+      double err[3];
+      for (int k = 0; k < 3; k++)
+        {
+          size_t steps = 200 << k;
+          auto stepper = m.make(rhs, 0);
+          Vector<> y = y0;
+          for (size_t i = 0; i < steps; i++)
+            stepper->DoStep(2 * M_PI / steps, y);
+          err[k] = Error(y, y0);
+        }
+      double order = std::log2(err[1] / err[2]);
+      if (order < m.order - 0.3)
+        ok = false;
+
+      std::cout << std::setw(24) << m.name << std::setw(8) << m.order
+                << std::setw(14) << err[2] << std::setw(10) << std::setprecision(3) << order
+                << std::setprecision(6);
+
+      if (m.estimate)
+        {
+          double est[3];
+          for (int k = 0; k < 3; k++)
+            {
+              auto stepper = m.make(rhs, 0);
+              Vector<> y = y0;
+              stepper->DoStep(0.04 / (1 << k), y);
+              est[k] = estimate(*stepper);
+            }
+          double estOrder = std::log2(est[1] / est[2]);
+          if (estOrder < m.order - 0.3)
+            ok = false;
+          std::cout << std::setw(14) << est[2] << std::setw(10) << std::setprecision(3) << estOrder
+                    << std::setprecision(6);
+        }
+      std::cout << std::endl;
+    }
+
+  // adaptive 3S*+ steps: the estimate lives in the registers, 4 vectors in all;
+  // tol bounds the local error per step, not the error after one period
+  for (double tol : { 1e-6, 1e-9 })
+    {
+      auto stepper = std::make_unique<LowStorage3SRungeKutta>(rhs, ThreeSStarPlus54Scheme(), tol);
+      Vector<> y = y0;
+      stepper->DoStep(2 * M_PI, y);
+      std::cout << "adaptive 3S*+ 5(4), tol = " << tol << ": " << stepper->numSteps() << " steps, "
+                << stepper->numRejected() << " rejected, error " << Error(y, y0) << std::endl;
+    }
+
+  if (!ok)
+    {
+      std::cout << "observed order below the nominal order" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
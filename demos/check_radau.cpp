@@ -0,0 +1,114 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <Radau.hpp>
+
+
+using namespace ASC_ode;
+
+
+struct VanDerPol
+{
+  double mu;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = x(1);
+    f(1) = mu * (1 - x(0)*x(0)) * x(1) - x(0);
+  }
+};
+
+// Robertson's chemical kinetics, rate constants 0.04, 1e4, 3e7
+struct Robertson
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = -0.04 * x(0) + 1e4 * x(1) * x(2);
+    f(2) = 3e7 * x(1) * x(1);
+    f(1) = -f(0) - f(2);
+  }
+};
+
+double Error (VectorView<double> y, VectorView<double> yref)
+{
+  double err = 0;
+  for (size_t i = 0; i < y.size(); i++)
+    err = std::max(err, std::abs(y(i) - yref(i)) / std::max(std::abs(yref(i)), 1e-6));
+  return err;
+}
+
+
+/*
+  AdaptiveRadau against reference values: Van der Pol (mu = 10, t in
+  [0, 5]) against a fine 5-stage Radau IIA solution, and Robertson at
+  t = 40 against the values of the Hairer-Wanner test set. Prints the
+  relative error and the rhs evaluations with 3, 5 and 7 fixed stages
+  and with variable order. Returns 1 if an error exceeds 100 tol, or if
+  the variable order needs 25% more evaluations than the best fixed
+  number of stages (which a user does not know in advance).
+*/
+int main()
+{
+  bool ok = true;
+  auto check = [&] (const char * name, std::shared_ptr<NonlinearFunction> rhs,
+                    VectorView<double> y0, double tend, VectorView<double> yref, double atolFactor)
+  {
+    std::cout << name << std::endl;
+    std::cout << std::setw(8) << "rtol" << std::setw(12) << "stages"
+              << std::setw(14) << "error" << std::setw(8) << "evals" << std::endl;
+    for (double tol : { 1e-4, 1e-6, 1e-8, 1e-10 })
+      {
+        size_t bestFixed = size_t(-1);
+        for (size_t stages : { 3, 5, 7, 0 })
+          {
+            bool variable = stages == 0;
+            AdaptiveRadau radau(rhs, tol, atolFactor * tol, variable ? 3 : stages, variable);
+            Vector<> y = y0;
+            radau.DoStep(tend, y);
+            double err = Error(y, yref);
+            size_t evals = radau.numEvaluations();
+
+            std::cout << std::setw(8) << tol << std::setw(12);
+            if (variable) std::cout << "variable";
+            else std::cout << stages;
+            std::cout << std::setw(14) << err << std::setw(8) << evals << std::endl;
+
+            if (!(err <= 100 * tol)) ok = false;
+            if (!variable) bestFixed = std::min(bestFixed, evals);
+            else if (evals > 1.25 * bestFixed) ok = false;
+          }
+      }
+  };
+
+  {
+    auto vdp = std::make_shared<AutoDiffFunction<VanDerPol,2>>(VanDerPol{10}, 2);
+    Vector<> y0(2), yref(2);
+    y0(0) = 2; y0(1) = 0;
+    const ButcherTableau & radau = GetTableau(TableauFamily::RadauIIA, 5);
+    ImplicitRungeKutta reference(vdp, radau.a, radau.b, radau.c);
+    yref = y0;
+    for (int i = 0; i < 20000; i++)
+      reference.DoStep(5.0 / 20000, yref);
+    check("Van der Pol, mu = 10, t = 5", vdp, y0, 5, yref, 1);
+  }
+
+  {
+    auto rober = std::make_shared<AutoDiffFunction<Robertson,3>>(Robertson(), 3);
+    Vector<> y0(3), yref(3);
+    y0(0) = 1; y0(1) = 0; y0(2) = 0;
+    yref(0) = 0.7158270687193772;
+    yref(1) = 9.185534764557256e-6;
+    yref(2) = 0.2841637457458577;
+    check("Robertson, t = 40", rober, y0, 40, yref, 1e-4);
+  }
+
+  if (!ok)
+    {
+      std::cout << "error above 100 tol, or variable order more expensive than fixed" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
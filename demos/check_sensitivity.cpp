@@ -0,0 +1,131 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <nonlinfunc.hpp>
+#include <sensitivity.hpp>
+#include <RungeKutta.hpp>
+
+
+using namespace ASC_ode;
+
+
+// hardening spring with its stiffness as own Parameter, y = (x, v):
+// x' = v, v' = -k (x + x^3)
+class Spring : public ParametricFunction
+{
+  std::shared_ptr<Parameter> m_k;
+public:
+  Spring (std::shared_ptr<Parameter> k) : ParametricFunction({ k }), m_k(k) { }
+
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -m_k->get() * (x(0) + x(0)*x(0)*x(0));
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -m_k->get() * (1 + 3*x(0)*x(0));
+  }
+
+  void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+  {
+    dfdp = 0.0;
+    if (&param == m_k.get())
+      dfdp(1) = -(x(0) + x(0)*x(0)*x(0));
+  }
+};
+
+// v' = -v, scaled by the damping Parameter
+struct Damping
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    f(0) = T(0);
+    f(1) = -x(1);
+  }
+};
+
+
+/*
+  Forward sensitivities dy(T)/dk and dy(T)/dc of the damped spring,
+  compared with central differences of whole trajectories of the same
+  stepper. Returns 1 if they differ by more than the difference error.
+*/
+int main()
+{
+  auto k = std::make_shared<Parameter>(2.0);
+  auto c = std::make_shared<Parameter>(0.3);
+  std::vector<std::shared_ptr<Parameter>> params { k, c };
+  auto rhs = std::make_shared<Spring>(k) + c * std::make_shared<AutoDiffFunction<Damping,2>>(Damping());
+
+  Matrix<> a(4,4);
+  a = 0.0;
+  a(1,0) = 0.5; a(2,1) = 0.5; a(3,2) = 1;
+  Vector<> b(4), cc(4);
+  b(0) = 1.0/6; b(1) = 1.0/3; b(2) = 1.0/3; b(3) = 1.0/6;
+  cc(0) = 0; cc(1) = 0.5; cc(2) = 0.5; cc(3) = 1;
+
+  std::vector<std::pair<std::string, SensitivityStepper::StepperFactory>> methods {
+    { "RK4", [&](auto f) { return std::make_unique<ExplicitRungeKutta>(f, a, b, cc); } },
+    { "implicit Euler", [](auto f) { return std::make_unique<ImplicitEuler>(f); } },
+    { "Crank-Nicolson", [](auto f) { return std::make_unique<CrankNicolson>(f); } },
+    { "Gauss2", [](auto f) { return std::make_unique<ImplicitRungeKutta>(f, Gauss2a, Gauss2b, Gauss2c); } },
+  };
+
+  size_t steps = 100;
+  double tau = 0.05, eps = 1e-5;
+  Vector<> y0(2);
+  y0(0) = 1;
+  y0(1) = 0;
+
+  bool ok = true;
+  for (auto & [name, make] : methods)
+    {
+      SensitivityStepper sens(rhs, params, make);
+      Vector<> y = y0;
+      for (size_t i = 0; i < steps; i++)
+        sens.DoStep(tau, y);
+
+      double err = 0, scale = 0;
+      for (size_t p = 0; p < params.size(); p++)
+        {
+          double p0 = params[p]->get();
+          Vector<> yp = y0, ym = y0;
+          params[p]->set(p0 + eps);
+          auto stepperp = make(rhs);
+          for (size_t i = 0; i < steps; i++)
+            stepperp->DoStep(tau, yp);
+          params[p]->set(p0 - eps);
+          auto stepperm = make(rhs);
+          for (size_t i = 0; i < steps; i++)
+            stepperm->DoStep(tau, ym);
+          params[p]->set(p0);
+
+          for (size_t i = 0; i < 2; i++)
+            {
+              double fd = (yp(i) - ym(i)) / (2*eps);
+              err = std::max(err, std::abs(sens.sensitivity(p)(i) - fd));
+              scale = std::max(scale, std::abs(fd));
+            }
+        }
+
+      std::cout << std::setw(16) << name << ": max |dy/dp - central difference| = " << err
+                << ", max |dy/dp| = " << scale << std::endl;
+      if (err > 1e-7 * scale)
+        ok = false;
+    }
+
+  if (!ok)
+    {
+      std::cout << "sensitivities do not match central differences" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
@@ -0,0 +1,91 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <sparseautodiff.hpp>
+
+
+using namespace ASC_ode;
+
+
+// chain with nearest and next-nearest neighbour coupling through
+// transcendental terms; the last row couples all unknowns, so its
+// derivatives do not fit into the K pairs inside SparseAutoDiff<K>
+struct CoupledChain
+{
+  size_t n;
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i+1 < n; i++)
+      {
+        T left = i > 0 ? x(i-1) : T(0.0);
+        T right = x(i+1);
+        T far = i+2 < n ? x(i+2) : T(1.0);
+        f(i) = sin(x(i) * right) + exp(0.1 * left) / (2 + cos(far))
+          - sqrt(1 + x(i)*x(i)) + pow(x(i), 3.0) * log(2 + right*right) - tan(0.1 * left);
+      }
+    T sum = 0;
+    for (size_t i = 0; i < n; i++)
+      sum = sum + x(i) * x(i) / (i+1);
+    f(n-1) = sum;
+  }
+};
+
+
+/*
+  Jacobian by SparseAutoDiff (CSR SparseOperator) against the dense
+  Jacobian by DynAutoDiffFunction, on a 2000-unknown chain whose last
+  row couples all unknowns (heap storage beyond 4 pairs). Returns 1 if
+  an entry differs by more than 1e-14 relative to the largest entry,
+  or if the sparse values differ.
+*/
+int main()
+{
+  size_t n = 2000;
+  CoupledChain chain { n };
+  auto dense = std::make_shared<DynAutoDiffFunction<CoupledChain>>(chain, n, n);
+  auto sparse = std::make_shared<SparseAutoDiffFunction<CoupledChain, 4>>(chain, n, n);
+
+  Vector<> x(n);
+  for (size_t i = 0; i < n; i++)
+    x(i) = 0.5 * std::sin(0.37 * i) + 0.1;
+
+  Vector<> fd(n), fs(n);
+  Matrix<> jd(n, n), js(n, n);
+  auto start = std::chrono::steady_clock::now();
+  dense->evaluateWithDeriv(x, fd, jd);
+  auto mid = std::chrono::steady_clock::now();
+  auto op = sparse->evaluateWithDerivOp(x, fs);
+  auto end = std::chrono::steady_clock::now();
+  js = 0.0;
+  op->assemble(js);
+
+  double err = 0, scale = 0, ferr = 0;
+  size_t nze = 0;
+  for (size_t i = 0; i < n; i++)
+    {
+      ferr = std::max(ferr, std::abs(fs(i) - fd(i)));
+      for (size_t j = 0; j < n; j++)
+        {
+          err = std::max(err, std::abs(js(i,j) - jd(i,j)));
+          scale = std::max(scale, std::abs(jd(i,j)));
+          if (jd(i,j) != 0) nze++;
+        }
+    }
+
+  std::cout << "n = " << n << ", nonzeros " << nze << " (sparse pattern "
+            << std::dynamic_pointer_cast<SparseOperator>(op)->nze() << ")" << std::endl
+            << "max |J_sparse - J_dense| = " << err << ", max |J| = " << scale
+            << ", max |f_sparse - f_dense| = " << ferr << std::endl
+            << "dense AutoDiff " << std::chrono::duration<double, std::milli>(mid-start).count() << " ms, "
+            << "sparse AutoDiff " << std::chrono::duration<double, std::milli>(end-mid).count() << " ms"
+            << std::endl;
+
+  if (err > 1e-14 * scale || ferr != 0)
+    {
+      std::cout << "sparse and dense AutoDiff Jacobians differ" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
@@ -0,0 +1,123 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <tableau.hpp>
+
+
+using namespace ASC_ode;
+
+
+// max over k = 1..p of |sum_i b_i c_i^(k-1) - 1/k|
+double ConditionB (const ButcherTableau & t, int p)
+{
+  double res = 0;
+  for (int k = 1; k <= p; k++)
+    {
+      double sum = 0;
+      for (size_t i = 0; i < t.stages(); i++)
+        sum += t.b(i) * std::pow(t.c(i), k-1);
+      res = std::max(res, std::abs(sum - 1.0 / k));
+    }
+  return res;
+}
+
+// max over k = 1..q and i of |sum_j a_ij c_j^(k-1) - c_i^k / k|
+double ConditionC (const ButcherTableau & t, int q)
+{
+  double res = 0;
+  size_t s = t.stages();
+  for (int k = 1; k <= q; k++)
+    for (size_t i = 0; i < s; i++)
+      {
+        double sum = 0;
+        for (size_t j = 0; j < s; j++)
+          sum += t.a(i,j) * std::pow(t.c(j), k-1);
+        res = std::max(res, std::abs(sum - std::pow(t.c(i), k) / k));
+      }
+  return res;
+}
+
+// max over k = 1..r and j of |sum_i b_i c_i^(k-1) a_ij - b_j (1 - c_j^k) / k|
+double ConditionD (const ButcherTableau & t, int r)
+{
+  double res = 0;
+  size_t s = t.stages();
+  for (int k = 1; k <= r; k++)
+    for (size_t j = 0; j < s; j++)
+      {
+        double sum = 0;
+        for (size_t i = 0; i < s; i++)
+          sum += t.b(i) * std::pow(t.c(i), k-1) * t.a(i,j);
+        res = std::max(res, std::abs(sum - t.b(j) * (1 - std::pow(t.c(j), k)) / k));
+      }
+  return res;
+}
+
+// max_ij |(T diag(lambda) T^-1)_ij - a_ij|
+double Reconstruction (const ButcherTableau & t)
+{
+  size_t s = t.stages();
+  const auto & e = t.eig;
+  double res = 0;
+  for (size_t i = 0; i < s; i++)
+    for (size_t j = 0; j < s; j++)
+      {
+        Complex sum = 0;
+        for (size_t k = 0; k < s; k++)
+          sum += e.t[i*s+k] * e.lambda[k] * e.tinv[k*s+j];
+        res = std::max(res, std::abs(sum - t.a(i,j)));
+      }
+  return res;
+}
+
+
+/*
+  The simplifying conditions B(p), C(q), D(r) of the collocation type
+  families, with the orders of Hairer-Wanner II, Table IV.5.13:
+    Gauss           B(2s)    C(s)     D(s)
+    Radau IIA       B(2s-1)  C(s)     D(s-1)
+    Lobatto IIIA    B(2s-2)  C(s)     D(s-2)
+    Lobatto IIIB    B(2s-2)  C(s-2)   D(s)
+    Lobatto IIIC    B(2s-2)  C(s-1)   D(s-1)
+  for up to 16 stages, and the reconstruction of a from its stored eigen
+  decomposition. Returns 1 if a condition is violated by more than 1e-13,
+  or the reconstruction error exceeds 1e-8; the latter grows with the
+  condition of the eigenvectors, to about 3e-10 at s = 16.
+*/
+int main()
+{
+  struct Family { const char * name; TableauFamily family; size_t minStages; int b, c, d; };
+  Family families[] = {
+    { "Gauss",        TableauFamily::GaussLegendre, 1, 0, 0, 0 },
+    { "Radau IIA",    TableauFamily::RadauIIA,      1, -1, 0, -1 },
+    { "Lobatto IIIA", TableauFamily::LobattoIIIA,   2, -2, 0, -2 },
+    { "Lobatto IIIB", TableauFamily::LobattoIIIB,   2, -2, -2, 0 },
+    { "Lobatto IIIC", TableauFamily::LobattoIIIC,   2, -2, -1, -1 },
+  };
+
+  bool ok = true;
+  std::cout << std::setw(14) << "family" << std::setw(4) << "s"
+            << std::setw(12) << "B" << std::setw(12) << "C" << std::setw(12) << "D"
+            << std::setw(12) << "T L T^-1" << std::endl;
+  for (auto & f : families)
+    for (size_t s = f.minStages; s <= 16; s++)
+      {
+        const ButcherTableau & t = GetTableau(f.family, s);
+        int si = int(s);
+        double b = ConditionB(t, 2*si + f.b), c = ConditionC(t, si + f.c), d = ConditionD(t, si + f.d);
+        double rec = Reconstruction(t);
+        bool good = b < 1e-13 && c < 1e-13 && d < 1e-13 && rec < 1e-8;
+        if (!good) ok = false;
+        if (!good || s % 4 == 0 || s == f.minStages)
+          std::cout << std::setw(14) << f.name << std::setw(4) << s << std::setprecision(2)
+                    << std::setw(12) << b << std::setw(12) << c << std::setw(12) << d
+                    << std::setw(12) << rec << std::setprecision(6) << std::endl;
+      }
+
+  if (!ok)
+    {
+      std::cout << "simplifying condition violated or eigen decomposition inaccurate" << std::endl;
+      return 1;
+    }
+  std::cout << "ok" << std::endl;
+}
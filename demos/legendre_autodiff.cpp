@@ -1,42 +1,31 @@
 #include <iostream>
-#include "autodiff.hpp"
 #include <fstream>
-#include <vector>
+#include <legendre.hpp>
 
 
 using namespace ASC_ode;
 
-template <typename T>
-std::vector<T> LegendrePolynomials(int n, T x) {
-    std::vector<T> P(n + 1);
-    if (n >= 0) P[0] = T(1);
-    if (n >= 1) P[1] = x;
-
-    for (int k = 2; k <= n; ++k) {
-        P[k] = ((T(2*k - 1) * x * P[k-1]) - T(k - 1) * P[k-2]) / T(k);
-    }
-
-    return P;
-}
-
 
 int main()
 {
- std::ofstream out("Legendre/legendre.csv");
+    std::ofstream out("Legendre/legendre.csv");
     out << "x,P0,dP0_dx,P1,dP1_dx,P2,dP2_dx,P3,dP3_dx,P4,dP4_dx,P5,dP5_dx\n";
 
-    for (double xv = -1; xv <= 1.00001; xv += 0.01) {
-        AutoDiff<1> x = Variable<0>(xv);
+    // all points at once, the recurrence runs in SIMD lanes
+    size_t order = 5, npoints = 201;
+    Vector<> x(npoints);
+    for (size_t i = 0; i < npoints; i++)
+        x(i) = -1 + 0.01 * i;
 
-        out << xv;
-        auto P = LegendrePolynomials(5, x);
+    Matrix<> P(order+1, npoints), dP(order+1, npoints);
+    LegendrePolynomials(order, x, P, dP);
 
-        for (int n = 0; n <= 5; n++) {
-            out << "," << P[n].value()
-                << "," << P[n].deriv()[0];
-        }
+    for (size_t i = 0; i < npoints; i++) {
+        out << x(i);
+        for (size_t n = 0; n <= order; n++)
+            out << "," << P(n, i) << "," << dP(n, i);
         out << "\n";
     }
     out.close();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,148 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <ExplicitRK.hpp>
+#include <Radau.hpp>
+#include <Splitting.hpp>
+
+
+using namespace ASC_ode;
+
+
+/*
+  Chain of N masses between two walls, y = (positions, velocities, t):
+  stiff linear springs, gravity and a periodic force on the last mass,
+  and weak damping. Each process is a separate part of the splitting.
+*/
+constexpr size_t N = 10;
+constexpr double stiffness = 1e4, gravity = 9.81, damping = 0.5;
+
+// y' = (v, -K x) on (positions, velocities)
+struct Springs
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i < N; i++)
+      {
+        T left = x(i);
+        if (i > 0) left = x(i) - x(i-1);
+        T right = -x(i);
+        if (i+1 < N) right = x(i+1) - x(i);
+        f(i) = x(N+i);
+        f(N+i) = stiffness * (right - left);
+      }
+  }
+};
+
+// v' = -g + F(t) e_N, t' = 1 on (velocities, t)
+struct Forcing
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    for (size_t i = 0; i+1 < N; i++)
+      f(i) = T(-gravity);
+    f(N-1) = 10 * sin(3 * x(N)) - gravity;
+    f(N) = T(1.0);
+  }
+};
+
+
+// exact flow of the damping v' = -damping v
+class DampingFlow : public TimeStepper
+{
+public:
+  using TimeStepper::TimeStepper;
+  void DoStep (double tau, VectorView<double> y) override
+  {
+    y.range(N, 2*N) *= std::exp(-damping * tau);
+  }
+};
+
+
+int main()
+{
+  size_t n = 2*N+1;
+  auto springs = std::make_shared<EmbedFunction>(
+    std::make_shared<AutoDiffFunction<Springs, 2*N>>(Springs(), 2*N), 0, n, 0, n);
+  auto forcing = std::make_shared<EmbedFunction>(
+    std::make_shared<AutoDiffFunction<Forcing, N+1>>(Forcing(), N+1), N, n, N, n);
+  auto friction = -damping * std::make_shared<Projector>(n, N, 2*N);
+
+  Vector<> y0(n);
+  y0 = 0.0;
+  double tend = 2;
+
+  // reference by the adaptive Radau integrator on the full rhs
+  Vector<> yref = y0;
+  AdaptiveRadau reference(springs + forcing + friction, 1e-12, 1e-12);
+  reference.DoStep(tend, yref);
+
+  std::cout << std::setw(10) << "scheme" << std::setw(8) << "steps";
+  std::cout << std::setw(14) << "error" << std::setw(8) << "rate" << std::endl;
+  for (auto [scheme, name] : { std::pair{ SplittingScheme::Lie, "Lie" },
+                               std::pair{ SplittingScheme::Strang, "Strang" },
+                               std::pair{ SplittingScheme::Yoshida4, "Yoshida4" } })
+    {
+      double errold = 0;
+      for (int steps : { 100, 200, 400, 800 })
+        {
+          // springs implicitly (symmetric, A-stable) and sub-cycled, the rest explicitly
+          OperatorSplitting splitting({ { springs, std::make_shared<CrankNicolson>(springs), 4 },
+                                        { forcing, std::make_shared<RK4>(forcing) },
+                                        { friction, std::make_shared<RK4>(friction) } },
+                                      scheme);
+          Vector<> y = y0;
+          for (int i = 0; i < steps; i++)
+            splitting.DoStep(tend / steps, y);
+
+          double err = norm(y - yref);
+          std::cout << std::setw(10) << name << std::setw(8) << steps << std::setw(14) << err;
+          if (errold > 0)
+            std::cout << std::setw(8) << std::setprecision(3) << std::log2(errold / err) << std::setprecision(6);
+          std::cout << std::endl;
+          errold = err;
+        }
+    }
+
+  // damping first, by its exact flow: its flows are merged inside a
+  // Yoshida4 step and across the step boundaries, with the same result
+  for (auto [scheme, name] : { std::pair{ SplittingScheme::Strang, "Strang" },
+                               std::pair{ SplittingScheme::Yoshida4, "Yoshida4" } })
+    {
+      int steps = 400;
+      OperatorSplitting splitting({ { friction, std::make_shared<DampingFlow>(friction), 1, true },
+                                    { forcing, std::make_shared<RK4>(forcing) },
+                                    { springs, std::make_shared<CrankNicolson>(springs), 4 } },
+                                  scheme);
+      Vector<> y = y0, ymerged = y0;
+      for (int i = 0; i < steps; i++)
+        splitting.DoStep(tend / steps, y);
+      splitting.DoSteps(steps, tend / steps, ymerged);
+      double diff = norm(y - ymerged);
+      std::cout << name << " with exact damping, " << steps << " steps: error " << norm(y - yref)
+                << ", " << splitting.sequence().size() << " flows per step, DoSteps differs by " << diff << std::endl;
+      if (!(diff <= 1e-12 * norm(yref)))
+        return 1;
+    }
+
+  // Yoshida4 steps backward in its middle block, which adaptive sub-steppers reject
+  try
+    {
+      OperatorSplitting splitting({ { springs, std::make_shared<CrankNicolson>(springs), 4 },
+                                    { forcing, std::make_shared<DOPRI5>(forcing, 1e-10) },
+                                    { friction, std::make_shared<RK4>(friction) } },
+                                  SplittingScheme::Yoshida4);
+      Vector<> y = y0;
+      splitting.DoStep(tend / 100, y);
+      std::cout << "Yoshida4 with an adaptive sub-stepper was not rejected" << std::endl;
+      return 1;
+    }
+  catch (const std::invalid_argument & e)
+    {
+      std::cout << "Yoshida4 with adaptive DOPRI5: " << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <string>
+#include <nonlinfunc.hpp>
+#include <RungeKutta.hpp>
+#include <TaylorSeries.hpp>
+
+
+using namespace ASC_ode;
+
+
+// Kepler problem y = (q1, q2, p1, p2), period 2 pi
+struct Kepler
+{
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    T r2 = x(0)*x(0) + x(1)*x(1);
+    T r3inv = 1.0 / (r2 * sqrt(r2));
+    f(0) = x(2);
+    f(1) = x(3);
+    f(2) = -x(0) * r3inv;
+    f(3) = -x(1) * r3inv;
+  }
+};
+
+
+// start in the pericenter of an orbit with eccentricity e
+void InitialValue (double e, VectorView<double> y)
+{
+  y(0) = 1 - e;
+  y(1) = 0;
+  y(2) = 0;
+  y(3) = std::sqrt((1 + e) / (1 - e));
+}
+
+double Error (VectorView<double> y, VectorView<double> y0)
+{
+  double err = 0;
+  for (size_t i = 0; i < y.size(); i++)
+    err = std::max(err, std::abs(y(i) - y0(i)));
+  return err;
+}
+
+
+int main()
+{
+  double e = 0.5;
+  int periods = 10;
+  double tend = periods * 2 * M_PI;
+
+  Vector<> y0(4);
+  InitialValue(e, y0);
+
+  std::cout << "Kepler orbit, e = " << e << ", " << periods << " periods" << std::endl;
+  std::cout << std::setw(20) << "method" << std::setw(12) << "steps"
+            << std::setw(16) << "error" << std::endl;
+
+  for (double tol : { 1e-8, 1e-12, 1e-16 })
+    {
+      TaylorSeries<Kepler> taylor(Kepler(), 4, tol);
+      Vector<> y = y0;
+      for (int i = 0; i < periods; i++)
+        taylor.DoStep(2 * M_PI, y);
+      std::cout << std::setw(20) << "taylor p~" + std::to_string(std::lround(taylor.averageOrder()))
+                << std::setw(12) << taylor.numSteps()
+                << std::setw(16) << Error(y, y0) << "   tol " << tol << std::endl;
+    }
+
+  // tol bounds the error per unit step: the global error grows with time
+  for (double tol : { 1e-8, 1e-12 })
+    {
+      TaylorSeries<Kepler> taylor(Kepler(), 4, tol);
+      Vector<> y = y0;
+      for (int i = 0; i < 10 * periods; i++)
+        taylor.DoStep(2 * M_PI, y);
+      std::cout << std::setw(20) << "taylor, 10x longer" << std::setw(12) << taylor.numSteps()
+                << std::setw(16) << Error(y, y0) << "   tol " << tol << std::endl;
+    }
+
+  Matrix<> a(4,4);
+  a = 0.0;
+  a(1,0) = 0.5; a(2,1) = 0.5; a(3,2) = 1;
+  Vector<> b(4), c(4);
+  b(0) = 1.0/6; b(1) = 1.0/3; b(2) = 1.0/3; b(3) = 1.0/6;
+  c(0) = 0; c(1) = 0.5; c(2) = 0.5; c(3) = 1;
+
+  auto rhs = std::make_shared<AutoDiffFunction<Kepler,4>>(Kepler(), 4);
+  for (int steps : { 1000, 10000, 100000 })
+    {
+      ExplicitRungeKutta rk4(rhs, a, b, c);
+      Vector<> y = y0;
+      for (int i = 0; i < steps; i++)
+        rk4.DoStep(tend / steps, y);
+      std::cout << std::setw(20) << "rk4" << std::setw(12) << steps
+                << std::setw(16) << Error(y, y0) << std::endl;
+    }
+}
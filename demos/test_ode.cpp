@@ -19,6 +19,7 @@
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <RungeKutta.hpp>
+#include <Radau.hpp>
 
 using namespace ASC_ode;
 
@@ -184,8 +185,9 @@ int main(int argc, char* argv[])
   auto print_usage = [argv]() {
     std::cerr << "Usage: " << argv[0] << " --stepper <name> [--rhs <system>] [--stages <int>] [--n-factor <double>] [--t-end-factor <double>] [--tableau-folder <name>]\n";
     std::cerr << "  --stepper        exp_euler | impl_euler | impr_euler | crank_nicolson | exp_rk | impl_rk_gauss_legendre | impl_rk_gauss_radau\n";
+    std::cerr << "                   | impl_rk_lobatto_iiia | impl_rk_lobatto_iiic | adaptive_radau\n";
     std::cerr << "  --rhs            mass_spring | electric_network (default mass_spring)\n";
-    std::cerr << "  --stages         required for impl_rk_gauss_legendre / impl_rk_gauss_radau (positive integer)\n";
+    std::cerr << "  --stages         required for the impl_rk_* steppers (positive integer, >= 2 for Lobatto)\n";
     std::cerr << "  --n-factor       optional, scales default steps N=100 (default 1.0)\n";
     std::cerr << "  --t-end-factor   optional, scales default T_end = 4*pi (default 1.0)\n";
     std::cerr << "  --tableau-folder required for exp_rk, folder containing tableau.txt (prefix ExplicitRK)\n";
@@ -217,7 +219,8 @@ int main(int argc, char* argv[])
 
   std::string stepper_name;
   auto needs_stages = [](const std::string& name) {
-    return name == "impl_rk_gauss_legendre" || name == "impl_rk_gauss_radau";
+    return name == "impl_rk_gauss_legendre" || name == "impl_rk_gauss_radau" ||
+           name == "impl_rk_lobatto_iiia" || name == "impl_rk_lobatto_iiic";
   };
   int stages = 0;
   bool stages_overridden = false;
@@ -377,54 +380,31 @@ else {
       return 1;
     }
   }
-  else if (stepper_name == "impl_rk_gauss_legendre") {
+  else if (needs_stages(stepper_name)) {
     if (!stages_overridden) {
-      std::cerr << "Legendre IRK requires a stages argument." << std::endl;
+      std::cerr << "Implicit RK '" << stepper_name << "' requires a stages argument." << std::endl;
       return 1;
     }
 
-    Matrix<> a(stages, stages);
-    Vector<> b(stages), c(stages);
+    TableauFamily family = TableauFamily::GaussLegendre;
+    if (stepper_name == "impl_rk_gauss_radau") family = TableauFamily::RadauIIA;
+    else if (stepper_name == "impl_rk_lobatto_iiia") family = TableauFamily::LobattoIIIA;
+    else if (stepper_name == "impl_rk_lobatto_iiic") family = TableauFamily::LobattoIIIC;
 
-    if (stages == 2) {
-      // Example: reuse predefined Gauss-Legendre tableau
-      a = Gauss2a;
-      b = Gauss2b;
-      c = Gauss2c;
-    }
-    else if (stages == 3) {
-      // Example: take tabulated nodes and derive coefficients programmatically
-      c = Gauss3c;
-      auto [a_tmp, b_tmp] = ComputeABfromC(c);
-      a = a_tmp;
-      b = b_tmp;
-    }
-    else {
-      // General construction: compute nodes (c) via Gauss-Legendre and build a,b
-      Vector<> quad_weights(stages);
-      GaussLegendre(c, quad_weights);
-      auto [a_tmp, b_tmp] = ComputeABfromC(c);
-      a = a_tmp;
-      b = b_tmp;
-    }
-
-    stepper = std::make_unique<ImplicitRungeKutta>(rhs, a, b, c);
-    stepper_tag = stepper_name + "_s" + std::to_string(stages);
-  } 
-  else if (stepper_name == "impl_rk_gauss_radau") {
-    if (!stages_overridden) {
-      std::cerr << "Radau IRK requires a stages argument." << std::endl;
+    try {
+      const ButcherTableau & tab = GetTableau(family, stages);
+      stepper = std::make_unique<ImplicitRungeKutta>(rhs, tab.a, tab.b, tab.c);
+    } catch (const std::exception& err) {
+      std::cerr << err.what() << std::endl;
       return 1;
     }
-
-    Vector<> c(stages), weights(stages);
-    GaussRadau(c, weights);
-    auto [a_tmp, b_tmp] = ComputeABfromC(c);
-    Matrix<> a = a_tmp;
-    Vector<> b = b_tmp;
-    stepper = std::make_unique<ImplicitRungeKutta>(rhs, a, b, c);
     stepper_tag = stepper_name + "_s" + std::to_string(stages);
   }
+  else if (stepper_name == "adaptive_radau") {
+    // error-controlled substeps within each output step, 3 to 7 stages
+    stepper = std::make_unique<AdaptiveRadau>(rhs, 1e-8, 1e-8);
+    stepper_tag = stepper_name;
+  }
   // Gauss3c .. points tabulated, compute a,b:
   //auto [Gauss3a,Gauss3b] = computeABfromC (Gauss3c);
   //ImplicitRungeKutta stepper(rhs, Gauss3a, Gauss3b, Gauss3c);
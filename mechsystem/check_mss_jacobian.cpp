@@ -0,0 +1,106 @@
+#include "mass_spring.hpp"
+#include <tape.hpp>
+
+// compares the analytic Jacobian of MSS_Function with central differences
+// for springs away from their rest length and a loaded distance constraint,
+// and the taped forces and Hessian of GradientFunction(MSS_Energy) with
+// central differences of the energy and of the forces
+
+int main()
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity({0, -9.81});
+  auto fA = mss.addFix({{0.0, 0.0}});
+  auto mA = mss.addMass({1, {1.2, -0.3}});
+  auto mB = mss.addMass({2, {2.1, 0.4}});
+  auto mC = mss.addMass({0.5, {1.5, 1.1}});
+  mss.addSpring({1, 10, {fA, mA}});
+  mss.addSpring({0.8, 20, {mA, mB}});
+  mss.addSpring({1.5, 5, {mB, mC}});
+  mss.addConstraint(DistanceConstraint(1.0, {mA, mC}));
+  mss.addConstraint(DistanceConstraint(0.7, {fA, mC}));
+
+  MSS_Function<2> func(mss);
+  size_t n = func.dimX();
+
+  Vector<> x(n);
+  for (size_t i = 0; i < mss.masses().size(); i++)
+    x.range(2 * i, 2 * i + 2) = mss.masses()[i].pos;
+  x(n - 2) = 0.7;
+  x(n - 1) = -1.3;
+
+  double eps = 1e-6;
+  auto jacobianFD = [&](const NonlinearFunction &f, VectorView<double> x, MatrixView<double> jacfd)
+  {
+    size_t n = x.size();
+    Vector<> xp(n), xm(n), fp(f.dimF()), fm(f.dimF());
+    for (size_t j = 0; j < n; j++)
+    {
+      xp = x;
+      xm = x;
+      xp(j) += eps;
+      xm(j) -= eps;
+      f.evaluate(xp, fp);
+      f.evaluate(xm, fm);
+      for (size_t i = 0; i < f.dimF(); i++)
+        jacfd(i, j) = (fp(i) - fm(i)) / (2 * eps);
+    }
+  };
+
+  bool ok = true;
+  auto compare = [&](const char *name, MatrixView<double> a, MatrixView<double> b)
+  {
+    double err = 0, scale = 0;
+    for (size_t i = 0; i < a.rows(); i++)
+      for (size_t j = 0; j < a.cols(); j++)
+      {
+        err = std::max(err, std::abs(a(i, j) - b(i, j)));
+        scale = std::max(scale, std::abs(b(i, j)));
+      }
+    std::cout << name << ": max difference " << err << ", max entry " << scale << std::endl;
+    if (err > 1e-6 * scale)
+      ok = false;
+  };
+
+  Matrix<> jac(n, n), jacfd(n, n);
+  func.evaluateDeriv(x, jac);
+  jacobianFD(func, x, jacfd);
+  compare("MSS_Function Jacobian vs central differences", jac, jacfd);
+
+  // forces -grad E and stiffness -E'' on the positions
+  size_t npos = 2 * mss.masses().size();
+  MSS_Energy<2> energy(mss);
+  GradientFunction forces(energy, npos, -1);
+  Vector<> pos = x.range(0, npos), f(npos), f2(npos), fp(npos), fm(npos);
+  Matrix<> force(npos, 1), forcefd(npos, 1);
+  forces.evaluate(pos, f);
+  for (size_t j = 0; j < npos; j++)
+  {
+    Vector<> pp = pos, pm = pos;
+    pp(j) += eps;
+    pm(j) -= eps;
+    force(j, 0) = f(j);
+    forcefd(j, 0) = -(energy.T_energy<double>(pp) - energy.T_energy<double>(pm)) / (2 * eps);
+  }
+  compare("forces vs central differences of the energy", force, forcefd);
+
+  Matrix<> hess(npos, npos), hessfd(npos, npos), hess2(npos, npos);
+  forces.evaluateDeriv(pos, hess);
+  jacobianFD(forces, pos, hessfd);
+  compare("taped Hessian vs central differences of the forces", hess, hessfd);
+
+  // evaluateWithDeriv takes the forces from the Hessian sweeps
+  forces.evaluateWithDeriv(pos, f2, hess2);
+  Matrix<> force2(npos, 1);
+  for (size_t j = 0; j < npos; j++)
+    force2(j, 0) = f2(j);
+  compare("evaluateWithDeriv vs evaluate, evaluateDeriv (forces)", force2, force);
+  compare("evaluateWithDeriv vs evaluate, evaluateDeriv (Hessian)", hess2, hess);
+
+  if (!ok)
+  {
+    std::cout << "derivatives do not match finite differences" << std::endl;
+    return 1;
+  }
+  std::cout << "ok" << std::endl;
+}
@@ -157,18 +157,16 @@ std::ostream &operator<<(std::ostream &ost, MassSpringSystem<D> &mss)
 template <int D>
 class MSS_Function : public NonlinearFunction
 {
+  std::shared_ptr<MassSpringSystem<D>> m_owned;  // set for clones
   MassSpringSystem<D> &mss;
 
-public:
-  MSS_Function(MassSpringSystem<D> &_mss)
-      : mss(_mss) {}
-
-  virtual size_t dimX() const override { return D * mss.masses().size() + mss.constraints().size(); }
-  virtual size_t dimF() const override { return D * mss.masses().size() + mss.constraints().size(); }
-
-  virtual void evaluate(VectorView<double> x, VectorView<double> f) const override
+  // forces, constraints and (if df is given) their Jacobian in one sweep,
+  // so that every spring's geometry is computed only once
+  void assemble(VectorView<double> x, VectorView<double> f, MatrixView<double> *df) const
   {
     f = 0.0;
+    if (df)
+      *df = 0.0;
 
     size_t numMasses = mss.masses().size();
     size_t numConstraints = mss.constraints().size();
@@ -176,48 +174,72 @@ public:
     auto xmat = x.range(0, D * numMasses).asMatrix(numMasses, D);
     auto fmat = f.range(0, D * numMasses).asMatrix(numMasses, D);
 
+    auto position = [&](const Connector &c) -> Vec<D>
+    {
+      if (c.type == Connector::FIX)
+        return mss.fixes()[c.nr].pos;
+      return xmat.row(c.nr);
+    };
+
+    // df(rows of ci, cols of cj) += fac * block
+    auto addBlock = [&](const Connector &ci, const Connector &cj, double fac, const auto &block)
+    {
+      if (ci.type != Connector::MASS || cj.type != Connector::MASS)
+        return;
+      for (int a = 0; a < D; a++)
+        for (int b = 0; b < D; b++)
+          (*df)(D * ci.nr + a, D * cj.nr + b) += fac * block[a][b];
+    };
+
     for (size_t i = 0; i < numMasses; i++)
       fmat.row(i) = mss.masses()[i].mass * mss.getGravity();
 
-    for (auto spring : mss.springs())
+    for (auto &spring : mss.springs())
     {
       auto [c1, c2] = spring.connectors;
-      Vec<D> p1, p2;
-      if (c1.type == Connector::FIX)
-        p1 = mss.fixes()[c1.nr].pos;
-      else
-        p1 = xmat.row(c1.nr);
-      if (c2.type == Connector::FIX)
-        p2 = mss.fixes()[c2.nr].pos;
-      else
-        p2 = xmat.row(c2.nr);
-
-      double force = spring.stiffness * (norm(p1 - p2) - spring.length);
-      Vec<D> dir12 = 1.0 / norm(p1 - p2) * (p2 - p1);
+      Vec<D> p1 = position(c1);
+      Vec<D> p2 = position(c2);
+
+      double len = norm(p1 - p2);
+      double force = spring.stiffness * (len - spring.length);
+      Vec<D> dir12 = 1.0 / len * (p2 - p1);
       if (c1.type == Connector::MASS)
         fmat.row(c1.nr) += force * dir12;
       if (c2.type == Connector::MASS)
         fmat.row(c2.nr) -= force * dir12;
+
+      if (df && len > 0.0)
+      {
+        // d(force*dir12)/dp2 = k ( (1 - l0/len) (I - dir dir^T) + dir dir^T )
+        std::array<std::array<double, D>, D> stiff;
+        for (int a = 0; a < D; a++)
+          for (int b = 0; b < D; b++)
+            stiff[a][b] = spring.stiffness * ((1 - spring.length / len) * ((a == b ? 1.0 : 0.0) - dir12(a) * dir12(b)) + dir12(a) * dir12(b));
+        addBlock(c1, c1, -1, stiff);
+        addBlock(c1, c2, 1, stiff);
+        addBlock(c2, c1, 1, stiff);
+        addBlock(c2, c2, -1, stiff);
+      }
     }
 
     for (size_t i = 0; i < numMasses; i++)
-      fmat.row(i) *= 1.0 / mss.masses()[i].mass;
+    {
+      double invm = 1.0 / mss.masses()[i].mass;
+      fmat.row(i) *= invm;
+      if (df)
+        for (size_t a = 0; a < D; a++)
+          df->row(D * i + a) *= invm;
+    }
 
     for (size_t i = 0; i < numConstraints; i++)
     {
-      double lambda = x(D * numMasses + i);
+      size_t row = D * numMasses + i;
+      double lambda = x(row);
       auto &con = mss.constraints()[i];
       auto [c1, c2] = con.connectors;
 
-      Vec<D> p1, p2;
-      if (c1.type == Connector::FIX)
-        p1 = mss.fixes()[c1.nr].pos;
-      else
-        p1 = xmat.row(c1.nr);
-      if (c2.type == Connector::FIX)
-        p2 = mss.fixes()[c2.nr].pos;
-      else
-        p2 = xmat.row(c2.nr);
+      Vec<D> p1 = position(c1);
+      Vec<D> p2 = position(c2);
 
       Vec<D> diff = p1 - p2;
       if (c1.type == Connector::MASS)
@@ -225,94 +247,112 @@ public:
       if (c2.type == Connector::MASS)
         fmat.row(c2.nr) -= (2 * lambda) * diff;
 
-      f(D * numMasses + i) = dot(p1 - p2, p1 - p2) - con.length * con.length;
+      f(row) = dot(p1 - p2, p1 - p2) - con.length * con.length;
+
+      if (df)
+      {
+        std::array<std::array<double, D>, D> ident{};
+        for (int a = 0; a < D; a++)
+          ident[a][a] = 1;
+        addBlock(c1, c1, 2 * lambda, ident);
+        addBlock(c1, c2, -2 * lambda, ident);
+        addBlock(c2, c1, -2 * lambda, ident);
+        addBlock(c2, c2, 2 * lambda, ident);
+
+        for (int a = 0; a < D; a++)
+        {
+          if (c1.type == Connector::MASS)
+          {
+            (*df)(D * c1.nr + a, row) += 2.0 * diff(a); // derivative wrt lambda
+            (*df)(row, D * c1.nr + a) += 2.0 * diff(a); // derivative wrt position
+          }
+          if (c2.type == Connector::MASS)
+          {
+            (*df)(D * c2.nr + a, row) -= 2.0 * diff(a);
+            (*df)(row, D * c2.nr + a) -= 2.0 * diff(a);
+          }
+        }
+      }
     }
   }
 
-  virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override
-  {
-    size_t numMasses = mss.masses().size();
-    size_t numConstraints = mss.constraints().size();
-    const size_t n = D * numMasses + numConstraints;
+public:
+  MSS_Function(MassSpringSystem<D> &_mss)
+      : mss(_mss) {}
+  MSS_Function(std::shared_ptr<MassSpringSystem<D>> _mss)
+      : m_owned(_mss), mss(*_mss) {}
 
-    for (size_t i = 0; i < df.rows(); i++)
-      for (size_t j = 0; j < df.cols(); j++)
-        df(i, j) = 0.0;
+  virtual size_t dimX() const override { return D * mss.masses().size() + mss.constraints().size(); }
+  virtual size_t dimF() const override { return D * mss.masses().size() + mss.constraints().size(); }
 
-    auto xmat = x.range(0, D * numMasses).asMatrix(numMasses, D);
+  virtual void evaluate(VectorView<double> x, VectorView<double> f) const override
+  {
+    assemble(x, f, nullptr);
+  }
 
-    for (auto spring : mss.springs())
-    {
-      auto [c1, c2] = spring.connectors;
+  virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override
+  {
+    Vector<> f(dimF());
+    assemble(x, f, &df);
+  }
 
-      Vec<D> p1 = (c1.type == Connector::FIX) ? mss.fixes()[c1.nr].pos : xmat.row(c1.nr);
-      Vec<D> p2 = (c2.type == Connector::FIX) ? mss.fixes()[c2.nr].pos : xmat.row(c2.nr);
+  virtual void evaluateWithDeriv(VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+  {
+    assemble(x, f, &df);
+  }
 
-      Vec<D> diff = p1 - p2;
-      double L = norm(diff);
-      if (L == 0.0)
-        continue;
-      Vec<D> dir = diff;
-      for (size_t k = 0; k < D; k++)
-        dir(k) /= L;
-
-      // Spring stiffness matrix (outer product)
-      for (int a = 0; a < D; a++)
-        for (int b = 0; b < D; b++)
-        {
-          double val = spring.stiffness * ((a == b ? 1.0 : 0.0) - dir(a) * dir(b));
-          if (c1.type == Connector::MASS && c2.type == Connector::MASS)
-          {
-            df(D * c1.nr + a, D * c1.nr + b) += val;
-            df(D * c1.nr + a, D * c2.nr + b) -= val;
-            df(D * c2.nr + a, D * c1.nr + b) -= val;
-            df(D * c2.nr + a, D * c2.nr + b) += val;
-          }
-          else if (c1.type == Connector::MASS && c2.type == Connector::FIX)
-            df(D * c1.nr + a, D * c1.nr + b) += val;
-          else if (c1.type == Connector::FIX && c2.type == Connector::MASS)
-            df(D * c2.nr + a, D * c2.nr + b) += val;
-        }
-    }
+protected:
+  // the clone owns a copy of the system, so it may be changed independently
+  std::shared_ptr<NonlinearFunction> cloneNode(CloneMap &map) const override
+  {
+    return std::make_shared<MSS_Function>(std::make_shared<MassSpringSystem<D>>(mss));
+  }
+};
 
-    // Constraints contributions
-    for (size_t i = 0; i < numConstraints; i++)
-    {
-      auto &con = mss.constraints()[i];
-      auto [c1, c2] = con.connectors;
+// potential energy of springs and gravity as a function of the mass
+// positions; GradientFunction(MSS_Energy<D>(mss), mss.masses().size()*D, -1)
+// gives the forces (constraints are not included)
+template <int D>
+class MSS_Energy
+{
+  std::shared_ptr<MassSpringSystem<D>> m_owned;  // set for clones
+  MassSpringSystem<D> *mss;
 
-      Vec<D> p1 = (c1.type == Connector::FIX) ? mss.fixes()[c1.nr].pos : xmat.row(c1.nr);
-      Vec<D> p2 = (c2.type == Connector::FIX) ? mss.fixes()[c2.nr].pos : xmat.row(c2.nr);
+public:
+  MSS_Energy(MassSpringSystem<D> &_mss) : mss(&_mss) {}
+  MSS_Energy(std::shared_ptr<MassSpringSystem<D>> _mss) : m_owned(_mss), mss(_mss.get()) {}
 
-      Vec<D> diff = p1 - p2;
+  // for cloned function graphs: a copy owning its own system
+  MSS_Energy clone() const { return MSS_Energy(std::make_shared<MassSpringSystem<D>>(*mss)); }
 
+  template <typename T>
+  T T_energy(VectorView<T> x) const
+  {
+    T energy = 0;
+    for (size_t i = 0; i < mss->masses().size(); i++)
       for (int a = 0; a < D; a++)
-      {
-        if (c1.type == Connector::MASS)
-        {
-          df(D * c1.nr + a, D * numMasses + i) += 2.0 * diff(a); // derivative wrt lambda
-          df(D * numMasses + i, D * c1.nr + a) += 2.0 * diff(a); // derivative wrt position
-        }
-        if (c2.type == Connector::MASS)
-        {
-          df(D * c2.nr + a, D * numMasses + i) -= 2.0 * diff(a);
-          df(D * numMasses + i, D * c2.nr + a) -= 2.0 * diff(a);
-        }
-      }
+        energy = energy - mss->masses()[i].mass * mss->getGravity()(a) * x(D * i + a);
 
-      // Derivative of constraint w.r.t lambda is zero (already handled in force positions)
-    }
+    auto coord = [&](const Connector &c, int a) -> T
+    {
+      if (c.type == Connector::FIX)
+        return T(mss->fixes()[c.nr].pos(a));
+      return x(D * c.nr + a);
+    };
 
-    // Divide forces by mass for acceleration part
-    for (size_t i = 0; i < numMasses; i++)
+    for (auto &spring : mss->springs())
     {
-      double m = mss.masses()[i].mass;
-      for (size_t a = 0; a < D; a++)
+      auto [c1, c2] = spring.connectors;
+      T len2 = 0;
+      for (int a = 0; a < D; a++)
       {
-        for (size_t j = 0; j < D * numMasses + numConstraints; j++)
-          df(D * i + a, j) /= m;
+        T diff = coord(c2, a) - coord(c1, a);
+        len2 = len2 + diff * diff;
       }
+      T ext = sqrt(len2) - spring.length;
+      energy = energy + 0.5 * spring.stiffness * ext * ext;
     }
+    return energy;
   }
 };
 
@@ -0,0 +1,311 @@
+#ifndef EXPLICITRK_HPP
+#define EXPLICITRK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Explicit Runge-Kutta methods with the tableau fixed at compile time.
+    A tableau is a type with
+      static constexpr size_t stages;
+      static constexpr int order;
+      static constexpr double a[stages][stages], b[stages], c[stages];
+    and, for embedded pairs, the weights bhat[stages] of the solution of
+    order - 1. ExplicitRK<Tableau> unrolls the stages, and coefficients
+    which are zero in the tableau generate no code. On the cheapest rhs
+    (a harmonic oscillator) this makes an RK4 step only about 1.2x faster
+    than the runtime ExplicitRungeKutta; the virtual rhs calls dominate
+    the rest.
+
+    Embedded pairs estimate the local error by tau sum_j (b_j - bhat_j) k_j,
+    at no extra rhs evaluation; error() is its scaled max norm
+    max |err_i| / max(1, |y_i|). With tol > 0, DoStep(tau, y) takes
+    adaptive steps to reach tau with error() <= tol, like
+    LowStorageRungeKutta.
+
+    Tableaus with the FSAL property (last row of a equal to b, c = 1) get
+    the new y as the last stage value, and f(y_{n+1}) is reused as the
+    first stage of the following step if DoStep is called with the same y.
+    Call reset() when the rhs changed otherwise (e.g. a Parameter).
+  */
+
+  struct RK4Tableau
+  {
+    static constexpr size_t stages = 4;
+    static constexpr int order = 4;
+    static constexpr double a[4][4] = {
+      { 0,   0,   0, 0 },
+      { 0.5, 0,   0, 0 },
+      { 0,   0.5, 0, 0 },
+      { 0,   0,   1, 0 } };
+    static constexpr double b[4] = { 1.0/6, 1.0/3, 1.0/3, 1.0/6 };
+    static constexpr double c[4] = { 0, 0.5, 0.5, 1 };
+  };
+
+  // Bogacki-Shampine 3(2)
+  struct BS3Tableau
+  {
+    static constexpr size_t stages = 4;
+    static constexpr int order = 3;
+    static constexpr double a[4][4] = {
+      { 0,       0,       0,       0 },
+      { 1.0/2,   0,       0,       0 },
+      { 0,       3.0/4,   0,       0 },
+      { 2.0/9,   1.0/3,   4.0/9,   0 } };
+    static constexpr double b[4] = { 2.0/9, 1.0/3, 4.0/9, 0 };
+    static constexpr double bhat[4] = { 7.0/24, 1.0/4, 1.0/3, 1.0/8 };
+    static constexpr double c[4] = { 0, 1.0/2, 3.0/4, 1 };
+  };
+
+  // Dormand-Prince 5(4)
+  struct DOPRI5Tableau
+  {
+    static constexpr size_t stages = 7;
+    static constexpr int order = 5;
+    static constexpr double a[7][7] = {
+      { 0, 0, 0, 0, 0, 0, 0 },
+      { 1.0/5, 0, 0, 0, 0, 0, 0 },
+      { 3.0/40, 9.0/40, 0, 0, 0, 0, 0 },
+      { 44.0/45, -56.0/15, 32.0/9, 0, 0, 0, 0 },
+      { 19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729, 0, 0, 0 },
+      { 9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656, 0, 0 },
+      { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84, 0 } };
+    static constexpr double b[7] = { 35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84, 0 };
+    static constexpr double bhat[7] = { 5179.0/57600, 0, 7571.0/16695, 393.0/640,
+                                        -92097.0/339200, 187.0/2100, 1.0/40 };
+    static constexpr double c[7] = { 0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1 };
+  };
+
+  // Tsitouras 5(4), Comput. Math. Appl. 62 (2011)
+  struct Tsit5Tableau
+  {
+    static constexpr size_t stages = 7;
+    static constexpr int order = 5;
+    static constexpr double a[7][7] = {
+      { 0, 0, 0, 0, 0, 0, 0 },
+      { 0.161, 0, 0, 0, 0, 0, 0 },
+      { -0.008480655492356989, 0.335480655492357, 0, 0, 0, 0, 0 },
+      { 2.897153057105493, -6.359448489975075, 4.3622954328695815, 0, 0, 0, 0 },
+      { 5.325864828439257, -11.748883564062828, 7.4955393428898365, -0.09249506636175525, 0, 0, 0 },
+      { 5.86145544294642, -12.92096931784711, 8.159367898576159, -0.071584973281401,
+        -0.028269050394068383, 0, 0 },
+      { 0.09646076681806523, 0.01, 0.4798896504144996, 1.379008574103742,
+        -3.290069515436081, 2.324710524099774, 0 } };
+    static constexpr double b[7] = { 0.09646076681806523, 0.01, 0.4798896504144996, 1.379008574103742,
+                                     -3.290069515436081, 2.324710524099774, 0 };
+    // b - bhat as given by Tsitouras
+    static constexpr double bhat[7] = { b[0] + 0.00178001105222577714, b[1] + 0.0008164344596567469,
+                                        b[2] - 0.007880878010261995, b[3] + 0.1447110071732629,
+                                        b[4] - 0.5823571654525552, b[5] + 0.45808210592918697,
+                                        b[6] - 1.0/66 };
+    static constexpr double c[7] = { 0, 0.161, 0.327, 0.9, 0.9800255409045097, 1, 1 };
+  };
+
+
+  template <typename Tableau>
+  class ExplicitRK : public TimeStepper
+  {
+    static constexpr size_t S = Tableau::stages;
+
+    static constexpr bool IsFSAL ()
+    {
+      if (Tableau::c[S-1] != 1.0) return false;
+      for (size_t j = 0; j < S; j++)
+        if (Tableau::a[S-1][j] != Tableau::b[j]) return false;
+      return true;
+    }
+    static constexpr bool FSAL = IsFSAL();
+    static constexpr bool Embedded = requires { Tableau::bhat[0]; };
+
+    double m_tol;
+    size_t m_n;
+    Matrix<> m_k;                 // row i = stage derivative k_i
+    Vector<> m_ystage;
+    Vector<> m_ylast;             // y for which row 0 of m_k holds f(y)
+    Vector<> m_ysave;             // y before an adaptive step
+    bool m_haveLast = false;
+    size_t m_evals = 0;
+    double m_error = 0;
+    double m_h = 0;
+    size_t m_steps = 0, m_rejected = 0;
+
+    // error weight b_J - bhat_J
+    template <size_t J>
+    static constexpr double ErrorWeight ()
+    {
+      if constexpr (Embedded)
+        return Tableau::b[J] - Tableau::bhat[J];
+      else
+        return 0.0;
+    }
+
+    // acc += coef * k(J,l), nothing if coef is zero
+    template <double coef, size_t J>
+    void addTerm (double & acc, size_t l) const
+    {
+      if constexpr (coef != 0.0)
+        acc += coef * m_k(J, l);
+    }
+
+    // stage state y + tau sum_j a_Ij k_j, then k_I = f(stage state)
+    template <size_t I, size_t... J>
+    void stage (double tau, VectorView<double> y, std::index_sequence<J...>)
+    {
+      for (size_t l = 0; l < m_n; l++)
+        {
+          double acc = -0.0;     // -0.0 + x == x, so the first term costs no add
+          (addTerm<Tableau::a[I][J], J>(acc, l), ...);
+          m_ystage(l) = y(l) + tau * acc;
+        }
+      m_rhs->evaluate(m_ystage, m_k.row(I));
+      m_evals++;
+    }
+
+    // m_error = scaled max norm of tau sum_j (b_j - bhat_j) k_j, for the new y
+    void estimateError (double tau, VectorView<double> y)
+    {
+      [&]<size_t... J> (std::index_sequence<J...>)
+      {
+        m_error = 0;
+        for (size_t l = 0; l < m_n; l++)
+          {
+            double acc = -0.0;
+            (addTerm<ErrorWeight<J>(), J>(acc, l), ...);
+            m_error = std::max(m_error, std::abs(tau * acc) / std::max(1.0, std::abs(y(l))));
+          }
+      } (std::make_index_sequence<S>());
+    }
+
+    void step (double tau, VectorView<double> y)
+    {
+      bool reuse = false;
+      if constexpr (FSAL)
+        if (m_haveLast)
+          {
+            reuse = true;
+            for (size_t l = 0; l < m_n; l++)
+              if (y(l) != m_ylast(l)) { reuse = false; break; }
+          }
+      if (!reuse)
+        {
+          m_rhs->evaluate(y, m_k.row(0));
+          m_evals++;
+        }
+
+      [&]<size_t... I> (std::index_sequence<I...>)
+      {
+        (stage<I+1>(tau, y, std::make_index_sequence<I+1>()), ...);
+      } (std::make_index_sequence<S-1>());
+
+      if constexpr (FSAL)
+        {
+          // the last stage was evaluated at y_{n+1}
+          y = m_ystage;
+          m_ylast = m_ystage;
+        }
+      else
+        [&]<size_t... J> (std::index_sequence<J...>)
+        {
+          for (size_t l = 0; l < m_n; l++)
+            {
+              double acc = -0.0;
+              (addTerm<Tableau::b[J], J>(acc, l), ...);
+              y(l) += tau * acc;
+            }
+        } (std::make_index_sequence<S>());
+
+      // the FSAL stage k_S-1 = f(y_{n+1}) enters the estimate before it moves to row 0
+      if constexpr (Embedded)
+        estimateError(tau, y);
+      if constexpr (FSAL)
+        {
+          m_k.row(0) = m_k.row(S-1);
+          m_haveLast = true;
+        }
+    }
+
+  public:
+    ExplicitRK (std::shared_ptr<NonlinearFunction> rhs, double tol = 0)
+      : TimeStepper(rhs), m_tol(tol), m_n(rhs->dimX()), m_k(S, m_n), m_ystage(m_n), m_ylast(m_n),
+        m_ysave(tol > 0 ? m_n : 0)
+    {
+      if (tol > 0 && !Embedded)
+        throw std::invalid_argument("ExplicitRK: adaptive steps need a tableau with bhat");
+    }
+
+    static constexpr size_t stages() { return S; }
+    static constexpr int order() { return Tableau::order; }
+    static constexpr bool fsal() { return FSAL; }
+    static constexpr bool embedded() { return Embedded; }
+    // number of rhs evaluations so far
+    size_t numEvaluations() const { return m_evals; }
+    // scaled error estimate of the last step (0 without bhat)
+    double error() const { return m_error; }
+    size_t numSteps() const { return m_steps; }
+    size_t numRejected() const { return m_rejected; }
+    // forget the stored f(y_{n+1}) of an FSAL method
+    void reset() { m_haveLast = false; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      if (m_tol <= 0)
+        {
+          step(tau, y);
+          m_steps++;
+          return;
+        }
+
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("ExplicitRK: adaptive steps need tau >= 0");
+      if (m_h <= 0) m_h = tau;
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(m_h, tau - t);
+          if (tau - t - h < 1e-14 * tau)
+            h = tau - t;
+
+          m_ysave = y;
+          step(h, y);
+          double err = m_error / m_tol;
+          double fac = err > 0 ? 0.9 * std::pow(err, -1.0 / Tableau::order) : 5;
+          m_h = h * std::clamp(fac, 0.2, 5.0);
+
+          if (err <= 1)
+            {
+              t += h;
+              m_steps++;
+            }
+          else
+            {
+              // row 0 now holds f of the rejected y_{n+1}
+              y = m_ysave;
+              m_haveLast = false;
+              m_rejected++;
+            }
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<ExplicitRK>(m_rhs->clone(), m_tol);
+    }
+  };
+
+  using RK4 = ExplicitRK<RK4Tableau>;
+  using BS3 = ExplicitRK<BS3Tableau>;
+  using DOPRI5 = ExplicitRK<DOPRI5Tableau>;
+  using Tsit5 = ExplicitRK<Tsit5Tableau>;
+
+}
+
+#endif
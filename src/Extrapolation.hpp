@@ -0,0 +1,363 @@
+#ifndef EXTRAPOLATION_HPP
+#define EXTRAPOLATION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <inverse.hpp>
+
+#include "timestepper.hpp"
+#include "parallel.hpp"
+
+namespace ASC_ode
+{
+
+  enum class ExtrapolationBase
+  {
+    Midpoint,                   // Gragg's explicit midpoint rule, n_j = 2, 4, 6, ...
+    LinearlyImplicitEuler       // (I - h J) dz = h f(z), J at y_n, n_j = 1, 2, 3, ...
+  };
+
+
+  /*
+    Extrapolation integrator (Gragg-Bulirsch-Stoer, and its linearly
+    implicit variant for stiff problems as in ODEX / SEULEX by Hairer
+    and Wanner).
+
+    A step of size h computes the base method with n_j substeps for the
+    rows j = 1..k, T_j1, and extrapolates to h -> 0 by Aitken-Neville,
+      T_j,l+1 = T_j,l + (T_j,l - T_j-1,l) / ((n_j / n_j-l)^p - 1),
+    with p = 2 for the midpoint rule (error expansion in h^2) and p = 1
+    for linearly implicit Euler. T_kk has order p k, and
+    T_kk - T_k,k-1 estimates the local error.
+
+    The linearly implicit Euler rows need the inverses of I - h/n_j J.
+    J is kept across rejected steps, where y does not change, and for the
+    next step if the error estimate was below 0.1 (the expansion in h
+    holds for any J, only the stability suffers); a rejection with such
+    an old J evaluates it again. While J is kept, h is not raised by less
+    than 20%, and the rows keep their inverses as long as h and J stay.
+
+    The rows are independent and run concurrently on the thread pool when
+    parallel is set, longest first. Order selection then weights the
+    work per row by the parallel critical path instead of the total number
+    of evaluations, which favours high orders on many cores.
+
+    DoStep(tau, y) integrates over tau with as many steps as needed,
+    |err_i| <= atol + rtol |y_i| in the rms norm.
+  */
+  class Extrapolation : public TimeStepper
+  {
+    struct Row
+    {
+      size_t steps;
+      Vector<> z[2], f;
+      Matrix<> inv;             // (I - h/n_j J)^-1, linearly implicit Euler only
+      double invStep = 0;       // h/n_j and Jacobian number of inv
+      size_t invJac = 0;
+      bool factored = false;    // inv was computed in this step
+    };
+
+    ExtrapolationBase m_base;
+    double m_rtol, m_atol;
+    size_t m_kmax;
+    bool m_parallel;
+    size_t m_n;
+    int m_p;                    // exponent of the error expansion
+
+    std::vector<Row> m_rows;
+    std::vector<Vector<>> m_T;  // extrapolation tableau, Aitken-Neville in place
+    std::vector<double> m_cost; // work for rows 1..k
+    Matrix<> m_jac;
+    bool m_jacCurrent = false;  // J belongs to the current y
+    bool m_jacValid = false;    // J may be used for the next step
+    bool m_f0Valid = false;
+    Vector<> m_yf0;             // state of m_f0 (and of J if m_jacCurrent)
+    Vector<> m_f0, m_scal;
+    Vector<> m_ylow;            // T_k-1,k-1
+
+    size_t m_k;                 // rows used in the current step
+    double m_h = 0;
+    bool m_lastRejected = false;
+    size_t m_steps = 0, m_rejected = 0, m_evaluations = 0;
+    size_t m_jacobians = 0, m_factorizations = 0;
+
+    // J is kept for the next step if the error estimate is below this
+    static constexpr double keepJacobian = 0.1;
+
+    // the base method with n_j substeps of h / n_j, result in z[0]
+    void baseMethod (size_t j, double h, VectorView<double> y)
+    {
+      Row & r = m_rows[j];
+      size_t nj = r.steps;
+      double hs = h / nj;
+
+      if (m_base == ExtrapolationBase::Midpoint)
+        {
+          // z_1 = z_0 + hs f(z_0),  z_i+1 = z_i-1 + 2 hs f(z_i)
+          r.z[0] = y;
+          r.z[1] = y + hs * m_f0;
+          for (size_t i = 1; i < nj; i++)
+            {
+              m_rhs->evaluate(r.z[i%2], r.f);
+              r.z[(i+1)%2] += 2 * hs * r.f;
+            }
+          return;
+        }
+
+      // kept while h and J do not change
+      if (r.invStep != hs || r.invJac != m_jacobians)
+        {
+          for (size_t l = 0; l < m_n; l++)
+            for (size_t m = 0; m < m_n; m++)
+              r.inv(l,m) = (l == m) - hs * m_jac(l,m);
+          calcInverse(r.inv);
+          r.invStep = hs;
+          r.invJac = m_jacobians;
+          r.factored = true;
+        }
+
+      r.z[0] = y;
+      r.f = m_f0;
+      for (size_t i = 0; i < nj; i++)
+        {
+          if (i > 0)
+            m_rhs->evaluate(r.z[0], r.f);
+          r.z[1] = hs * r.f;
+          r.z[0] += r.inv * r.z[1];
+        }
+    }
+
+    double rmsNorm (VectorView<double> v) const
+    {
+      double sum = 0;
+      for (size_t l = 0; l < m_n; l++)
+        {
+          double q = v(l) / m_scal(l);
+          sum += q*q;
+        }
+      return std::sqrt(sum / m_n);
+    }
+
+    // exponent of the local error estimate with k rows
+    double errorExponent (size_t k) const { return 1.0 / (m_p * (k-1) + 1); }
+
+    // work for the rows 1..k, in evaluations; a factorization counts as one
+    void computeCosts ()
+    {
+      size_t threads = m_parallel ? ThreadPool::global().numThreads() : 1;
+      double factor = m_base == ExtrapolationBase::LinearlyImplicitEuler ? 1 : 0;
+      double total = 1;
+      m_cost.assign(m_kmax+1, 0);
+      for (size_t k = 1; k <= m_kmax; k++)
+        {
+          double row = m_rows[k-1].steps - 1 + factor;
+          total += row;
+          // the longest row is the critical path of the parallel version
+          m_cost[k] = threads > 1 ? std::max(1 + row, total / threads) : total;
+        }
+    }
+
+  public:
+    /*
+      kmax: maximal number of rows of the extrapolation tableau
+      (order 2 kmax for the midpoint rule, kmax for linearly implicit Euler).
+    */
+    Extrapolation (std::shared_ptr<NonlinearFunction> rhs, double rtol = 1e-8, double atol = 1e-8,
+                   ExtrapolationBase base = ExtrapolationBase::Midpoint,
+                   size_t kmax = 8, bool parallel = false)
+      : TimeStepper(rhs), m_base(base), m_rtol(rtol), m_atol(atol), m_kmax(kmax),
+        m_parallel(parallel), m_n(rhs->dimX()),
+        m_p(base == ExtrapolationBase::Midpoint ? 2 : 1),
+        m_jac(base == ExtrapolationBase::Midpoint ? 0 : m_n, base == ExtrapolationBase::Midpoint ? 0 : m_n),
+        m_yf0(m_n), m_f0(m_n), m_scal(m_n), m_ylow(m_n)
+    {
+      if (kmax < 3)
+        throw std::invalid_argument("Extrapolation: kmax must be at least 3");
+      if (rtol <= 0 || atol < 0)
+        throw std::invalid_argument("Extrapolation: tolerances must be positive");
+
+      bool implicit = base == ExtrapolationBase::LinearlyImplicitEuler;
+      for (size_t j = 0; j < kmax; j++)
+        m_rows.push_back(Row{ implicit ? j+1 : 2*(j+1),
+                              { Vector<>(m_n), Vector<>(m_n) }, Vector<>(m_n),
+                              Matrix<>(implicit ? m_n : 0, implicit ? m_n : 0) });
+      for (size_t j = 0; j < kmax; j++)
+        m_T.emplace_back(m_n);
+      computeCosts();
+
+      // start in the middle: order 8 (midpoint) or 5 (implicit Euler)
+      m_k = std::min(kmax-1, implicit ? size_t(5) : size_t(4));
+    }
+
+    // number of rows and order of the current tableau
+    size_t rows() const { return m_k; }
+    size_t order() const { return m_p * m_k; }
+    double stepSize() const { return m_h; }
+    size_t numSteps() const { return m_steps; }
+    size_t numRejected() const { return m_rejected; }
+    size_t numEvaluations() const { return m_evaluations; }
+    size_t numJacobians() const { return m_jacobians; }
+    size_t numFactorizations() const { return m_factorizations; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("Extrapolation: adaptive steps need tau >= 0");
+      if (m_h <= 0)
+        m_h = tau;
+      bool implicit = m_base == ExtrapolationBase::LinearlyImplicitEuler;
+
+      // f(y) and J are kept from the last step if y was not changed since
+      bool same = m_f0Valid;
+      for (size_t l = 0; same && l < m_n; l++)
+        if (y(l) != m_yf0(l)) same = false;
+      if (!same)
+        {
+          m_rhs->evaluate(y, m_f0);
+          m_evaluations++;
+          m_yf0 = y;
+          m_f0Valid = true;
+          m_jacCurrent = m_jacValid = false;
+        }
+
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(m_h, tau - t);
+          if (tau - t - h < 1e-10 * h)
+            h = tau - t;
+          if (h < 1e-14 * tau)
+            throw std::domain_error("Extrapolation: step size too small");
+
+          if (implicit && !m_jacValid)
+            {
+              m_rhs->evaluateDeriv(y, m_jac);
+              m_jacobians++;
+              m_jacCurrent = m_jacValid = true;
+            }
+
+          size_t k = m_k;
+          m_steps++;
+
+          // rows 1..k, longest first for the dynamic schedule of the pool
+          auto row = [&] (size_t i) { baseMethod(k-1-i, h, y); };
+          if (m_parallel)
+            ParallelFor(k, row);
+          else
+            for (size_t i = 0; i < k; i++) row(i);
+          for (size_t j = 0; j < k; j++)
+            {
+              m_evaluations += m_rows[j].steps-1;
+              if (m_rows[j].factored)
+                m_factorizations++;
+              m_rows[j].factored = false;
+            }
+
+          // Aitken-Neville: after row j, m_T[0] = T_jj and m_T[1] = T_j,j-1
+          std::vector<double> err(k+1, 0), hopt(k+1, 0);
+          bool finite = true;
+          for (size_t j = 0; j < k; j++)
+            {
+              m_T[j] = m_rows[j].z[0];
+              for (size_t l = j; l > 0; l--)
+                {
+                  double fac = std::pow(double(m_rows[j].steps) / m_rows[l-1].steps, m_p) - 1;
+                  m_T[l-1] = m_T[l] + (1/fac) * (m_T[l] - m_T[l-1]);
+                }
+              if (j == 0) continue;
+
+              for (size_t l = 0; l < m_n; l++)
+                m_scal(l) = m_atol + m_rtol * std::max(std::abs(y(l)), std::abs(m_T[0](l)));
+              m_rows[j].f = m_T[0] - m_T[1];
+              double e = rmsNorm(m_rows[j].f);
+              if (!std::isfinite(e)) finite = false;
+              err[j+1] = std::max(e, 1e-14);
+              double expo = errorExponent(j+1);
+              hopt[j+1] = h * std::clamp(0.94 * std::pow(0.65 / err[j+1], expo),
+                                         std::pow(0.02, expo) / 4, 1 / std::pow(0.02, expo));
+              if (j+2 == k)
+                m_ylow = m_T[0];
+            }
+
+          if (!finite)
+            {
+              m_h = 0.25 * h;
+              m_rejected++;
+              m_lastRejected = true;
+              if (!m_jacCurrent) m_jacValid = false;
+              continue;
+            }
+
+          // work per unit step of the orders k-1 and k
+          size_t knew = k;
+          double wk = m_cost[k] / hopt[k];
+          double wkm1 = k > 2 ? m_cost[k-1] / hopt[k-1] : 0;
+          double hnew = hopt[k];
+          if (k > 2 && wkm1 < 0.8 * wk)
+            {
+              knew = k-1;
+              hnew = hopt[k-1];
+            }
+          else if (!m_lastRejected && k < m_kmax && (k == 2 || wk < 0.9 * wkm1))
+            {
+              knew = k+1;
+              hnew = hopt[k] * m_cost[k+1] / m_cost[k];
+            }
+
+          // the lower order k-1 converged even if k did not
+          bool lower = err[k] > 1 && k > 2 && err[k-1] <= 1;
+          if (lower)
+            {
+              knew = k-1;
+              hnew = hopt[k-1];
+            }
+
+          if (err[k] <= 1 || lower)
+            {
+              y = lower ? m_ylow : m_T[0];
+              t += h;
+              // no growth right after a rejection
+              if (m_lastRejected)
+                {
+                  knew = std::min(knew, k);
+                  hnew = std::min(hnew, h);
+                }
+              m_lastRejected = false;
+              m_rhs->evaluate(y, m_f0);
+              m_evaluations++;
+              m_yf0 = y;
+              m_jacCurrent = false;
+              m_jacValid = implicit && err[k] <= keepJacobian;
+              // keep h, and so the inverses, for small changes
+              if (m_jacValid && hnew / h >= 1 && hnew / h <= 1.2)
+                hnew = h;
+            }
+          else
+            {
+              // no order increase after a rejection
+              knew = std::min(knew, k);
+              hnew = std::min(hnew, hopt[knew]);
+              m_rejected++;
+              m_lastRejected = true;
+              // J from an earlier y may have caused the rejection
+              if (!m_jacCurrent) m_jacValid = false;
+            }
+          m_k = knew;
+          m_h = hnew;
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<Extrapolation>(m_rhs->clone(), m_rtol, m_atol, m_base, m_kmax, m_parallel);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef LOWSTORAGERK_HPP
+#define LOWSTORAGERK_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Low-storage explicit Runge-Kutta methods in Williamson's 2N form:
+      dY = A_i dY + h f(Y),  Y = Y + B_i dY,   i = 0..s-1, A_0 = 0.
+    Only y, dY and the rhs output f are stored, whatever the number of
+    stages: 3 vectors of size N (the 2N of the name counts the registers
+    of a rhs that can evaluate in place, which NonlinearFunction cannot).
+    Schemes with error weights e = b - bhat (the Butcher weights of the
+    scheme minus an embedded method of lower order) accumulate the
+    estimate h sum_i e_i k_i in a fourth vector, and adaptive steps keep
+    a fifth copy of y to restore it after a rejected step:
+
+      fixed steps 3N, fixed steps with error() 4N, adaptive steps 5N.
+
+    The 3S* form below needs 4N also when adaptive.
+  */
+  struct LowStorageScheme
+  {
+    std::vector<double> A, B;
+    std::vector<double> e;      // empty: no error estimate
+    int order;
+  };
+
+  // Williamson 1980, third order, 3 stages; embedded bhat = (-1/2, 3/2, 0)
+  inline LowStorageScheme Williamson3Scheme ()
+  {
+    return { { 0, -5.0/9, -153.0/128 },
+             { 1.0/3, 15.0/16, 8.0/15 },
+             { 2.0/3, -6.0/5, 8.0/15 },
+             3 };
+  }
+
+  // Carpenter and Kennedy 1994, fourth order, 5 stages;
+  // embedded third order solution without the last stage
+  inline LowStorageScheme CarpenterKennedy4Scheme ()
+  {
+    return { { 0,
+               -567301805773.0/1357537059087,
+               -2404267990393.0/2016746695238,
+               -3550918686646.0/2091501179385,
+               -1275806237668.0/842570457699 },
+             { 1432997174477.0/9575080441755,
+               5161836677717.0/13612068292357,
+               1720146321549.0/2090206949498,
+               3134564353537.0/4481467310338,
+               2277821191437.0/14882151754819 },
+             { -4.895423576561098, 10.525898847361994, -7.452185327504108,
+               1.6686528087350616, 0.15305724796815198 },
+             4 };
+  }
+
+
+  /*
+    With tol = 0, DoStep(tau, y) is one step of size tau, and error()
+    returns the embedded estimate of that step if the scheme has one.
+    With tol > 0, DoStep takes as many adaptive steps as needed to reach
+    tau, keeping |err_i| <= tol max(1, |y_i|) per step; this needs one
+    more vector to restore y after a rejected step (5N storage in all).
+    The tolerance bounds the local error, the global error accumulates
+    over the steps and may exceed it.
+  */
+  class LowStorageRungeKutta : public TimeStepper
+  {
+    LowStorageScheme m_scheme;
+    double m_tol;
+    size_t m_n;
+    Vector<> m_dy, m_f, m_err, m_ysave;
+    double m_error = 0;
+    double m_h = 0;
+    size_t m_steps = 0, m_rejected = 0;
+
+    // one step of size h; m_error = scaled max norm of the estimate
+    void step (double h, VectorView<double> y)
+    {
+      bool estimate = !m_scheme.e.empty();
+      if (estimate) m_err = 0.0;
+
+      for (size_t i = 0; i < m_scheme.A.size(); i++)
+        {
+          m_rhs->evaluate(y, m_f);
+          double a = m_scheme.A[i], b = m_scheme.B[i];
+          double he = estimate ? h * m_scheme.e[i] : 0;
+          for (size_t l = 0; l < m_n; l++)
+            {
+              double d = h * m_f(l);
+              if (i > 0) d += a * m_dy(l);
+              m_dy(l) = d;
+              y(l) += b * d;
+              if (estimate) m_err(l) += he * m_f(l);
+            }
+        }
+
+      m_error = 0;
+      if (estimate)
+        for (size_t l = 0; l < m_n; l++)
+          m_error = std::max(m_error, std::abs(m_err(l)) / std::max(1.0, std::abs(y(l))));
+    }
+
+  public:
+    LowStorageRungeKutta (std::shared_ptr<NonlinearFunction> rhs,
+                          LowStorageScheme scheme, double tol = 0)
+      : TimeStepper(rhs), m_scheme(std::move(scheme)), m_tol(tol), m_n(rhs->dimX()),
+        m_dy(m_n), m_f(m_n),
+        m_err(m_scheme.e.empty() ? 0 : m_n), m_ysave(tol > 0 ? m_n : 0)
+    {
+      if (m_scheme.A.size() != m_scheme.B.size() || m_scheme.A.empty())
+        throw std::invalid_argument("LowStorageRungeKutta: A and B must have the same, positive length");
+      if (tol > 0 && m_scheme.e.size() != m_scheme.A.size())
+        throw std::invalid_argument("LowStorageRungeKutta: adaptive steps need a scheme with error weights");
+    }
+
+    // scaled error estimate of the last step (0 without error weights)
+    double error() const { return m_error; }
+    size_t numSteps() const { return m_steps; }
+    size_t numRejected() const { return m_rejected; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      if (m_tol <= 0)
+        {
+          step(tau, y);
+          m_steps++;
+          return;
+        }
+
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("LowStorageRungeKutta: adaptive steps need tau >= 0");
+      if (m_h <= 0) m_h = tau;
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(m_h, tau - t);
+          if (tau - t - h < 1e-14 * tau)
+            h = tau - t;
+
+          m_ysave = y;
+          step(h, y);
+          double err = m_error / m_tol;
+          double fac = err > 0 ? 0.9 * std::pow(err, -1.0 / m_scheme.order) : 5;
+          m_h = h * std::clamp(fac, 0.2, 5.0);
+
+          if (err <= 1)
+            {
+              t += h;
+              m_steps++;
+            }
+          else
+            {
+              y = m_ysave;
+              m_rejected++;
+            }
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<LowStorageRungeKutta>(m_rhs->clone(), m_scheme, m_tol);
+    }
+  };
+
+
+  /*
+    Low-storage schemes in Ketcheson's 3S* form (J. Comput. Phys. 229,
+    2010), with registers S1 = y, S2 and S3:
+      S2 = 0, S3 = y_n
+      S2 += delta_i S1,  S1 = gamma1_i S1 + gamma2_i S2 + gamma3_i S3 + beta_i h f(S1),
+                                                               i = 0..s-1
+    S3 keeps y_n, which serves as the restore copy for rejected steps.
+    3S*+ schemes add two weights delta_s, delta_s+1 for the embedded
+      yhat = (S2 + delta_s S1 + delta_s+1 S3) / sum_j delta_j,
+    so the estimate y_n+1 - yhat needs no register of its own. With the
+    rhs output f this is 4 vectors of size N, with or without estimate
+    and adaptivity (the rhs cannot evaluate in place, so 3 registers
+    alone are not reachable through NonlinearFunction).
+
+    The coefficients below were computed for this file by solving the
+    order conditions in 3S* form (least-norm Newton from random starts,
+    for the 3S*+ schemes followed by minimizing the leading error
+    coefficients with the embedded solution held one order lower); they
+    are not Ketcheson's published tables. check_low_storage verifies
+    the order conditions of every scheme on all rooted trees, on the
+    Butcher tableau obtained by running a step on coefficient vectors.
+    The 5(4) scheme has only a short stability interval on the imaginary
+    axis, prefer the 4(3) one for undamped waves. Over one period of
+    the Kepler orbit (e = 0.5), adaptive 5(4) steps end with a global
+    error of 9.3e-6 at tol = 1e-6 and 7.0e-9 at tol = 1e-9.
+  */
+  struct ThreeSStarScheme
+  {
+    std::vector<double> gamma1, gamma2, gamma3, beta;
+    std::vector<double> delta;    // s weights, or s+2 with embedded solution
+    int order;
+  };
+
+  // 3S*, fourth order, 5 stages, no error estimate;
+  // stability interval [-3.61, 0] on the real, [-3.46, 3.46] on the imaginary axis
+  inline ThreeSStarScheme ThreeSStar4Scheme ()
+  {
+    return { { -0.3425989589338041, 0.26749489179445207, -0.72485318011908684,
+               -0.25582525056989863, -0.3239003234159748 },
+             { 0.96642783315255598, 0.5718650501086795, 0.26450902701524315,
+               0.64782404833881735, 0.67559473281990612 },
+             { 0.45510466021242635, -0.023030035017789552, 1.228675735149543,
+               -0.6222105885691771, -0.87954676619205352 },
+             { 0.32076228044136706, 0.17212661006091473, 0.7809297959867364,
+               0.36960562792541035, 0.4227991094957701 },
+             { 0.91832444004257263, 0.40285289555391585, 0.55466580884542083,
+               1.0231474749320222, 0.36250178511970071 },
+             4 };
+  }
+
+  // 3S*+, fourth order with third order estimate, 6 stages;
+  // stability interval [-5.36, 0] on the real, [-3.76, 3.76] on the imaginary axis
+  inline ThreeSStarScheme ThreeSStarPlus43Scheme ()
+  {
+    return { { 0.058678369494918906, 0.30479895465092632, 0.58219731208836856,
+               -0.2527340766298104, 1.5749427583780919, -1.8151066384470436 },
+             { -0.3165075167529911, -0.024993338472784225, -0.7108097128344405,
+               0.16030596575719119, 0.64955735194449871, 1.1445000315675535 },
+             { 0.74566664092685908, 0.68127321616368575, 0.33403803788843983,
+               1.1956357843954302, -1.2324209026364943, -0.29708155235392875 },
+             { 0.3166139872075, 0.23740371367000265, 0.69138038643760713,
+               0.27703425131635923, 0.22398874403693017, 0.14236037743288635 },
+             { -0.61816854015165512, 0.060906884188636913, 0.43941766971644625,
+               0.47402718856646925, 0.65601093618102513, 1.7070615233258351,
+               -1.3430632166772269, -0.5360581453107236 },
+             4 };
+  }
+
+  // 3S*+, fifth order with fourth order estimate, 10 stages;
+  // stability interval [-4.50, 0] on the real, [-0.88, 0.88] on the imaginary axis
+  inline ThreeSStarScheme ThreeSStarPlus54Scheme ()
+  {
+    return { { -0.34238657505547071, -0.69618690500808578, -1.134288777976306,
+               0.26810526519807204, -1.0418105618549014, -1.3903739696590676,
+               -0.77663749455892661, 0.037847818834501688, -3.5587292298273439,
+               -0.21435126808178337 },
+             { 0.96634785612072838, 0.14769908098664083, 0.21650630321630002,
+               0.75048039830467828, 0.8701527249696005, 0.33576691134662606,
+               0.28524085000891775, 0.20968963646429686, 1.4762454369577982,
+               0.40646868747416609 },
+             { 1.2337797881700965, 1.7162674464842136, 1.961883578121258,
+               0.061730201151543485, 0.68712429451637247, 0.85753495434260318,
+               0.033363447850287553, -0.1336744728922683, -0.46657999321805921,
+               0.17246530466972709 },
+             { 0.082685354501804087, 0.60621391274867864, 0.53963461547123481,
+               0.081203929209823986, 0.36353879984304571, 1.0281091613027662,
+               -0.36974497923700789, -0.00063641907970027258, -0.42954091200910832,
+               0.096079825153941173 },
+             { 0.11238891481723913, -0.24834467934866597, 0.9322614484486631,
+               0.09667504571177761, 0.66385662600399398, 3.00835046817269,
+               1.5463983906307606, -0.88564051423324797, -1.8218307087276682,
+               -0.84085244378353752, -1.7884153307838517, -0.1948781218865217 },
+             5 };
+  }
+
+
+  // same interface and step size control as LowStorageRungeKutta
+  class LowStorage3SRungeKutta : public TimeStepper
+  {
+    ThreeSStarScheme m_scheme;
+    double m_tol;
+    size_t m_n;
+    Vector<> m_s2, m_s3, m_f;
+    double m_error = 0;
+    double m_h = 0;
+    size_t m_steps = 0, m_rejected = 0;
+
+    bool embedded() const { return m_scheme.delta.size() == m_scheme.beta.size() + 2; }
+
+    // one step of size h, S3 = y_n afterwards; m_error = scaled max norm of y - yhat
+    void step (double h, VectorView<double> y)
+    {
+      const auto & s = m_scheme;
+      size_t stages = s.beta.size();
+      m_s2 = 0.0;
+      m_s3 = y;
+
+      for (size_t i = 0; i < stages; i++)
+        {
+          m_rhs->evaluate(y, m_f);
+          double g1 = s.gamma1[i], g2 = s.gamma2[i], g3 = s.gamma3[i];
+          double d = s.delta[i], hb = h * s.beta[i];
+          for (size_t l = 0; l < m_n; l++)
+            {
+              m_s2(l) += d * y(l);
+              y(l) = g1 * y(l) + g2 * m_s2(l) + g3 * m_s3(l) + hb * m_f(l);
+            }
+        }
+
+      m_error = 0;
+      if (embedded())
+        {
+          double sum = 0;
+          for (double d : s.delta)
+            sum += d;
+          double d1 = s.delta[stages], d2 = s.delta[stages+1];
+          for (size_t l = 0; l < m_n; l++)
+            {
+              double yhat = (m_s2(l) + d1 * y(l) + d2 * m_s3(l)) / sum;
+              m_error = std::max(m_error, std::abs(y(l) - yhat) / std::max(1.0, std::abs(y(l))));
+            }
+        }
+    }
+
+  public:
+    LowStorage3SRungeKutta (std::shared_ptr<NonlinearFunction> rhs,
+                            ThreeSStarScheme scheme, double tol = 0)
+      : TimeStepper(rhs), m_scheme(std::move(scheme)), m_tol(tol), m_n(rhs->dimX()),
+        m_s2(m_n), m_s3(m_n), m_f(m_n)
+    {
+      size_t s = m_scheme.beta.size();
+      if (s == 0 || m_scheme.gamma1.size() != s || m_scheme.gamma2.size() != s
+          || m_scheme.gamma3.size() != s
+          || (m_scheme.delta.size() != s && m_scheme.delta.size() != s+2))
+        throw std::invalid_argument("LowStorage3SRungeKutta: coefficient lengths do not match");
+      if (tol > 0 && !embedded())
+        throw std::invalid_argument("LowStorage3SRungeKutta: adaptive steps need a 3S*+ scheme");
+    }
+
+    // scaled error estimate of the last step (0 without embedded solution)
+    double error() const { return m_error; }
+    size_t numSteps() const { return m_steps; }
+    size_t numRejected() const { return m_rejected; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      if (m_tol <= 0)
+        {
+          step(tau, y);
+          m_steps++;
+          return;
+        }
+
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("LowStorage3SRungeKutta: adaptive steps need tau >= 0");
+      if (m_h <= 0) m_h = tau;
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(m_h, tau - t);
+          if (tau - t - h < 1e-14 * tau)
+            h = tau - t;
+
+          step(h, y);
+          double err = m_error / m_tol;
+          double fac = err > 0 ? 0.9 * std::pow(err, -1.0 / m_scheme.order) : 5;
+          m_h = h * std::clamp(fac, 0.2, 5.0);
+
+          if (err <= 1)
+            {
+              t += h;
+              m_steps++;
+            }
+          else
+            {
+              y = m_s3;
+              m_rejected++;
+            }
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<LowStorage3SRungeKutta>(m_rhs->clone(), m_scheme, m_tol);
+    }
+  };
+
+}
+
+#endif
@@ -12,18 +12,29 @@ namespace ASC_ode
                      std::function<void(int,double,VectorView<double>)> callback = nullptr)
   {
     Vector<double> res(func->dimF());
-    Matrix<double> fprime(func->dimF(), func->dimX());
+    Vector<double> dx(func->dimX());
+    double lasterr = 0, rate = 1;
 
     for (int i = 0; i < maxsteps; i++)
       {
-        func->evaluate(x, res);
+        // residual and Jacobian in one call, unless the observed
+        // contraction predicts that this iterate already converged
+        std::shared_ptr<LinearOperator> fprime;
+        if (i > 0 && rate*lasterr < tol)
+          func->evaluate(x, res);
+        else
+          fprime = func->evaluateWithDerivOp(x, res);
+
         double err= norm(res);
         if (err < tol) return;
-
-        func->evaluateDeriv(x, fprime);
-
-        calcInverse(fprime);
-        x -= fprime*res;
+        if (i > 0) rate = err / lasterr;
+        lasterr = err;
+
+        // structured Jacobian, dense inverse only where no structure is left
+        if (!fprime)
+          fprime = func->evaluateDerivOp(x);
+        fprime->inverse()->mult(res, dx);
+        x -= dx;
 
         // LapackLU LU(fprime);
         // LU.solve(res);
@@ -0,0 +1,436 @@
+#ifndef RADAU_HPP
+#define RADAU_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "timestepper.hpp"
+#include "tableau.hpp"
+#include "predictor.hpp"
+#include "ParallelIRK.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Adaptive Radau IIA integrator in the style of RADAU5 / RADAU by Hairer
+    and Wanner, with 3, 5 or 7 stages (order 5, 9, 13).
+
+    - Stage equations by simplified Newton, the linear systems decoupled by
+      the eigenvalues of A (StageSystemSolver), starting from the
+      extrapolated stages of the previous step (StagePredictor).
+    - Embedded error estimate of order s with weight gamma0 = the real
+      eigenvalue of A on f(y_n):
+        err = (I - h gamma0 J)^-1  h gamma0 (f(y_n) - sum_i l_i(0) K_i),
+      l_i the Lagrange polynomials of the nodes; after a rejected step
+      f(y_n + err) replaces f(y_n) to filter stiff components.
+    - Step size control with the predictive (Gustafsson) controller.
+    - Jacobian reuse: J is kept while Newton contracts fast (theta < 0.001),
+      and the factorizations are kept while h changes by less than 20%.
+    - Variable order: the number of stages goes down when Newton
+      converges slowly (theta >= 0.8) or fails. It goes up when Newton
+      converges very fast (theta <= 0.002) and the estimated work per
+      unit time of the higher order is smaller (predictedWorkRatio), which
+      for rtol >= 5e-7 keeps 3 stages and for rtol >= 2e-11 at most 5.
+      The work per unit time (rhs evaluations over the time covered) is
+      also measured after 3 steps at an order: a raise is taken back after
+      5 steps if the new order does more work than the old one, and not
+      tried again while that measurement is less than 50 steps old.
+
+    DoStep(tau, y) integrates over tau with as many steps as needed,
+    |err_i| <= atol + rtol |y_i| in the rms norm.
+  */
+  class AdaptiveRadau : public TimeStepper
+  {
+    struct Method
+    {
+      const ButcherTableau * tab;
+      size_t stages;
+      StageSystemSolver solver;
+      StagePredictor predictor;
+      Vector<> l0;                 // Lagrange polynomials of the nodes at 0
+      Vector<> k, ystage, res, dk;
+
+      Method (const ButcherTableau & _tab, size_t n, bool parallel)
+        : tab(&_tab), stages(_tab.stages()), solver(_tab.eig, n, parallel),
+          predictor(_tab.c, n), l0(stages),
+          k(stages*n), ystage(stages*n), res(stages*n), dk(stages*n)
+      {
+        for (size_t j = 0; j < stages; j++)
+          {
+            double lj = 1;
+            for (size_t m = 0; m < stages; m++)
+              if (m != j) lj *= (0 - tab->c(m)) / (tab->c(j) - tab->c(m));
+            l0(j) = lj;
+          }
+      }
+    };
+
+    double m_rtol, m_atol;
+    bool m_variableOrder, m_parallel;
+    size_t m_n;
+    std::vector<std::unique_ptr<Method>> m_methods;     // 3, 5, 7 stages
+    size_t m_order;                                     // index into m_methods
+
+    Matrix<> m_jac;
+    Vector<> m_f0, m_ynew, m_scal, m_err, m_tmp;
+    bool m_jacCurrent = false;      // J belongs to the current y
+    bool m_jacValid = false;        // J may be used for the next step
+    bool m_factored = false;
+    double m_hFactored = 0;
+    bool m_f0Valid = false;
+    Vector<> m_yf0;                 // state of m_f0
+
+    double m_h = 0;
+    double m_theta = 0, m_eta = 1;
+    double m_hacc = 0, m_erracc = 1e-2;
+    bool m_first = true, m_lastRejected = false;
+    size_t m_newtonIts = 0;
+
+    // work per unit time of the orders (0: not measured), and the
+    // evaluations, time and accepted steps since the current order began
+    std::vector<double> m_work;
+    size_t m_orderMark = 0, m_orderSteps = 0;
+    double m_orderTime = 0;
+    bool m_raised = false;
+
+    size_t m_steps = 0, m_accepted = 0, m_rejected = 0;
+    size_t m_jacobians = 0, m_factorizations = 0, m_evaluations = 0;
+
+    static constexpr int maxNewton = 7;
+    static constexpr double safe = 0.9, facl = 5, facr = 0.125;
+    static constexpr double workMargin = 2;
+
+    Method & method() { return *m_methods[m_order]; }
+
+    template <typename F>
+    void forEach (size_t n, F && f)
+    {
+      if (m_parallel)
+        ParallelFor(n, f);
+      else
+        for (size_t i = 0; i < n; i++) f(i);
+    }
+
+    double rmsNorm (VectorView<double> v, size_t blocks = 1) const
+    {
+      double sum = 0;
+      for (size_t l = 0; l < v.size(); l++)
+        {
+          double q = v(l) / m_scal(l % m_n);
+          sum += q*q;
+        }
+      return std::sqrt(sum / (blocks*m_n));
+    }
+
+    // simplified Newton for the stages of a step of size h
+    bool newton (double h, VectorView<double> y)
+    {
+      Method & m = method();
+      size_t s = m.stages, n = m_n;
+      const Matrix<> & a = m.tab->a;
+      double fnewt = std::max(10 * std::numeric_limits<double>::epsilon() / m_rtol,
+                              std::min(0.03, std::sqrt(m_rtol)));
+      double eta = std::pow(std::max(m_eta, std::numeric_limits<double>::epsilon()), 0.8);
+      double dynold = 0;
+
+      for (m_newtonIts = 1; m_newtonIts <= maxNewton; m_newtonIts++)
+        {
+          forEach(s, [&] (size_t i)
+          {
+            auto yi = m.ystage.range(i*n, (i+1)*n);
+            yi = y;
+            for (size_t j = 0; j < s; j++)
+              yi += h * a(i,j) * m.k.range(j*n, (j+1)*n);
+            m_rhs->evaluate(yi, m.res.range(i*n, (i+1)*n));
+            m.res.range(i*n, (i+1)*n) = m.k.range(i*n, (i+1)*n) - m.res.range(i*n, (i+1)*n);
+          });
+          m_evaluations += s;
+
+          m.solver.solve(m.res, m.dk);
+          m.k -= m.dk;
+
+          double dyno = h * rmsNorm(m.dk, s);
+          if (!std::isfinite(dyno)) return false;
+          if (m_newtonIts > 1)
+            {
+              m_theta = dyno / dynold;
+              if (m_theta >= 0.99) return false;
+              eta = m_theta / (1 - m_theta);
+              // the remaining iterations cannot reach the tolerance
+              if (eta * dyno * std::pow(m_theta, maxNewton - m_newtonIts) > fnewt)
+                return false;
+            }
+          dynold = std::max(dyno, std::numeric_limits<double>::epsilon());
+          if (eta * dyno <= fnewt)
+            {
+              m_eta = eta;
+              return true;
+            }
+        }
+      return false;
+    }
+
+    // scaled norm of the embedded error estimate of the step y -> m_ynew
+    double estimate (double h, VectorView<double> y)
+    {
+      Method & m = method();
+      double gamma0 = m.solver.realEigenvalue();
+      auto raw = [&] (VectorView<double> f0)
+      {
+        m_tmp = f0;
+        for (size_t j = 0; j < m.stages; j++)
+          m_tmp -= m.l0(j) * m.k.range(j*m_n, (j+1)*m_n);
+        m_tmp *= h * gamma0;
+        m.solver.solveReal(m_tmp, m_err);
+      };
+
+      for (size_t l = 0; l < m_n; l++)
+        m_scal(l) = m_atol + m_rtol * std::max(std::abs(y(l)), std::abs(m_ynew(l)));
+
+      raw(m_f0);
+      double err = rmsNorm(m_err);
+      if (err >= 1 && (m_first || m_lastRejected))
+        {
+          m_err += y;
+          m_rhs->evaluate(m_err, m_tmp);
+          m_evaluations++;
+          Vector<> f1 = m_tmp;
+          raw(f1);
+          err = rmsNorm(m_err);
+        }
+      return std::max(err, 1e-10);
+    }
+
+    // evaluations per unit time at the current order, 0 if too few steps
+    double orderWork() const
+    {
+      return m_orderSteps >= 3 ? (m_evaluations - m_orderMark) / m_orderTime : 0.0;
+    }
+
+    void setOrder (size_t order)
+    {
+      if (order == m_order) return;
+      if (double w = orderWork(); w > 0)
+        m_work[m_order] = w;
+      m_raised = order > m_order;
+      m_order = order;
+      m_orderMark = m_evaluations;
+      m_orderSteps = 0;
+      m_orderTime = 0;
+      m_factored = false;
+      method().predictor.reset();
+    }
+
+    /*
+      predicted work per unit time of s+2 stages relative to s: (s+2)/s
+      evaluations per Newton iteration, and for derivatives growing like
+      rho^-k the error estimate of order s allows h ~ rho rtol^(1/(s+1)).
+      workMargin (calibrated on Van der Pol and Robertson) accounts for
+      the more Newton iterations and the larger error constants of more
+      stages.
+    */
+    double predictedWorkRatio() const
+    {
+      double s = double(m_methods[m_order]->stages);
+      return workMargin * (s+2) / s * std::pow(m_rtol, 2 / ((s+1)*(s+3)));
+    }
+
+    // after an accepted step of size h, with hnew proposed for the next one
+    void selectOrder (double h, double hnew)
+    {
+      m_orderTime += h;
+      m_orderSteps++;
+      if (m_orderSteps % 50 == 0)
+        for (size_t o = 0; o < m_work.size(); o++)
+          if (o != m_order) m_work[o] = 0;
+
+      double work = orderWork();
+      if (m_theta >= 0.8 && m_order > 0)
+        setOrder(m_order-1);
+      else if (m_raised && m_orderSteps >= 5 && m_work[m_order-1] > 0 && work > m_work[m_order-1])
+        setOrder(m_order-1);
+      else if (m_theta <= 0.002 && m_order+1 < m_methods.size() && hnew >= h && work > 0
+               && !(m_work[m_order+1] > 0 && m_work[m_order+1] >= work)
+               && predictedWorkRatio() < 1)
+        setOrder(m_order+1);
+    }
+
+  public:
+    /*
+      stages: 3, 5 or 7 to start with; with variableOrder the integrator
+      switches between them. parallel runs stages and the decoupled solves
+      on the thread pool.
+    */
+    AdaptiveRadau (std::shared_ptr<NonlinearFunction> rhs, double rtol = 1e-6, double atol = 1e-6,
+                   size_t stages = 3, bool variableOrder = true, bool parallel = false)
+      : TimeStepper(rhs), m_rtol(rtol), m_atol(atol),
+        m_variableOrder(variableOrder), m_parallel(parallel), m_n(rhs->dimX()),
+        m_jac(m_n, m_n), m_f0(m_n), m_ynew(m_n), m_scal(m_n), m_err(m_n), m_tmp(m_n), m_yf0(m_n)
+    {
+      if (stages != 3 && stages != 5 && stages != 7)
+        throw std::invalid_argument("AdaptiveRadau: stages must be 3, 5 or 7");
+      if (rtol <= 0 || atol < 0)
+        throw std::invalid_argument("AdaptiveRadau: tolerances must be positive");
+      for (size_t s : { 3, 5, 7 })
+        m_methods.push_back(std::make_unique<Method>(GetTableau(TableauFamily::RadauIIA, s), m_n, parallel));
+      m_order = (stages - 3) / 2;
+      m_work.assign(m_methods.size(), 0.0);
+    }
+
+    size_t stages() const { return m_methods[m_order]->stages; }
+    double stepSize() const { return m_h; }
+    size_t numSteps() const { return m_steps; }
+    size_t numAccepted() const { return m_accepted; }
+    size_t numRejected() const { return m_rejected; }
+    size_t numJacobians() const { return m_jacobians; }
+    size_t numFactorizations() const { return m_factorizations; }
+    size_t numEvaluations() const { return m_evaluations; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("AdaptiveRadau: adaptive steps need tau >= 0");
+      if (m_h <= 0)
+        m_h = std::min(tau, 1e-6);
+
+      // f(y) is kept from the last accepted step if y was not changed since
+      bool same = m_f0Valid;
+      for (size_t l = 0; same && l < m_n; l++)
+        if (y(l) != m_yf0(l)) same = false;
+      if (!same)
+        {
+          m_rhs->evaluate(y, m_f0);
+          m_evaluations++;
+          m_jacCurrent = false;
+          m_jacValid = false;
+        }
+
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(m_h, tau - t);
+          if (tau - t - h < 1e-10 * h)
+            h = tau - t;
+          if (h < 1e-14 * tau)
+            throw std::domain_error("AdaptiveRadau: step size too small");
+
+          if (!m_jacValid)
+            {
+              m_rhs->evaluateDeriv(y, m_jac);
+              m_jacobians++;
+              m_jacCurrent = m_jacValid = true;
+              m_factored = false;
+            }
+          Method & m = method();
+          if (!m_factored || h != m_hFactored)
+            {
+              m.solver.factor(m_jac, h);
+              m_factorizations++;
+              m_factored = true;
+              m_hFactored = h;
+            }
+
+          m_steps++;
+          for (size_t l = 0; l < m_n; l++)
+            m_scal(l) = m_atol + m_rtol * std::abs(y(l));
+          // from the extrapolated stages of the last step, else from K_i = f(y)
+          auto constantGuess = [&] ()
+          {
+            for (size_t j = 0; j < m.stages; j++)
+              m.k.range(j*m_n, (j+1)*m_n) = m_f0;
+          };
+          bool predicted = m.predictor.predict(h, y, m.k);
+          if (!predicted)
+            constantGuess();
+          bool converged = newton(h, y);
+          if (!converged && predicted)
+            {
+              constantGuess();
+              converged = newton(h, y);
+            }
+          if (!converged)
+            {
+              // Newton failed: smaller step, fresh Jacobian if the old one is stale
+              m_h = 0.5 * h;
+              m_rejected++;
+              m_lastRejected = true;
+              if (!m_jacCurrent) m_jacValid = false;
+              m.predictor.reset();
+              if (m_variableOrder && m_order > 0)
+                setOrder(m_order-1);
+              continue;
+            }
+
+          m_ynew = y;
+          for (size_t j = 0; j < m.stages; j++)
+            m_ynew += h * m.tab->b(j) * m.k.range(j*m_n, (j+1)*m_n);
+
+          double err = estimate(h, y);
+          double fac = std::min(safe, safe * (1 + 2*maxNewton) / (m_newtonIts + 2*maxNewton));
+          double quot = std::clamp(std::pow(err, 1.0 / (m.stages+1)) / fac, facr, facl);
+          double hnew = h / quot;
+
+          if (err < 1)
+            {
+              if (!m_first)
+                {
+                  double facgus = m_hacc / h * std::pow(err*err / m_erracc, 1.0 / (m.stages+1)) / safe;
+                  facgus = std::clamp(facgus, facr, facl);
+                  quot = std::max(quot, facgus);
+                  hnew = h / quot;
+                }
+              m_hacc = h;
+              m_erracc = std::max(1e-2, err);
+              // no growth right after a rejection
+              if (m_lastRejected)
+                hnew = std::min(hnew, h);
+
+              m.predictor.store(h, m.k, m_ynew);
+              y = m_ynew;
+              t += h;
+              m_accepted++;
+              m_first = false;
+              m_lastRejected = false;
+
+              m_rhs->evaluate(y, m_f0);
+              m_evaluations++;
+              m_jacCurrent = false;
+              m_jacValid = m_theta <= 0.001;
+
+              // keep h (and the factorizations) for small changes
+              if (m_jacValid && hnew / h >= 1 && hnew / h <= 1.2)
+                hnew = h;
+
+              if (m_variableOrder)
+                selectOrder(h, hnew);
+              m_h = hnew;
+            }
+          else
+            {
+              m_h = m_first ? 0.1 * h : hnew;
+              m_rejected++;
+              m_lastRejected = true;
+              if (!m_jacCurrent) m_jacValid = false;
+            }
+        }
+
+      m_yf0 = y;
+      m_f0Valid = true;
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<AdaptiveRadau>(m_rhs->clone(), m_rtol, m_atol,
+                                             m_methods[m_order]->stages, m_variableOrder, m_parallel);
+    }
+  };
+
+}
+
+#endif
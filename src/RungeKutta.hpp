@@ -15,6 +15,10 @@
 
 #include "nonlinfunc.hpp"
 #include "timestepper.hpp"
+#include "legendre.hpp"
+#include "tableau.hpp"
+#include "lincomb.hpp"
+#include "predictor.hpp"
 
 namespace ASC_ode {
   using namespace nanoblas;
@@ -95,35 +99,63 @@ namespace ASC_ode {
     Vector<> m_b, m_c;
     int m_stages;
     int m_n;
+    bool m_parallel;
     Vector<> m_stage;
     Vector<> m_k;
+    // nonzero a(j,i) of each stage (b for the last entry), as indices i
+    std::vector<std::vector<size_t>> m_nonzero;
+    std::vector<double> m_coefs;
+    std::vector<const double*> m_kptr;
+
+    // out = y + tau sum_i coef_i k_i over the nonzero coefficients, in one pass
+    template <typename TCoef>
+    void combine (double tau, const std::vector<size_t> & nonzero, TCoef coef,
+                  VectorView<double> y, VectorView<double> out)
+    {
+      for (size_t l = 0; l < nonzero.size(); l++)
+        {
+          size_t i = nonzero[l];
+          m_coefs[l] = tau * coef(i);
+          m_kptr[l] = m_k.range(i * m_n, (i + 1) * m_n).data();
+        }
+      LinearCombination(m_n, out.data(), y.data(), nonzero.size(),
+                        m_coefs.data(), m_kptr.data(), m_parallel);
+    }
+
   public:
+    // parallel: the stage combinations of large systems run on the thread pool
     ExplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
-                       const Matrix<> &a, const Vector<> &b, const Vector<> &c)
+                       const Matrix<> &a, const Vector<> &b, const Vector<> &c,
+                       bool parallel = false)
         : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
-          m_stages(c.size()), m_n(rhs->dimX()),
-          m_stage(m_stages * m_n), m_k(m_stages * m_n) {}
+          m_stages(c.size()), m_n(rhs->dimX()), m_parallel(parallel),
+          m_stage(m_stages * m_n), m_k(m_stages * m_n),
+          m_nonzero(m_stages + 1), m_coefs(m_stages), m_kptr(m_stages)
+    {
+      for (int j = 0; j < m_stages; j++)
+        for (int i = 0; i < j; i++)
+          if (m_a(j, i) != 0.0) m_nonzero[j].push_back(i);
+      for (int j = 0; j < m_stages; j++)
+        if (m_b(j) != 0.0) m_nonzero[m_stages].push_back(j);
+    }
 
     void DoStep(double tau, VectorView<double> y) override
     {
       for (int j = 0; j < m_stages; j++)
       {
         auto stage_state = m_stage.range(j * m_n, (j + 1) * m_n);
-        stage_state = y;
-        for (int i = 0; i < j; i++)
-        {
-          auto prev_k = m_k.range(i * m_n, (i + 1) * m_n);
-          stage_state += tau * m_a(j, i) * prev_k;
-        }
+        combine(tau, m_nonzero[j], [&](size_t i) { return m_a(j, i); }, y, stage_state);
 
         auto curr_k = m_k.range(j * m_n, (j + 1) * m_n);
         this->m_rhs->evaluate(stage_state, curr_k);
       }
 
-      for (int j = 0; j < m_stages; j++)
-      {
-        y += tau * m_b(j) * m_k.range(j * m_n, (j + 1) * m_n);
-      }
+      combine(tau, m_nonzero[m_stages], [&](size_t i) { return m_b(i); }, y, y);
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<ExplicitRungeKutta>(m_rhs->clone(), m_a, m_b, m_c, m_parallel);
     }
   };
 
@@ -136,15 +168,23 @@ namespace ASC_ode {
     std::shared_ptr<ConstantFunction> m_yold;
     int m_stages;
     int m_n;
+    bool m_parallel;
+    bool m_predict = true;
+    StagePredictor m_predictor;
     Vector<> m_k, m_y;
+    size_t m_iterations = 0;
   public:
+    // parallel: stage rhs and Jacobians are evaluated on the thread pool;
+    // the dense solve of the sn x sn Newton system stays serial, and
+    // inside another ParallelFor task the stages run serially as well
     ImplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
-      const Matrix<> &a, const Vector<> &b, const Vector<> &c) 
+      const Matrix<> &a, const Vector<> &b, const Vector<> &c, bool parallel = false) 
     : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
     m_tau(std::make_shared<Parameter>(0.0)),
-    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n)
+    m_stages(c.size()), m_n(rhs->dimX()), m_parallel(parallel),
+    m_predictor(c, m_n), m_k(m_stages*m_n), m_y(m_stages*m_n)
     {
-      auto multiple_rhs = std::make_shared<MultipleFunc>(rhs, m_stages);
+      auto multiple_rhs = std::make_shared<MultipleFunc>(rhs, m_stages, parallel);
       m_yold = std::make_shared<ConstantFunction>(m_stages*m_n);
       auto knew = std::make_shared<IdentityFunction>(m_stages*m_n);
       m_equ = knew - Compose(multiple_rhs, m_yold + m_tau * std::make_shared<MatVecFunc>(m_a, m_n));
@@ -157,11 +197,45 @@ namespace ASC_ode {
       m_yold->set(m_y);
 
       m_tau->set(tau);
-      m_k = 0.0;  
-      NewtonSolver(m_equ, m_k);
+      // Newton from the extrapolated stages of the last step, from K = 0
+      // if there is none or Newton fails from there
+      bool predicted = m_predict && m_predictor.predict(tau, y, m_k);
+      if (!predicted)
+        m_k = 0.0;
+      m_iterations = 0;
+      auto count = [this] (int, double, VectorView<double>) { m_iterations++; };
+      try
+        {
+          NewtonSolver(m_equ, m_k, 1e-10, 10, count);
+        }
+      catch (const std::domain_error &)
+        {
+          if (!predicted) throw;
+          m_k = 0.0;
+          NewtonSolver(m_equ, m_k, 1e-10, 10, count);
+        }
 
       for (int j = 0; j < m_stages; j++)
         y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
+      if (m_predict)
+        m_predictor.store(tau, m_k, y);
+    }
+
+    // Newton iterations of the last step, including a retry from K = 0
+    size_t numIterations() const { return m_iterations; }
+
+    // stage value predictor for the Newton initial guess (on by default)
+    void usePredictor (bool predict)
+    {
+      m_predict = predict;
+      m_predictor.reset();
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      auto copy = std::make_unique<ImplicitRungeKutta>(m_rhs->clone(), m_a, m_b, m_c, m_parallel);
+      copy->usePredictor(m_predict);
+      return copy;
     }
   };
 
@@ -190,33 +264,33 @@ void GaussLegendre(VectorView<> x, VectorView<> w)
     double x1 = 0;
     double x2 = 1;
     const double EPS=1.0e-14;  // EPS is the relative precision.
-    double z1,z,xm,xl,pp,p3,p2,p1;
+    const int MAXIT=100;
+    double xm,xl;
     int n=x.size();
     int m=(n+1)/2;  // The roots are symmetric in the interval, so
     xm=0.5*(x2+x1); // we only have to find half of them.
     xl=0.5*(x2-x1);
-    for (int i=0;i<m;i++) {  // Loop over the desired roots.
-      z = std::cos(3.141592654*(i+0.75)/(n+0.5));
-      // Starting with this approximation to the ith root, we enter the main loop of refinement
-      // by Newton’s method.
-      do {
-        p1=1.0;
-        p2=0.0;
-        for (int j=0;j<n;j++) { // Loop up the recurrence relation to get the
-            p3=p2;  // Legendre polynomial evaluated at z.
-          p2=p1;
-          p1=((2.0*j+1.0)*z*p2-j*p3)/(j+1);
-        }
-        // p1 is now the desired Legendre polynomial. We next compute pp, its derivative,
-        // by a standard relation involving also p2, the polynomial of one lower order.
-        pp=n*(z*p1-p2)/(z*z-1.0);
-        z1=z;
-        z=z1-p1/pp;   // Newton’s method.
-      } while (std::abs(z - z1) > EPS);
-      x[i]=xm-xl*z;      // Scale the root to the desired interval,
-      x[n-1-i]=xm+xl*z;  //  and put in its symmetric counterpart.
-      w[i]=2.0*xl/((1.0-z*z)*pp*pp);  // Compute the weight
-      w[n-1-i]=w[i];     // and its symmetric counterpart.
+    Vector<> z(m), p(m), pp(m);
+    for (int i=0;i<m;i++)  // Initial approximations to the roots.
+      z(i) = std::cos(3.141592654*(i+0.75)/(n+0.5));
+    // Newton's method for all roots at once; the recurrence for the
+    // Legendre polynomial and its derivative runs in SIMD lanes.
+    bool converged = false;
+    for (int its=0; its<MAXIT && !converged; its++) {
+      LegendrePolynomial(n, z, p, pp);
+      converged = true;
+      for (int i=0;i<m;i++) {
+        double dz = p(i)/pp(i);
+        z(i) -= dz;
+        if (std::abs(dz) > EPS) converged = false;
+      }
+    }
+    LegendrePolynomial(n, z, p, pp);
+    for (int i=0;i<m;i++) {
+      x[i]=xm-xl*z(i);      // Scale the root to the desired interval,
+      x[n-1-i]=xm+xl*z(i);  //  and put in its symmetric counterpart.
+      w[i]=2.0*xl/((1.0-z(i)*z(i))*pp(i)*pp(i));  // Compute the weight
+      w[n-1-i]=w[i];        // and its symmetric counterpart.
     }
   }
 
@@ -227,9 +301,9 @@ void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double
 {
   const int MAXIT=10;
   const double EPS=1.0e-14; // EPS is the relative precision.
-  int i,its,j;
+  int i,its;
   double alfbet,an,bn,r1,r2,r3;
-  double a,b,c,p1,p2,p3,pp,temp,z,z1;
+  double p1=0,p2=0,pp=0,temp,z,z1;
   int n=x.size();
   for (i=0;i<n;i++) { // Loop over the desired roots.
     if (i == 0) {  // Initial guess for the largest root.
@@ -263,22 +337,13 @@ void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double
     }
     alfbet=alf+bet;
     for (its=1;its<=MAXIT;its++) { // Refinement by Newton’s method.
-      temp=2.0+alfbet; // Start the recurrence with P0 and P1 to avoid
-      // a division by zero when ˛ C ˇ D 0 or 1.
-      p1=(alf-bet+temp*z)/2.0;
-      p2=1.0;
-      for (j=2;j<=n;j++) { // Loop up the recurrence relation to get the
-        p3=p2;    // Jacobi polynomial evaluated at z.
-        p2=p1;
-        temp=2*j+alfbet;
-        a=2*j*(j+alfbet)*(temp-2.0);
-        b=(temp-1.0)*(alf*alf-bet*bet+temp*(temp-2.0)*z);
-        c=2.0*(j-1+alf)*(j-1+bet)*temp;
-        p1=(b*p2-c*p3)/a;
-      }
-      pp=(n*(alf-bet-temp*z)*p1+2.0*(n+alf)*(n+bet)*p2)/(temp*(1.0-z*z));
-      // p1 is now the desired Jacobi polynomial. We next compute pp, its derivative, by
-      //  a standard relation involving also p2, the polynomial of one lower order.
+      // The Jacobi polynomial p1, its derivative pp and p2, the polynomial of
+      // one lower order, from the recurrence shared with JacobiPolynomials.
+      JacobiKernel(n, alf, bet, z, [&](size_t k, double pk, double dpk) {
+        if (k+1 == size_t(n)) p2 = pk;
+        if (k == size_t(n)) { p1 = pk; pp = dpk; }
+      });
+      temp=2*n+alfbet;
       z1=z;
       z=z1-p1/pp; // Newton’s formula.
       if (std::abs(z - z1) <= EPS) break;
@@ -295,35 +360,14 @@ void GaussJacobi (VectorView<> x, VectorView<> w, const double alf, const double
 /*
   given Runge-Kutta nodes c, compute the coefficients a and b
 */
+// collocation method for the nodes c, via Lagrange quadrature (see tableau.hpp)
+// instead of inverting the ill-conditioned Vandermonde matrix
 auto ComputeABfromC (const Vector<> & c)
 {
-  int s = c.size();
-  Matrix<> M(s, s);
-  Vector<> tmp(s);
-  
-  for (int i = 0; i < s; i++)
-    for (int j = 0; j < s; j++)
-      M(i,j) = std::pow(c(j), i);
-
-  calcInverse(M);
-  // M = LapackLU(M).inverse();
-  
-  for (int i = 0; i < s; i++)
-    tmp(i) = 1.0 / (i+1);
-
-  Vector<> b = M * tmp;
+  size_t s = c.size();
   Matrix<> a(s, s);
-
-  for (int j = 0; j < s; j++)
-    {
-      for (int i = 0; i < s; i++)
-        tmp(i) = std::pow(c(j),i+1) / (i+1);
-      a.row(j) = M * tmp;
-    }
-  /*
-  std::cout << "b = " << b << std::endl;
-  std::cout << "a = " << a << std::endl;
-  */
+  Vector<> b(s);
+  CollocationCoefficients(c, a, b);
   return std::tuple { a, b };
 }
   
@@ -0,0 +1,336 @@
+#ifndef SDC_HPP
+#define SDC_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include <inverse.hpp>
+
+#include "timestepper.hpp"
+#include "tableau.hpp"
+#include "parallel.hpp"
+
+namespace ASC_ode
+{
+
+  enum class SDCSweeper { ExplicitEuler, ImplicitEuler };
+
+
+  /*
+    Spectral deferred correction (Dutt, Greengard, Rokhlin 2000).
+
+    On the collocation nodes c_1..c_M of a step of size h the collocation
+    solution satisfies U_m = u0 + h sum_j q_mj f(U_j), with q = the a
+    matrix of the collocation tableau (Gauss, Radau IIA or Lobatto IIIA
+    nodes). Starting from U_m = u0, each sweep is an Euler pass over the
+    nodes which corrects the previous iterate,
+      U_m' = U_m-1' + dt_m (f(U_m') - f(U_m)) + h sum_j s_mj f(U_j)    (implicit)
+      U_m' = U_m-1' + dt_m (f(U_m-1') - f(U_m-1)) + h sum_j s_mj f(U_j) (explicit)
+    with dt_m = h (c_m - c_m-1) and s_mj = q_mj - q_m-1,j. The step ends
+    with u1 = u0 + h sum_j b_j f(U_j); K sweeps give order K+1, up to the
+    order of the collocation method.
+
+    The implicit sweep needs only n x n systems (I - dt_m J), solved by
+    simplified Newton with J at the start of DoStep; the M inverses are
+    reused for all sweeps and slices.
+
+    DoStep(tau, y) takes `slices` steps of tau / slices. With parallel set
+    the slices are pipelined (as in PFASST without coarse level, or RIDC):
+    sweep k of slice p starts from the end value of sweep k of slice p-1,
+    so slice p runs sweep k while slice p-1 runs sweep k+1, and `slices`
+    threads finish K sweeps in K + slices - 1 sweep times instead of
+    K * slices. The result differs slightly from the serial slices, which
+    start from fully corrected values.
+
+    On stiff problems the pipelined sweeps may not converge from the
+    changing start values: Newton fails, or a slice ends with a larger
+    collocation residual than slice 0, which saw its start value in all
+    sweeps. Then the slices from the first bad one on are redone in the
+    serial order (counted by numFallbacks()), so the pipelined mode solves
+    whatever the serial one solves, at the price of the wasted sweeps.
+  */
+  class SpectralDeferredCorrection : public TimeStepper
+  {
+    struct Slice
+    {
+      Vector<> u, f, fold;      // U_m and f(U_m) at all nodes, stacked
+      Vector<> f0, f0old;       // f(u0) of this and the previous sweep
+      Vector<> uend[2];         // end value after sweeps of even / odd index
+      Vector<> rhs, r, quad;
+      Matrix<> jac, inv;        // refreshed Jacobian for a node, implicit sweeps only
+      size_t evaluations = 0;
+      double residual = 0;
+
+      Slice (size_t m, size_t n, bool implicit)
+        : u(m*n), f(m*n), fold(m*n), f0(n), f0old(n),
+          uend{ Vector<>(n), Vector<>(n) }, rhs(n), r(n), quad(n),
+          jac(implicit ? n : 0, implicit ? n : 0), inv(implicit ? n : 0, implicit ? n : 0) { }
+    };
+
+    TableauFamily m_family;
+    size_t m_nodes, m_sweeps;
+    SDCSweeper m_sweeper;
+    size_t m_numSlices;
+    bool m_parallel;
+    size_t m_n;
+
+    const ButcherTableau * m_tab;
+    Matrix<> m_s;               // s_mj = q_mj - q_m-1,j
+    Vector<> m_dc;              // c_m - c_m-1
+    std::vector<Slice> m_slices;
+    std::vector<Matrix<>> m_inv;
+    Matrix<> m_jac;
+    size_t m_evaluations = 0;
+    double m_residual = 0;
+    size_t m_fallbacks = 0;
+
+    static constexpr int maxNewton = 20;
+    static constexpr double newtonTol = 1e-14;
+
+    VectorView<double> node (Vector<> & v, size_t m) { return v.range(m*m_n, (m+1)*m_n); }
+
+    // U_m = rhs + dt f(U_m) by simplified Newton, leaves f(U_m) in fm;
+    // if it contracts poorly, J is recomputed at U_m for this node
+    void solveNode (Slice & sl, size_t m, double dt, VectorView<double> um, VectorView<double> fm)
+    {
+      const Matrix<> * inv = &m_inv[m];
+      double resold = std::numeric_limits<double>::infinity();
+      for (int it = 0; ; it++)
+        {
+          m_rhs->evaluate(um, fm);
+          sl.evaluations++;
+          sl.r = um - dt * fm - sl.rhs;
+          double res = 0, scale = 0;
+          for (size_t l = 0; l < m_n; l++)
+            {
+              res = std::max(res, std::abs(sl.r(l)));
+              scale = std::max(scale, std::abs(um(l)));
+            }
+          if (!std::isfinite(res) || it == maxNewton)
+            throw std::domain_error("SpectralDeferredCorrection: Newton did not converge");
+          // converged, or stagnating at roundoff level
+          if (res <= newtonTol * (1 + scale) ||
+              (res > 0.5 * resold && res <= 1e3 * newtonTol * (1 + scale)))
+            return;
+
+          if (res > 0.5 * resold && inv != &sl.inv)
+            {
+              m_rhs->evaluateDeriv(um, sl.jac);
+              for (size_t i = 0; i < m_n; i++)
+                for (size_t j = 0; j < m_n; j++)
+                  sl.inv(i,j) = (i == j) - dt * sl.jac(i,j);
+              calcInverse(sl.inv);
+              inv = &sl.inv;
+            }
+          resold = res;
+          um -= (*inv) * sl.r;
+        }
+    }
+
+    // sweep k of slice p over a step of size h, starting from u0
+    void sweep (size_t p, size_t k, double h, VectorView<double> u0)
+    {
+      Slice & sl = m_slices[p];
+      size_t M = m_nodes;
+
+      sl.f0old = sl.f0;
+      m_rhs->evaluate(u0, sl.f0);
+      sl.evaluations++;
+      if (k == 0)
+        {
+          // spread the initial value to all nodes
+          for (size_t m = 0; m < M; m++)
+            {
+              node(sl.u, m) = u0;
+              node(sl.f, m) = sl.f0;
+            }
+          sl.f0old = sl.f0;
+        }
+      sl.fold = sl.f;
+
+      for (size_t m = 0; m < M; m++)
+        {
+          double dt = h * m_dc(m);
+          // U_m-1 of this sweep, and f(U_m-1) of this and the last sweep
+          VectorView<double> uprev = m == 0 ? u0 : node(sl.u, m-1);
+          VectorView<double> fprev = m == 0 ? VectorView<double>(sl.f0) : node(sl.f, m-1);
+          VectorView<double> fprevold = m == 0 ? VectorView<double>(sl.f0old) : node(sl.fold, m-1);
+
+          sl.rhs = uprev;
+          for (size_t j = 0; j < M; j++)
+            if (m_s(m,j) != 0.0)
+              sl.rhs += h * m_s(m,j) * node(sl.fold, j);
+
+          auto um = node(sl.u, m);
+          auto fm = node(sl.f, m);
+          if (m_sweeper == SDCSweeper::ImplicitEuler)
+            {
+              sl.rhs -= dt * node(sl.fold, m);
+              solveNode(sl, m, dt, um, fm);
+            }
+          else
+            {
+              um = sl.rhs + dt * (fprev - fprevold);
+              m_rhs->evaluate(um, fm);
+              sl.evaluations++;
+            }
+        }
+
+      // u1 = u0 + h sum_j b_j f(U_j)
+      auto & uend = sl.uend[k%2];
+      uend = u0;
+      for (size_t j = 0; j < M; j++)
+        uend += h * m_tab->b(j) * node(sl.f, j);
+
+      // collocation residual max_m |u0 + h sum_j q_mj f_j - U_m| of the last sweep
+      if (k+1 == m_sweeps)
+        {
+          sl.residual = 0;
+          for (size_t m = 0; m < M; m++)
+            {
+              sl.quad = u0 - node(sl.u, m);
+              for (size_t j = 0; j < M; j++)
+                sl.quad += h * m_tab->a(m,j) * node(sl.f, j);
+              for (size_t l = 0; l < m_n; l++)
+                sl.residual = std::max(sl.residual, std::abs(sl.quad(l)));
+            }
+        }
+    }
+
+  public:
+    /*
+      family: GaussLegendre, RadauIIA or LobattoIIIA nodes, M = nodes.
+      sweeps: number of correction sweeps, 0 = enough for the order of
+      the collocation method (2M, 2M-1, 2M-2).
+    */
+    SpectralDeferredCorrection (std::shared_ptr<NonlinearFunction> rhs,
+                                TableauFamily family = TableauFamily::RadauIIA, size_t nodes = 3,
+                                size_t sweeps = 0, SDCSweeper sweeper = SDCSweeper::ImplicitEuler,
+                                size_t slices = 1, bool parallel = false)
+      : TimeStepper(rhs), m_family(family), m_nodes(nodes), m_sweeps(sweeps), m_sweeper(sweeper),
+        m_numSlices(std::max<size_t>(slices, 1)), m_parallel(parallel), m_n(rhs->dimX()),
+        m_tab(&GetTableau(family, nodes)), m_s(nodes, nodes), m_dc(nodes),
+        m_jac(sweeper == SDCSweeper::ImplicitEuler ? m_n : 0, sweeper == SDCSweeper::ImplicitEuler ? m_n : 0)
+    {
+      if (family != TableauFamily::GaussLegendre && family != TableauFamily::RadauIIA &&
+          family != TableauFamily::LobattoIIIA)
+        throw std::invalid_argument("SpectralDeferredCorrection: nodes must be Gauss, Radau IIA or Lobatto IIIA");
+
+      if (m_sweeps == 0)
+        m_sweeps = family == TableauFamily::GaussLegendre ? 2*nodes-1
+          : family == TableauFamily::RadauIIA ? 2*nodes-2 : 2*nodes-3;
+
+      const Matrix<> & q = m_tab->a;
+      for (size_t m = 0; m < nodes; m++)
+        {
+          m_dc(m) = m_tab->c(m) - (m > 0 ? m_tab->c(m-1) : 0.0);
+          for (size_t j = 0; j < nodes; j++)
+            m_s(m,j) = q(m,j) - (m > 0 ? q(m-1,j) : 0.0);
+        }
+
+      for (size_t p = 0; p < m_numSlices; p++)
+        m_slices.emplace_back(nodes, m_n, sweeper == SDCSweeper::ImplicitEuler);
+      if (sweeper == SDCSweeper::ImplicitEuler)
+        for (size_t m = 0; m < nodes; m++)
+          m_inv.emplace_back(m_n, m_n);
+    }
+
+    size_t sweeps() const { return m_sweeps; }
+    size_t numEvaluations() const { return m_evaluations; }
+    size_t numFallbacks() const { return m_fallbacks; }
+    // largest collocation residual after the last sweep of the last DoStep
+    double residual() const { return m_residual; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      size_t P = m_numSlices, K = m_sweeps;
+      double h = tau / P;
+
+      if (m_sweeper == SDCSweeper::ImplicitEuler)
+        {
+          m_rhs->evaluateDeriv(y, m_jac);
+          auto factor = [&] (size_t m)
+          {
+            double dt = h * m_dc(m);
+            for (size_t i = 0; i < m_n; i++)
+              for (size_t j = 0; j < m_n; j++)
+                m_inv[m](i,j) = (i == j) - dt * m_jac(i,j);
+            calcInverse(m_inv[m]);
+          };
+          if (m_parallel)
+            ParallelFor(m_nodes, factor);
+          else
+            for (size_t m = 0; m < m_nodes; m++) factor(m);
+        }
+      for (auto & sl : m_slices)
+        sl.evaluations = 0;
+
+      // slices from `first` on, one after the other
+      auto serial = [&] (size_t first)
+      {
+        for (size_t p = first; p < P; p++)
+          for (size_t k = 0; k < K; k++)
+            sweep(p, k, h, p == 0 ? y : VectorView<double>(m_slices[p-1].uend[(K-1)%2]));
+      };
+
+      if (!m_parallel || P == 1)
+        serial(0);
+      else
+        {
+          size_t redo = P;
+          try
+            {
+              // wavefront: in stage w, slice p runs sweep w - p
+              for (size_t w = 0; w < K+P-1; w++)
+                {
+                  size_t first = w >= K ? w-K+1 : 0;
+                  size_t last = std::min(P-1, w);
+                  ParallelFor(last-first+1, [&] (size_t i)
+                  {
+                    size_t p = first + i, k = w - p;
+                    sweep(p, k, h, p == 0 ? y : VectorView<double>(m_slices[p-1].uend[k%2]));
+                  });
+                }
+
+              // slice 0 had its start value in all sweeps, so its residual
+              // is what K sweeps reach (the serial slices after it have
+              // smoother starts and do better); a later slice above it did
+              // not converge from the changing start values
+              double bound = 2 * std::max(m_slices[0].residual, 1e-12 * (1 + norm(y)));
+              for (size_t p = 1; p < P && redo == P; p++)
+                if (!(m_slices[p].residual <= bound))
+                  redo = p;
+            }
+          catch (const std::domain_error &)
+            {
+              redo = 0;
+            }
+          if (redo < P)
+            {
+              m_fallbacks++;
+              serial(redo);
+            }
+        }
+
+      y = m_slices[P-1].uend[(K-1)%2];
+      m_residual = 0;
+      for (auto & sl : m_slices)
+        {
+          m_evaluations += sl.evaluations;
+          m_residual = std::max(m_residual, sl.residual);
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<SpectralDeferredCorrection>(m_rhs->clone(), m_family, m_nodes, m_sweeps,
+                                                          m_sweeper, m_numSlices, m_parallel);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef SPLITTING_HPP
+#define SPLITTING_HPP
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Operator splitting for y' = f_1(y) + ... + f_m(y). Every sub-rhs acts
+    on the full state (built with EmbedFunction / Projector) and gets its
+    own TimeStepper for y' = f_i(y), e.g. an implicit or exact method for
+    stiff springs and an explicit one for gravity and forcing. The flows
+    phi_i of the parts are composed:
+
+      Lie       phi_m(h) ... phi_1(h),                                 order 1
+      Strang    phi_1(h/2) ... phi_m-1(h/2) phi_m(h) phi_m-1(h/2) ... phi_1(h/2),
+                                                                        order 2
+      Yoshida4  S(g1 h) S(g2 h) S(g1 h) with the Strang step S,
+                g1 = 1 / (2 - 2^(1/3)), g2 = 1 - 2 g1 < 0,             order 4
+
+    provided the sub-steppers are accurate enough (order >= that of the
+    splitting, or symmetric of order 2 for Yoshida4). Yoshida4 has a
+    negative substep and so is not suitable for dissipative stiff parts,
+    and it needs fixed-step sub-steppers: the adaptive ones (ExplicitRK
+    or the low-storage schemes with a tolerance, AdaptiveRadau,
+    Extrapolation, TaylorSeries) only step forward and throw
+    std::invalid_argument for tau < 0.
+
+    Consecutive flows of a part marked exact (its stepper is the exact
+    flow, e.g. a free flight or a linear part by its exponential) are
+    merged into one, e.g. the two half-flows of part 0 between the
+    Strang blocks of Yoshida4. DoSteps also merges the last flow of a
+    step with the first of the next one, so n Strang steps cost n+1
+    flows of part 0 instead of 2n. Numerical flows are not merged:
+    CrankNicolson over a + b is not CrankNicolson over a and then b, and
+    merging them costs Yoshida4 its order (measured 2 instead of 4 in
+    splitting_demo).
+
+    A part with substeps > 1 is sub-cycled: each of its flows is taken
+    with that many steps of the sub-stepper, for fast parts that need
+    smaller steps than the rest.
+  */
+  enum class SplittingScheme { Lie, Strang, Yoshida4 };
+
+  struct SplittingPart
+  {
+    std::shared_ptr<NonlinearFunction> rhs;
+    std::shared_ptr<TimeStepper> stepper;     // integrates y' = rhs(y)
+    size_t substeps = 1;
+    bool exact = false;                       // the stepper is the exact flow
+  };
+
+
+  class OperatorSplitting : public TimeStepper
+  {
+    std::vector<SplittingPart> m_parts;
+    SplittingScheme m_scheme;
+    std::vector<std::pair<size_t, double>> m_sequence;    // (part, fraction of tau)
+
+    static std::shared_ptr<NonlinearFunction> Sum (const std::vector<SplittingPart> & parts)
+    {
+      if (parts.empty())
+        throw std::invalid_argument("OperatorSplitting: no parts");
+      auto sum = parts[0].rhs;
+      for (size_t i = 1; i < parts.size(); i++)
+        {
+          if (parts[i].rhs->dimX() != sum->dimX() || parts[i].rhs->dimF() != sum->dimF())
+            throw std::invalid_argument("OperatorSplitting: parts act on different state sizes");
+          sum = sum + parts[i].rhs;
+        }
+      return sum;
+    }
+
+    void append (size_t part, double fraction)
+    {
+      if (!m_sequence.empty() && m_sequence.back().first == part && m_parts[part].exact)
+        m_sequence.back().second += fraction;
+      else
+        m_sequence.emplace_back(part, fraction);
+    }
+
+    void appendStrang (double fraction)
+    {
+      size_t m = m_parts.size();
+      for (size_t i = 0; i+1 < m; i++)
+        append(i, 0.5 * fraction);
+      append(m-1, fraction);
+      for (size_t i = m-1; i-- > 0; )
+        append(i, 0.5 * fraction);
+    }
+
+    void flow (size_t part, double tau, VectorView<double> y)
+    {
+      SplittingPart & p = m_parts[part];
+      double h = tau / p.substeps;
+      for (size_t k = 0; k < p.substeps; k++)
+        p.stepper->DoStep(h, y);
+    }
+
+  public:
+    OperatorSplitting (std::vector<SplittingPart> parts,
+                       SplittingScheme scheme = SplittingScheme::Strang)
+      : TimeStepper(Sum(parts)), m_parts(std::move(parts)), m_scheme(scheme)
+    {
+      for (auto & p : m_parts)
+        if (!p.stepper || p.substeps == 0)
+          throw std::invalid_argument("OperatorSplitting: every part needs a stepper and substeps >= 1");
+
+      switch (scheme)
+        {
+        case SplittingScheme::Lie:
+          for (size_t i = 0; i < m_parts.size(); i++)
+            append(i, 1.0);
+          break;
+        case SplittingScheme::Strang:
+          appendStrang(1.0);
+          break;
+        case SplittingScheme::Yoshida4:
+          {
+            double g1 = 1 / (2 - std::cbrt(2.0));
+            appendStrang(g1);
+            appendStrang(1 - 2*g1);
+            appendStrang(g1);
+            break;
+          }
+        }
+    }
+
+    size_t numParts() const { return m_parts.size(); }
+    SplittingScheme scheme() const { return m_scheme; }
+
+    // flows of one step after merging, as (part, fraction of tau)
+    const std::vector<std::pair<size_t, double>> & sequence() const { return m_sequence; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      for (auto [i, fraction] : m_sequence)
+        flow(i, fraction * tau, y);
+    }
+
+    // steps of size tau, merging the flows at the step boundaries; y is
+    // only valid at the end
+    void DoSteps (size_t steps, double tau, VectorView<double> y)
+    {
+      if (steps == 0) return;
+      auto [part, fraction] = m_sequence[0];
+      for (size_t s = 0; s < steps; s++)
+        for (size_t j = s == 0 ? 1 : 0; j < m_sequence.size(); j++)
+          {
+            auto [i, f] = m_sequence[j];
+            if (i == part && m_parts[i].exact)
+              fraction += f;
+            else
+              {
+                flow(part, fraction * tau, y);
+                part = i;
+                fraction = f;
+              }
+          }
+      flow(part, fraction * tau, y);
+    }
+
+    // the part's rhs is taken from the cloned stepper if the stepper
+    // integrates that very function, so both refer to the same copy
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      std::vector<SplittingPart> parts;
+      for (auto & p : m_parts)
+        {
+          std::shared_ptr<TimeStepper> stepper = p.stepper->clone();
+          auto rhs = p.stepper->rhs() == p.rhs ? stepper->rhs() : p.rhs->clone();
+          parts.push_back(SplittingPart{ rhs, stepper, p.substeps, p.exact });
+        }
+      return std::make_unique<OperatorSplitting>(std::move(parts), m_scheme);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,461 @@
+#ifndef TAYLORSERIES_HPP
+#define TAYLORSERIES_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Recording of one model evaluation for the Taylor coefficient
+    recurrences. Every operation on TaylorVar appends a node holding its
+    value (coefficient 0). propagate(k) then computes coefficient k of all
+    nodes in recording order: it needs coefficients 0..k of the arguments
+    and 0..k-1 of the node itself, so the first p coefficients cost O(p^2)
+    per nonlinear node, in a single pass over the degrees.
+
+    sin/cos and tan record a partner node each (cos/sin and 1 + tan^2),
+    since their recurrences are coupled.
+  */
+  class TaylorTape
+  {
+  public:
+    static constexpr uint32_t None = uint32_t(-1);
+
+    enum class Op : uint8_t { Variable, Linear, Add, Sub, Mul, Div, Exp, Log, Sin, Cos, Tan, TanAux, Sqrt, Pow };
+
+  private:
+    struct Node
+    {
+      Op op;
+      uint32_t a, b;
+      double c;
+    };
+    std::vector<Node> m_nodes;
+    std::vector<double> m_coefs;     // node i, degree k at i*(m_maxDegree+1) + k
+    size_t m_maxDegree;
+
+    static TaylorTape *& activePtr()
+    {
+      thread_local TaylorTape * tape = nullptr;
+      return tape;
+    }
+
+    double * coefs (uint32_t i) { return &m_coefs[i * (m_maxDegree+1)]; }
+
+  public:
+    TaylorTape (size_t maxDegree) : m_maxDegree(maxDegree) { }
+
+    TaylorTape (const TaylorTape &) = delete;
+    TaylorTape & operator= (const TaylorTape &) = delete;
+
+    static TaylorTape & active()
+    {
+      if (!activePtr())
+        throw std::logic_error("TaylorVar: operation on variables outside of a recording TaylorTape::Activate");
+      return *activePtr();
+    }
+
+    size_t maxDegree() const { return m_maxDegree; }
+    size_t size() const { return m_nodes.size(); }
+    void clear() { m_nodes.clear(); m_coefs.clear(); }
+
+    uint32_t record (Op op, double value, uint32_t a = None, uint32_t b = None, double c = 0)
+    {
+      m_nodes.push_back({ op, a, b, c });
+      m_coefs.resize(m_coefs.size() + m_maxDegree+1, 0.0);
+      m_coefs[(m_nodes.size()-1) * (m_maxDegree+1)] = value;
+      return uint32_t(m_nodes.size()-1);
+    }
+
+    double coefficient (uint32_t i, size_t k) const { return m_coefs[i * (m_maxDegree+1) + k]; }
+    // coefficients of Variable nodes are set by the caller before propagate(k)
+    void setCoefficient (uint32_t i, size_t k, double v) { coefs(i)[k] = v; }
+
+    // coefficient k >= 1 of all nodes
+    void propagate (size_t k)
+    {
+      static const double zero[1] = { 0 };
+      for (uint32_t i = 0; i < m_nodes.size(); i++)
+        {
+          const Node & nd = m_nodes[i];
+          double * r = coefs(i);
+          const double * a = nd.a != None ? coefs(nd.a) : zero;
+          const double * b = nd.b != None ? coefs(nd.b) : zero;
+          double sum = 0;
+          switch (nd.op)
+            {
+            case Op::Variable:
+              break;
+            case Op::Linear:     // c a + shift
+              r[k] = nd.c * a[k];
+              break;
+            case Op::Add:
+              r[k] = a[k] + b[k];
+              break;
+            case Op::Sub:
+              r[k] = a[k] - b[k];
+              break;
+            case Op::Mul:
+              for (size_t j = 0; j <= k; j++)
+                sum += a[j] * b[k-j];
+              r[k] = sum;
+              break;
+            case Op::Div:        // r b = a, a may be a constant (None)
+              sum = nd.a != None ? a[k] : 0.0;
+              for (size_t j = 1; j <= k; j++)
+                sum -= b[j] * r[k-j];
+              r[k] = sum / b[0];
+              break;
+            case Op::Exp:        // k r_k = sum_j j a_j r_k-j
+              for (size_t j = 1; j <= k; j++)
+                sum += double(j) * a[j] * r[k-j];
+              r[k] = sum / double(k);
+              break;
+            case Op::Log:        // a r' = a'
+              sum = double(k) * a[k];
+              for (size_t j = 1; j < k; j++)
+                sum -= double(j) * r[j] * a[k-j];
+              r[k] = sum / (double(k) * a[0]);
+              break;
+            case Op::Sin:        // s' = c a', b = the cos partner
+              for (size_t j = 1; j <= k; j++)
+                sum += double(j) * a[j] * b[k-j];
+              r[k] = sum / double(k);
+              break;
+            case Op::Cos:        // c' = -s a', b = the sin partner
+              for (size_t j = 1; j <= k; j++)
+                sum += double(j) * a[j] * b[k-j];
+              r[k] = -sum / double(k);
+              break;
+            case Op::Tan:        // t' = u a', b = the partner u = 1 + t^2
+              for (size_t j = 1; j <= k; j++)
+                sum += double(j) * a[j] * b[k-j];
+              r[k] = sum / double(k);
+              break;
+            case Op::TanAux:     // u = 1 + t^2, a = t
+              for (size_t j = 0; j <= k; j++)
+                sum += a[j] * a[k-j];
+              r[k] = sum;
+              break;
+            case Op::Sqrt:
+              sum = a[k];
+              for (size_t j = 1; j < k; j++)
+                sum -= r[j] * r[k-j];
+              r[k] = sum / (2 * r[0]);
+              break;
+            case Op::Pow:        // a r' = c r a'
+              for (size_t j = 0; j < k; j++)
+                sum += (nd.c * double(k-j) - double(j)) * a[k-j] * r[j];
+              r[k] = sum / (double(k) * a[0]);
+              break;
+            }
+        }
+    }
+
+    // makes this the active tape of the thread while in scope
+    class Activate
+    {
+      TaylorTape * m_prev;
+    public:
+      Activate (TaylorTape & tape) : m_prev(activePtr()) { activePtr() = &tape; }
+      ~Activate() { activePtr() = m_prev; }
+    };
+  };
+
+
+  /*
+    Scalar recorded on the active TaylorTape, for instantiating a model's
+    T_evaluate. It carries its value, so branches on values work; doubles
+    convert to constants, which are never recorded.
+  */
+  class TaylorVar
+  {
+    using Op = TaylorTape::Op;
+    double m_val;
+    uint32_t m_index;
+
+    static TaylorVar record (Op op, double val, const TaylorVar & a,
+                             uint32_t b = TaylorTape::None, double c = 0)
+    {
+      return TaylorVar(val, TaylorTape::active().record(op, val, a.m_index, b, c));
+    }
+
+    // c a + shift
+    static TaylorVar linear (double val, const TaylorVar & a, double c)
+    {
+      if (a.isConstant()) return TaylorVar(val);
+      return record(Op::Linear, val, a, TaylorTape::None, c);
+    }
+
+  public:
+    TaylorVar (double v = 0, uint32_t index = TaylorTape::None) : m_val(v), m_index(index) { }
+
+    double value() const { return m_val; }
+    uint32_t index() const { return m_index; }
+    bool isConstant() const { return m_index == TaylorTape::None; }
+
+    friend TaylorVar operator+ (const TaylorVar & a, const TaylorVar & b)
+    {
+      double val = a.m_val + b.m_val;
+      if (a.isConstant()) return linear(val, b, 1);
+      if (b.isConstant()) return linear(val, a, 1);
+      return record(Op::Add, val, a, b.m_index);
+    }
+
+    friend TaylorVar operator- (const TaylorVar & a, const TaylorVar & b)
+    {
+      double val = a.m_val - b.m_val;
+      if (a.isConstant()) return linear(val, b, -1);
+      if (b.isConstant()) return linear(val, a, 1);
+      return record(Op::Sub, val, a, b.m_index);
+    }
+
+    friend TaylorVar operator- (const TaylorVar & a) { return linear(-a.m_val, a, -1); }
+
+    friend TaylorVar operator* (const TaylorVar & a, const TaylorVar & b)
+    {
+      double val = a.m_val * b.m_val;
+      if (a.isConstant()) return linear(val, b, a.m_val);
+      if (b.isConstant()) return linear(val, a, b.m_val);
+      return record(Op::Mul, val, a, b.m_index);
+    }
+
+    friend TaylorVar operator/ (const TaylorVar & a, const TaylorVar & b)
+    {
+      double val = a.m_val / b.m_val;
+      if (b.isConstant()) return linear(val, a, 1 / b.m_val);
+      return record(Op::Div, val, a, b.m_index);
+    }
+
+    TaylorVar & operator+= (const TaylorVar & b) { return *this = *this + b; }
+    TaylorVar & operator-= (const TaylorVar & b) { return *this = *this - b; }
+    TaylorVar & operator*= (const TaylorVar & b) { return *this = *this * b; }
+    TaylorVar & operator/= (const TaylorVar & b) { return *this = *this / b; }
+
+    friend TaylorVar exp (const TaylorVar & a)
+    {
+      if (a.isConstant()) return TaylorVar(std::exp(a.m_val));
+      return record(Op::Exp, std::exp(a.m_val), a);
+    }
+
+    friend TaylorVar log (const TaylorVar & a)
+    {
+      if (a.isConstant()) return TaylorVar(std::log(a.m_val));
+      return record(Op::Log, std::log(a.m_val), a);
+    }
+
+    friend TaylorVar sqrt (const TaylorVar & a)
+    {
+      if (a.isConstant()) return TaylorVar(std::sqrt(a.m_val));
+      return record(Op::Sqrt, std::sqrt(a.m_val), a);
+    }
+
+    friend TaylorVar pow (const TaylorVar & a, double r)
+    {
+      if (a.isConstant()) return TaylorVar(std::pow(a.m_val, r));
+      return record(Op::Pow, std::pow(a.m_val, r), a, TaylorTape::None, r);
+    }
+
+    friend TaylorVar pow (double a, const TaylorVar & r)
+    {
+      return exp(linear(std::log(a) * r.m_val, r, std::log(a)));
+    }
+
+    // s and c are recorded as partners, each pointing to the other
+    friend void SinCos (const TaylorVar & a, TaylorVar & s, TaylorVar & c)
+    {
+      double sv = std::sin(a.m_val), cv = std::cos(a.m_val);
+      if (a.isConstant())
+        {
+          s = TaylorVar(sv);
+          c = TaylorVar(cv);
+          return;
+        }
+      TaylorTape & tape = TaylorTape::active();
+      uint32_t is = uint32_t(tape.size());
+      tape.record(Op::Sin, sv, a.m_index, is+1);
+      tape.record(Op::Cos, cv, a.m_index, is);
+      s = TaylorVar(sv, is);
+      c = TaylorVar(cv, is+1);
+    }
+
+    friend TaylorVar sin (const TaylorVar & a) { TaylorVar s, c; SinCos(a, s, c); return s; }
+    friend TaylorVar cos (const TaylorVar & a) { TaylorVar s, c; SinCos(a, s, c); return c; }
+
+    friend TaylorVar tan (const TaylorVar & a)
+    {
+      double t = std::tan(a.m_val);
+      if (a.isConstant()) return TaylorVar(t);
+      TaylorTape & tape = TaylorTape::active();
+      uint32_t it = uint32_t(tape.size());
+      tape.record(Op::Tan, t, a.m_index, it+1);
+      tape.record(Op::TanAux, 1 + t*t, it);
+      return TaylorVar(t, it);
+    }
+  };
+
+
+  /*
+    Taylor series method for y' = f(y), with f given by a model providing
+      template <typename T> void T_evaluate (VectorView<T> x, VectorView<T> f) const;
+    T_evaluate is recorded once per step on a TaylorTape; the Taylor
+    coefficients of the solution then follow degree by degree from
+    y_k+1 = f(y)_k / (k+1), each degree in one pass over the tape.
+
+    Order and step size are chosen in every step from the decay of the
+    coefficients, as by Jorba and Zou, but with the first truncated term
+    as error estimate: order p allows
+      h_p = 0.9 min_{j = p, p+1} (tol s / |y_j|)^(1/(j-1)),
+    where s = 1 for |y| <= 1 (absolute error) and s = |y| otherwise, so
+    the truncated term |y_p+1| h^(p+1) stays below tol s h: tol bounds the
+    error per unit step, and the global error grows with the length of the
+    interval (and with the phase error of an orbit). Term p guards against
+    an accidentally small y_p+1. Coefficients are generated while the work
+    per unit time (p+1)^2 / h_p still decreases (up to K), and the
+    cheapest p is taken.
+    DoStep(tau, y) takes as many internal steps as needed to reach tau.
+  */
+  template <typename Model, size_t K = 20>
+  class TaylorSeries : public TimeStepper
+  {
+    static_assert(K >= 3, "TaylorSeries: K must allow order 2 and its error term");
+
+    static constexpr double safety = 0.9;
+
+    Model m_model;
+    size_t m_n;
+    double m_tol;
+    size_t m_order = 0;
+    size_t m_steps = 0, m_orderSum = 0;
+    Matrix<> m_coefs;                  // row k = k-th Taylor coefficient
+    TaylorTape m_tape;
+    Vector<TaylorVar> m_x, m_f;
+
+    static double normInf (VectorView<double> v)
+    {
+      double norm = 0;
+      for (size_t i = 0; i < v.size(); i++)
+        norm = std::max(norm, std::abs(v(i)));
+      return norm;
+    }
+
+    double outputCoefficient (size_t i, size_t k) const
+    {
+      const TaylorVar & f = m_f(i);
+      if (f.isConstant()) return k == 0 ? f.value() : 0.0;
+      return m_tape.coefficient(f.index(), k);
+    }
+
+    // y_k+1 from f_k for all components
+    void nextCoefficient (size_t k)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        m_coefs(k+1, i) = outputCoefficient(i, k) / double(k+1);
+    }
+
+    // coefficients up to the chosen order, returns the step size for it
+    double computeCoefficients (VectorView<double> y)
+    {
+      m_coefs.row(0) = y;
+      m_tape.clear();
+      {
+        TaylorTape::Activate active(m_tape);
+        for (size_t i = 0; i < m_n; i++)
+          m_x(i) = TaylorVar(y(i), m_tape.record(TaylorTape::Op::Variable, y(i)));
+        m_model.template T_evaluate<TaylorVar>(m_x, m_f);
+      }
+      nextCoefficient(0);
+
+      double ynorm = normInf(y);
+      double scale = m_tol * (ynorm <= 1 ? 1 : ynorm);
+      // h with |y_j| h^j <= scale h, the error per unit step
+      auto radius = [&] (size_t j)
+      {
+        double cnorm = normInf(m_coefs.row(j));
+        return cnorm > 0 ? std::pow(scale / cnorm, 1.0 / (j-1)) : std::numeric_limits<double>::infinity();
+      };
+
+      double rprev = radius(2);
+      double bestWork = std::numeric_limits<double>::infinity(), bestH = 0;
+      size_t bestP = 0, worse = 0;
+      for (size_t j = 2; j <= K; j++)
+        {
+          for (size_t i = 0; i < m_n; i++)
+            m_tape.setCoefficient(m_x(i).index(), j-1, m_coefs(j-1, i));
+          m_tape.propagate(j-1);
+          nextCoefficient(j-1);
+          if (j == 2) continue;
+
+          // order p = j-1: the last kept and the first truncated term
+          size_t p = j-1;
+          double r = radius(j);
+          double h = safety * std::min(rprev, r);
+          rprev = r;
+          double work = double((p+1)*(p+1)) / h;
+          if (work < bestWork)
+            {
+              bestWork = work;
+              bestH = h;
+              bestP = p;
+              worse = 0;
+            }
+          else if (++worse == 2)
+            break;
+        }
+      m_order = bestP;
+      return bestH;
+    }
+
+  public:
+    TaylorSeries (Model model, size_t dim, double tol = 1e-16)
+      : TimeStepper(std::make_shared<DynAutoDiffFunction<Model>>(model, dim, dim)),
+        m_model(std::move(model)), m_n(dim), m_tol(tol),
+        m_coefs(K+1, dim), m_tape(K), m_x(dim), m_f(dim) { }
+
+    // order of the last internal step, and the average over all steps
+    size_t order() const { return m_order; }
+    double averageOrder() const { return m_steps ? double(m_orderSum) / m_steps : 0.0; }
+    size_t numSteps() const { return m_steps; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      // the step size control runs forward in time only
+      if (tau < 0)
+        throw std::invalid_argument("TaylorSeries: adaptive steps need tau >= 0");
+      double t = 0;
+      while (t < tau)
+        {
+          double h = std::min(computeCoefficients(y), tau - t);
+          if (tau - t - h < 1e-14 * tau)
+            h = tau - t;
+
+          // Horner
+          y = m_coefs.row(m_order);
+          for (size_t k = m_order; k-- > 0; )
+            {
+              y *= h;
+              y += m_coefs.row(k);
+            }
+          t += h;
+          m_steps++;
+          m_orderSum += m_order;
+        }
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      return std::make_unique<TaylorSeries>(m_model, m_n, m_tol);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef ADJOINT_HPP
+#define ADJOINT_HPP
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Gradients of a function L(y(T)) of the end state of an explicit
+    Runge-Kutta integration, with respect to the initial state and to
+    Parameters of the rhs, by the discrete adjoint: the adjoint equation
+    lambda' = -f_y^T lambda is integrated backward by the transposed
+    Runge-Kutta scheme, using only vector-Jacobian products
+    (evaluateDerivTrans, addParamGradient). The gradient is exact for the
+    discrete solution and costs a few forward runs, independent of the
+    number of parameters.
+
+    Forward() keeps only the initial state. Backward() recomputes the
+    trajectory from at most `checkpoints` stored states, placed by the
+    binomial (revolve) schedule of Griewank: with c checkpoints and r
+    recomputations per step, C(c+r, c) steps can be reversed.
+  */
+  class AdjointRungeKutta
+  {
+    std::shared_ptr<NonlinearFunction> m_rhs;
+    std::vector<std::shared_ptr<Parameter>> m_params;
+    ParamIndex m_paramIndex;
+    Matrix<> m_a;
+    Vector<> m_b;
+    size_t m_stages, m_n;
+    double m_tau = 0;
+    size_t m_steps = 0;
+    size_t m_forwardSteps = 0;
+    Vector<> m_y0, m_y;
+    std::vector<Vector<>> m_snaps;
+    Vector<> m_ystage, m_k, m_ybar, m_kbar;
+
+    // y(k) = f(y + tau sum_j a_kj k_j); stage states stay in m_ystage
+    void computeStages (VectorView<double> y)
+    {
+      for (size_t i = 0; i < m_stages; i++)
+        {
+          auto yi = m_ystage.range(i*m_n, (i+1)*m_n);
+          yi = y;
+          for (size_t j = 0; j < i; j++)
+            if (m_a(i,j) != 0.0)
+              yi += m_tau * m_a(i,j) * m_k.range(j*m_n, (j+1)*m_n);
+          m_rhs->evaluate(yi, m_k.range(i*m_n, (i+1)*m_n));
+        }
+    }
+
+    void advance (VectorView<double> y, size_t steps)
+    {
+      for (size_t s = 0; s < steps; s++)
+        {
+          computeStages(y);
+          for (size_t i = 0; i < m_stages; i++)
+            y += m_tau * m_b(i) * m_k.range(i*m_n, (i+1)*m_n);
+        }
+      m_forwardSteps += steps;
+    }
+
+    // lambda_n from lambda_{n+1} through the step starting at y
+    void adjointStep (VectorView<double> y, VectorView<double> lambda, VectorView<double> grad)
+    {
+      computeStages(y);
+      for (size_t i = m_stages; i-- > 0; )
+        {
+          auto kbar = m_kbar.range(i*m_n, (i+1)*m_n);
+          kbar = m_tau * m_b(i) * lambda;
+          for (size_t j = i+1; j < m_stages; j++)
+            if (m_a(j,i) != 0.0)
+              kbar += m_tau * m_a(j,i) * m_ybar.range(j*m_n, (j+1)*m_n);
+
+          auto yi = m_ystage.range(i*m_n, (i+1)*m_n);
+          m_rhs->evaluateDerivTrans(yi, kbar, m_ybar.range(i*m_n, (i+1)*m_n));
+          m_rhs->addParamGradient(yi, kbar, m_paramIndex, grad);
+        }
+      for (size_t i = 0; i < m_stages; i++)
+        lambda += m_ybar.range(i*m_n, (i+1)*m_n);
+    }
+
+    static double Binomial (size_t n, size_t k)
+    {
+      double b = 1;
+      for (size_t i = 1; i <= k; i++)
+        b = b * (n-k+i) / i;
+      return b;
+    }
+
+    // reverse the steps start .. start+l, the state at start given, with s free checkpoints
+    void reverse (VectorView<double> start, size_t l, size_t s,
+                  VectorView<double> lambda, VectorView<double> grad)
+    {
+      if (l == 0) return;
+      if (l == 1 || s == 0)
+        {
+          for (size_t i = l; i-- > 0; )
+            {
+              m_y = start;
+              advance(m_y, i);
+              adjointStep(m_y, lambda, grad);
+            }
+          return;
+        }
+
+      // fewest recomputations r with C(s+r, s) >= l, then split off C(s+r-1, s) steps
+      size_t r = 1;
+      while (Binomial(s+r, s) < l) r++;
+      size_t m = std::min(size_t(Binomial(s+r-1, s)), l-1);
+
+      auto & snap = m_snaps[m_snaps.size()-s];
+      snap = start;
+      advance(snap, m);
+      reverse(snap, l-m, s-1, lambda, grad);
+      reverse(start, m, s, lambda, grad);
+    }
+
+  public:
+    AdjointRungeKutta (std::shared_ptr<NonlinearFunction> rhs,
+                       std::vector<std::shared_ptr<Parameter>> params,
+                       const Matrix<> & a, const Vector<> & b,
+                       size_t checkpoints = 16)
+      : m_rhs(rhs), m_params(std::move(params)), m_paramIndex(m_params), m_a(a), m_b(b),
+        m_stages(b.size()), m_n(rhs->dimX()), m_y0(m_n), m_y(m_n),
+        m_snaps(checkpoints, Vector<>(m_n)),
+        m_ystage(m_stages*m_n), m_k(m_stages*m_n), m_ybar(m_stages*m_n), m_kbar(m_stages*m_n)
+    {
+      // the stages and their transposes are swept in order, so the
+      // method must be explicit
+      if (a.rows() != m_stages || a.cols() != m_stages)
+        throw std::invalid_argument("AdjointRungeKutta: a must be s x s for s = b.size()");
+      for (size_t i = 0; i < m_stages; i++)
+        for (size_t j = i; j < m_stages; j++)
+          if (a(i,j) != 0.0)
+            throw std::invalid_argument("AdjointRungeKutta: a must be strictly lower triangular (explicit method)");
+    }
+
+    size_t numParams() const { return m_params.size(); }
+    // steps computed by Forward and Backward together
+    size_t numForwardSteps() const { return m_forwardSteps; }
+
+    // integrate with the given number of steps of size tau; y becomes the end state
+    void Forward (double tau, size_t steps, VectorView<double> y)
+    {
+      m_tau = tau;
+      m_steps = steps;
+      m_forwardSteps = 0;
+      m_y0 = y;
+      advance(y, steps);
+    }
+
+    /*
+      lambda = dL/dy(T) on input, dL/dy(0) on output;
+      grad(k) = dL/dp_k for the Parameters given to the constructor.
+    */
+    void Backward (VectorView<double> lambda, VectorView<double> grad)
+    {
+      grad = 0.0;
+      reverse(m_y0, m_steps, m_snaps.size(), lambda, grad);
+    }
+  };
+
+}
+
+#endif
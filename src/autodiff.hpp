@@ -1,17 +1,24 @@
 #ifndef AUTODIFF_HPP
 #define AUTODIFF_HPP
 
-#include <cstddef> 
-#include <ostream> 
-#include <cmath>   
-#include <array>  
+#include <cstddef>
+#include <ostream>
+#include <cmath>
+#include <array>
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <type_traits>
+#include <utility>
+
+#include "simd.hpp"
 
 
 namespace ASC_ode
 {
 
   template <size_t N, typename T = double>
-  class Variable 
+  class Variable
   {
     private:
       T m_val;
@@ -21,42 +28,221 @@ namespace ASC_ode
   };
 
   template <typename T = double>
-  auto derivative (T v, size_t /*index*/) { return T(0); } 
+  auto derivative (T v, size_t /*index*/) { return T(0); }
+
+
+  /*
+    AutoDiff and the lazy expressions built from it.
+    An expression node computes its value (and the outer derivative of
+    its operation) when it is built, and the i-th derivative on demand by
+    partial<V>(i), where V is T or a simd register of T. Assigning an
+    expression to an AutoDiff evaluates all derivatives in a single pass,
+    so a*b + c*d - e creates no intermediate derivative arrays.
+
+    AutoDiff lvalues are held by reference, everything else by value, so
+    an expression must not outlive its AutoDiff operands. Expressions are
+    therefore only evaluated as rvalues, inside the full-expression that
+    builds them: a named expression (auto e = a*b;) cannot be used as an
+    operand or assigned to an AutoDiff, and expressions cannot be copied.
+    Do not return an expression from a function either (a function with
+    return type auto returning a*b of local AutoDiffs dangles); return
+    an AutoDiff.
+
+    Every operation still carries all N derivatives, so a full gradient
+    or Jacobian costs a multiple of the evaluation that grows with N:
+    bench_autodiff measures 2-3 times for N <= 8, 6 times for N = 32 and
+    10 times for N = 64 (SSE2, simd width 2). The taped reverse mode
+    (EvaluateGradient in tape.hpp) stays at about 6-7 times there.
+  */
+  template <size_t N, typename T>
+  struct ADExpression
+  {
+    static constexpr size_t dim = N;
+    using value_type = T;
+  };
+
+  template <typename E>
+  concept ADExpr = requires { std::decay_t<E>::dim; typename std::decay_t<E>::value_type; }
+    && std::is_base_of_v<ADExpression<std::decay_t<E>::dim, typename std::decay_t<E>::value_type>, std::decay_t<E>>;
+
+  template <typename E>
+  using ADScalar = typename std::decay_t<E>::value_type;
+
+  // AutoDiff values, or expressions as rvalues (see above)
+  template <typename E>
+  concept ADOperand = ADExpr<E>
+    && (requires { std::decay_t<E>::isAutoDiff; } || !std::is_lvalue_reference_v<E>);
+
+  template <typename A, typename B>
+  concept ADCompatible = ADExpr<A> && ADExpr<B>
+    && std::decay_t<A>::dim == std::decay_t<B>::dim
+    && std::same_as<ADScalar<A>, ADScalar<B>>;
 
 
   template <size_t N, typename T = double>
-  class AutoDiff
+  class AutoDiff : public ADExpression<N, T>
   {
+  public:
+    static constexpr bool isAutoDiff = true;
   private:
+    // derivatives first and aligned to the vector width they fill
+    static constexpr size_t DerivAlign = std::is_arithmetic_v<T>
+      ? std::clamp(std::bit_ceil(N*sizeof(T)), alignof(T), size_t(64)) : alignof(T);
+    alignas(DerivAlign) std::array<T, N> m_deriv;
     T m_val;
-    std::array<T, N> m_deriv;
-  public: 
-    AutoDiff () : m_val(0), m_deriv{} {}
-    AutoDiff (T v) : m_val(v), m_deriv{} 
+
+    // registers only run over the derivatives if one fits, and then the
+    // storage is aligned for them: loads and stores use vector_aligned
+    static_assert(N*sizeof(T) < SimdAlignment<T>() || DerivAlign >= SimdAlignment<T>());
+
+    template <typename E>
+    void assignDeriv (E && e)
+    {
+      SimdFill<true>(N, m_deriv.data(), [&]<typename V>(size_t i) { return std::move(e).template partial<V>(i); });
+    }
+
+  public:
+    AutoDiff () : m_deriv{}, m_val(0) {}
+    AutoDiff (T v) : m_deriv{}, m_val(v)
     {
-      for (size_t i = 0; i < N; i++)
-        m_deriv[i] = derivative(v, i);
+      // a constant inner AutoDiff carries the seeds of nested derivatives
+      if constexpr (!std::is_arithmetic_v<T>)
+        for (size_t i = 0; i < N; i++)
+          m_deriv[i] = derivative(v, i);
     }
-    
+
     template <size_t I>
-    AutoDiff (Variable<I, T> var) : m_val(var.value()), m_deriv{} 
+    AutoDiff (Variable<I, T> var) : m_deriv{}, m_val(var.value())
     {
       m_deriv[I] = 1.0;
     }
 
+    template <ADOperand E>
+      requires ADCompatible<E, AutoDiff> && (!std::same_as<std::decay_t<E>, AutoDiff>)
+    AutoDiff (E && e) : m_val(e.value())
+    {
+      assignDeriv(std::move(e));
+    }
+
+    // e may refer to this, it has taken all values it needs
+    template <ADOperand E>
+      requires ADCompatible<E, AutoDiff> && (!std::same_as<std::decay_t<E>, AutoDiff>)
+    AutoDiff & operator= (E && e)
+    {
+      m_val = e.value();
+      assignDeriv(std::move(e));
+      return *this;
+    }
+
     T value() const { return m_val; }
     std::array<T, N>& deriv() { return m_deriv; }
     const std::array<T, N>& deriv() const { return m_deriv; }
+
+    template <typename V>
+    V partial (size_t i) const { return SimdLoad<V, true>(&m_deriv[i]); }
   };
 
 
   template <size_t N, typename T = double>
-  auto derivative (AutoDiff<N, T> v, size_t index) 
+  auto derivative (AutoDiff<N, T> v, size_t index)
   {
     return v.deriv()[index];
   }
 
 
+  template <typename E>
+  constexpr bool IsAutoDiff = false;
+  template <size_t N, typename T>
+  constexpr bool IsAutoDiff<AutoDiff<N, T>> = true;
+
+  template <typename E>
+  using ADResult = AutoDiff<std::decay_t<E>::dim, ADScalar<E>>;
+
+  template <typename E>
+  using ADStore = std::conditional_t<std::is_lvalue_reference_v<E> && IsAutoDiff<std::decay_t<E>>,
+                                     const std::decay_t<E> &, std::decay_t<E>>;
+
+  // expression nodes: move-only, evaluated by partial() on rvalues only
+  template <size_t N, typename T>
+  struct ADNode : ADExpression<N, T>
+  {
+    ADNode () = default;
+    ADNode (const ADNode &) = delete;
+    ADNode (ADNode &&) = default;
+    ADNode & operator= (const ADNode &) = delete;
+  };
+
+
+  // a + b
+  template <typename A, typename B>
+  class [[nodiscard]] ADSum : public ADNode<std::decay_t<A>::dim, ADScalar<A>>
+  {
+    using T = ADScalar<A>;
+    ADStore<A> m_a;
+    ADStore<B> m_b;
+    T m_val;
+  public:
+    ADSum (A && a, B && b)
+      : m_a(std::forward<A>(a)), m_b(std::forward<B>(b)), m_val(m_a.value() + m_b.value()) { }
+    T value() const { return m_val; }
+    template <typename V>
+    V partial (size_t i) const && { return std::move(m_a).template partial<V>(i) + std::move(m_b).template partial<V>(i); }
+  };
+
+  // a - b
+  template <typename A, typename B>
+  class [[nodiscard]] ADDifference : public ADNode<std::decay_t<A>::dim, ADScalar<A>>
+  {
+    using T = ADScalar<A>;
+    ADStore<A> m_a;
+    ADStore<B> m_b;
+    T m_val;
+  public:
+    ADDifference (A && a, B && b)
+      : m_a(std::forward<A>(a)), m_b(std::forward<B>(b)), m_val(m_a.value() - m_b.value()) { }
+    T value() const { return m_val; }
+    template <typename V>
+    V partial (size_t i) const && { return std::move(m_a).template partial<V>(i) - std::move(m_b).template partial<V>(i); }
+  };
+
+  // binary operation with partial derivatives fa, fb: val' = fa a' + fb b'
+  template <typename A, typename B>
+  class [[nodiscard]] ADLinComb : public ADNode<std::decay_t<A>::dim, ADScalar<A>>
+  {
+    using T = ADScalar<A>;
+    ADStore<A> m_a;
+    ADStore<B> m_b;
+    T m_val, m_fa, m_fb;
+  public:
+    ADLinComb (A && a, B && b, T val, T fa, T fb)
+      : m_a(std::forward<A>(a)), m_b(std::forward<B>(b)), m_val(val), m_fa(fa), m_fb(fb) { }
+    T value() const { return m_val; }
+    template <typename V>
+    V partial (size_t i) const && { return m_fa * std::move(m_a).template partial<V>(i) + m_fb * std::move(m_b).template partial<V>(i); }
+  };
+
+  // unary operation (or one with a constant) with derivative f: val' = f a'
+  template <typename A>
+  class [[nodiscard]] ADChain : public ADNode<std::decay_t<A>::dim, ADScalar<A>>
+  {
+    using T = ADScalar<A>;
+    ADStore<A> m_a;
+    T m_val, m_f;
+  public:
+    ADChain (A && a, T val, T f)
+      : m_a(std::forward<A>(a)), m_val(val), m_f(f) { }
+    T value() const { return m_val; }
+    template <typename V>
+    V partial (size_t i) const && { return m_f * std::move(m_a).template partial<V>(i); }
+  };
+
+  template <typename A>
+  auto MakeADChain (A && a, ADScalar<A> val, ADScalar<A> f)
+  {
+    return ADChain<A>(std::forward<A>(a), val, f);
+  }
+
+
 
   template <size_t N, typename T>
   std::ostream & operator<< (std::ostream& os, const AutoDiff<N, T>& ad)
@@ -71,66 +257,89 @@ namespace ASC_ode
     return os;
   }
 
-  template <size_t N, typename T = double>
-  AutoDiff<N, T> operator+ (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
+  template <ADOperand E> requires (!IsAutoDiff<std::decay_t<E>>)
+  std::ostream & operator<< (std::ostream& os, E && e)
   {
-     AutoDiff<N, T> result(a.value() + b.value());
-     for (size_t i = 0; i < N; i++)
-        result.deriv()[i] = a.deriv()[i] + b.deriv()[i];
-       return result;
-   }
+    return os << ADResult<E>(std::move(e));
+  }
 
-   template <size_t N, typename T = double>
-   auto operator+ (T a, const AutoDiff<N, T>& b) { return AutoDiff<N, T>(a) + b; }
 
+  template <ADOperand A, ADOperand B> requires ADCompatible<A, B>
+  auto operator+ (A && a, B && b)
+  {
+    return ADSum<A, B>(std::forward<A>(a), std::forward<B>(b));
+  }
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> operator* (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
-   {
-       AutoDiff<N, T> result(a.value() * b.value());
-       for (size_t i = 0; i < N; i++)
-          result.deriv()[i] = a.deriv()[i] * b.value() + a.value() * b.deriv()[i];
-       return result;
-   }
+  template <ADOperand A, ADOperand B> requires ADCompatible<A, B>
+  auto operator- (A && a, B && b)
+  {
+    return ADDifference<A, B>(std::forward<A>(a), std::forward<B>(b));
+  }
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> operator* (T a, const AutoDiff<N, T> &b) 
-   {
-        AutoDiff<N, T> result(a * b.value());
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = a * b.deriv()[i];
-        return result;
-    }
+  template <ADOperand A, ADOperand B> requires ADCompatible<A, B>
+  auto operator* (A && a, B && b)
+  {
+    ADScalar<A> va = a.value(), vb = b.value();
+    return ADLinComb<A, B>(std::forward<A>(a), std::forward<B>(b), va * vb, vb, va);
+  }
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> operator/ (const AutoDiff<N, T> &a, const AutoDiff<N, T> &b)
-   {
-       AutoDiff<N, T> result(a.value() / b.value());
-       for (size_t i = 0; i < N; i++)
-          result.deriv()[i] = (a.deriv()[i] * b.value() - a.value() * b.deriv()[i]) / (b.value() * b.value());
-       return result;
-   }
+  template <ADOperand A, ADOperand B> requires ADCompatible<A, B>
+  auto operator/ (A && a, B && b)
+  {
+    using T = ADScalar<A>;
+    // (a' b - a b') / b^2 = a'/b - (a/b) b'/b
+    T inv = T(1) / b.value();
+    T quot = a.value() * inv;
+    return ADLinComb<A, B>(std::forward<A>(a), std::forward<B>(b), quot, inv, T(-quot * inv));
+  }
+
+  template <ADOperand A>
+  auto operator- (A && a)
+  {
+    using T = ADScalar<A>;
+    return MakeADChain(std::forward<A>(a), T(-a.value()), T(-1));
+  }
+
+
+  // constants combine with values only and never touch derivative arrays
+
+  template <ADOperand A>
+  auto operator+ (A && a, ADScalar<A> b) { return MakeADChain(std::forward<A>(a), a.value() + b, 1); }
+
+  template <ADOperand A>
+  auto operator+ (ADScalar<A> a, A && b) { return MakeADChain(std::forward<A>(b), a + b.value(), 1); }
+
+  template <ADOperand A>
+  auto operator- (A && a, ADScalar<A> b) { return MakeADChain(std::forward<A>(a), a.value() - b, 1); }
+
+  template <ADOperand A>
+  auto operator- (ADScalar<A> a, A && b) { return MakeADChain(std::forward<A>(b), a - b.value(), -1); }
+
+  template <ADOperand A>
+  auto operator* (A && a, ADScalar<A> b) { return MakeADChain(std::forward<A>(a), a.value() * b, b); }
+
+  template <ADOperand A>
+  auto operator* (ADScalar<A> a, A && b) { return MakeADChain(std::forward<A>(b), a * b.value(), a); }
+
+  template <ADOperand A>
+  auto operator/ (A && a, ADScalar<A> b)
+  {
+    using T = ADScalar<A>;
+    T inv = T(1) / b;
+    return MakeADChain(std::forward<A>(a), a.value() * inv, inv);
+  }
+
+  template <ADOperand A>
+  auto operator/ (ADScalar<A> a, A && b)
+  {
+    using T = ADScalar<A>;
+    T quot = a / b.value();
+    return MakeADChain(std::forward<A>(b), quot, T(-quot / b.value()));
+  }
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> operator- (const AutoDiff<N, T> &a, const AutoDiff<N, T> &b)
-   {
-       AutoDiff<N, T> result(a.value() - b.value());
-       for (size_t i = 0; i < N; i++)
-          result.deriv()[i] = a.deriv()[i] - b.deriv()[i];
-       return result;
-   }
 
    template <size_t N, typename T = double>
-   AutoDiff<N, T> operator- (const AutoDiff<N, T> &a)
-   {
-       AutoDiff<N, T> result(-a.value());
-       for (size_t i = 0; i < N; i++)
-          result.deriv()[i] = -a.deriv()[i];
-       return result;
-   }
-   
-   template <size_t N, typename T = double>
-   bool operator== (const AutoDiff<N, T> &a, const AutoDiff<N, T> &b) 
+   bool operator== (const AutoDiff<N, T> &a, const AutoDiff<N, T> &b)
    {
         bool value = a.value() == b.value();
         return value && (a.deriv() == b.deriv());
@@ -138,77 +347,73 @@ namespace ASC_ode
 
    using std::sin;
    using std::cos;
+   using std::tan;
+   using std::exp;
+   using std::log;
+   using std::pow;
+   using std::sqrt;
 
-   template <size_t N, typename T = double>
-   AutoDiff<N, T> sin(const AutoDiff<N, T> &a)
+   // the elementary functions evaluate their outer derivative once
+
+   template <ADOperand A>
+   auto sin (A && a)
    {
-       AutoDiff<N, T> result(sin(a.value()));
-       for (size_t i = 0; i < N; i++)
-           result.deriv()[i] = cos(a.value()) * a.deriv()[i];
-       return result;
+     using T = ADScalar<A>;
+     return MakeADChain(std::forward<A>(a), T(sin(a.value())), T(cos(a.value())));
    }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> cos(const AutoDiff<N, T> &a)
-    {
-        AutoDiff<N, T> result(cos(a.value()));
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = -sin(a.value()) * a.deriv()[i];
-        return result;
-    }
-
-    template <size_t N, typename T = double>
-    AutoDiff<N,T> tan(const AutoDiff<N,T>& a) {
-        AutoDiff<N,T> result(std::tan(a.value()));
+   template <ADOperand A>
+   auto cos (A && a)
+   {
+     using T = ADScalar<A>;
+     return MakeADChain(std::forward<A>(a), T(cos(a.value())), T(-sin(a.value())));
+   }
 
-        T sec2 = 1.0 / std::cos(a.value());
-        sec2 = sec2 * sec2;
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = sec2 * a.deriv()[i];
-        return result;
-    }
+   template <ADOperand A>
+   auto tan (A && a)
+   {
+     using T = ADScalar<A>;
+     T t = tan(a.value());
+     return MakeADChain(std::forward<A>(a), t, T(1 + t*t));
+   }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> exp(const AutoDiff<N, T> &a)
-    {
-        AutoDiff<N, T> result(exp(a.value()));
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = exp(a.value()) * a.deriv()[i];
-        return result;
-    }
+   template <ADOperand A>
+   auto exp (A && a)
+   {
+     using T = ADScalar<A>;
+     T e = exp(a.value());
+     return MakeADChain(std::forward<A>(a), e, e);
+   }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> log(const AutoDiff<N, T> &a)
-    {
-        AutoDiff<N, T> result(log(a.value()));
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = 1/a.value() * a.deriv()[i];
-        return result;
-    }
+   template <ADOperand A>
+   auto log (A && a)
+   {
+     using T = ADScalar<A>;
+     return MakeADChain(std::forward<A>(a), T(log(a.value())), T(T(1) / a.value()));
+   }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> pow(const AutoDiff<N, T> &a, T exp)
-    {
-        AutoDiff<N, T> result(std::pow(a.value(), exp));
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = exp * std::pow(a.value(), exp - 1) * a.deriv()[i];
-        return result;
-    }
+   template <ADOperand A>
+   auto pow (A && a, ADScalar<A> exp)
+   {
+     using T = ADScalar<A>;
+     return MakeADChain(std::forward<A>(a), T(pow(a.value(), exp)), T(exp * pow(a.value(), exp - 1)));
+   }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> pow(T a, const AutoDiff<N, T> &exp)
-    {
-        AutoDiff<N, T> result(std::pow(a, exp.value()));
-        for (size_t i = 0; i < N; i++)
-            result.deriv()[i] = std::pow(a, exp.value())* std::log(a) * exp.deriv()[i];
-        return result;
-    }
+   template <ADOperand A>
+   auto pow (ADScalar<A> a, A && exp)
+   {
+     using T = ADScalar<A>;
+     T p = pow(a, exp.value());
+     return MakeADChain(std::forward<A>(exp), p, T(p * log(a)));
+   }
 
-    template <size_t N, typename T = double>
-    AutoDiff<N, T> sqrt(const AutoDiff<N, T>& a)
-    {
-        return pow(a, T(0.5));
-    }
+   template <ADOperand A>
+   auto sqrt (A && a)
+   {
+     using T = ADScalar<A>;
+     T r = sqrt(a.value());
+     return MakeADChain(std::forward<A>(a), r, T(T(0.5) / r));
+   }
 
 
 } // namespace ASC_ode
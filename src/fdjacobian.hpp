@@ -0,0 +1,255 @@
+#ifndef FDJACOBIAN_HPP
+#define FDJACOBIAN_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "nonlinfunc.hpp"
+#include "parallel.hpp"
+#include "scratch.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Jacobian by finite differences for models that only implement evaluate.
+
+    The sparsity pattern is detected once (or set by the user). Columns
+    that share no row get the same colour (Curtis-Powell-Reid), and all
+    columns of one colour are perturbed together, so the Jacobian costs
+    one evaluation per colour instead of one per unknown. Colour groups
+    are evaluated on the thread pool; the wrapped function's evaluate
+    must be safe to call concurrently, as all library functions are.
+
+    The result is a SparseOperator, whose inverse (e.g. in NewtonSolver)
+    is a banded LU when the pattern has a narrow band.
+  */
+  class FiniteDifferenceJacobian : public NonlinearFunction
+  {
+    // pattern and colouring; immutable once built, so evaluations keep
+    // using their snapshot while setPattern installs a new one
+    struct Coloring
+    {
+      std::vector<std::vector<size_t>> colpattern;  // rows per column
+      std::shared_ptr<SparseOperator::Pattern> rows;  // shared by the Jacobians
+      std::vector<std::vector<size_t>> colors;      // columns per colour
+    };
+
+    std::shared_ptr<NonlinearFunction> m_func;
+    bool m_parallel;
+
+    mutable std::mutex m_mutex;
+    mutable std::shared_ptr<const Coloring> m_coloring;
+
+    static double stepSize (double xj)
+    {
+      return std::sqrt(std::numeric_limits<double>::epsilon()) * std::max(1.0, std::abs(xj));
+    }
+
+    void forEach (size_t n, const std::function<void(size_t)> & task) const
+    {
+      if (m_parallel)
+        ParallelFor(n, task);
+      else
+        for (size_t i = 0; i < n; i++)
+          task(i);
+    }
+
+    // rows touched by perturbing each column, at x and at a shifted point
+    std::vector<std::vector<size_t>> detectPattern (VectorView<double> x) const
+    {
+      size_t n = dimX(), m = dimF();
+      std::vector<std::vector<size_t>> pattern(n);
+
+      // a second base point avoids entries that vanish by accident at x
+      // (e.g. springs aligned with a coordinate axis)
+      Vector<> xs(n);
+      for (size_t j = 0; j < n; j++)
+        xs(j) = x(j) + 1e-3 * (1 + std::abs(x(j))) * (0.3 + 0.7*((j*7919) % 101) / 101.0);
+
+      for (VectorView<double> base : { VectorView<double>(x), VectorView<double>(xs) })
+        {
+          Vector<> f0(m);
+          m_func->evaluate(base, f0);
+          forEach(n, [&](size_t j)
+          {
+            Vector<> xj(n), fj(m);
+            xj = base;
+            xj(j) += 1e-4 * (1 + std::abs(base(j)));
+            m_func->evaluate(xj, fj);
+            for (size_t i = 0; i < m; i++)
+              if (fj(i) != f0(i) &&
+                  std::find(pattern[j].begin(), pattern[j].end(), i) == pattern[j].end())
+                pattern[j].push_back(i);
+          });
+        }
+      return pattern;
+    }
+
+    std::shared_ptr<const Coloring> makeColoring (std::vector<std::vector<size_t>> pattern) const
+    {
+      size_t n = dimX(), m = dimF();
+      auto col = std::make_shared<Coloring>();
+      for (auto & rows : pattern)
+        std::sort(rows.begin(), rows.end());
+      col->colpattern = std::move(pattern);
+      auto & colpattern = col->colpattern;
+
+      // compressed rows of the pattern
+      std::vector<std::vector<size_t>> rowpattern(m);
+      for (size_t j = 0; j < n; j++)
+        for (size_t i : colpattern[j])
+          rowpattern[i].push_back(j);
+      col->rows = std::make_shared<SparseOperator::Pattern>();
+      auto & firstinrow = col->rows->firstinrow;
+      auto & colind = col->rows->colind;
+      firstinrow.assign(1, 0);
+      for (auto & cols : rowpattern)
+        {
+          colind.insert(colind.end(), cols.begin(), cols.end());
+          firstinrow.push_back(colind.size());
+        }
+
+      // greedy colouring of the column intersection graph, largest first
+      std::vector<size_t> order(n);
+      for (size_t j = 0; j < n; j++) order[j] = j;
+      std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                       { return colpattern[a].size() > colpattern[b].size(); });
+
+      std::vector<size_t> color(n, n), forbidden(n+1, n);
+      for (size_t j : order)
+        {
+          for (size_t i : colpattern[j])
+            for (size_t k : rowpattern[i])
+              if (color[k] < n)
+                forbidden[color[k]] = j;
+          size_t c = 0;
+          while (forbidden[c] == j) c++;
+          color[j] = c;
+          if (c == col->colors.size()) col->colors.emplace_back();
+          col->colors[c].push_back(j);
+        }
+      return col;
+    }
+
+    // the current colouring, detected at x on first use
+    std::shared_ptr<const Coloring> coloring (VectorView<double> x) const
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      if (!m_coloring)
+        m_coloring = makeColoring(detectPattern(x));
+      return m_coloring;
+    }
+
+  public:
+    FiniteDifferenceJacobian (std::shared_ptr<NonlinearFunction> func, bool parallel = true)
+      : m_func(func), m_parallel(parallel) { }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+
+    // known pattern: rows[j] lists the nonzero rows of column j
+    void setPattern (std::vector<std::vector<size_t>> rows)
+    {
+      auto col = makeColoring(std::move(rows));
+      std::lock_guard<std::mutex> guard(m_mutex);
+      m_coloring = std::move(col);
+    }
+
+    // 0 before the pattern is known
+    size_t numColors() const
+    {
+      std::lock_guard<std::mutex> guard(m_mutex);
+      return m_coloring ? m_coloring->colors.size() : 0;
+    }
+
+  protected:
+    // the clone keeps a detected pattern, so it is not detected again
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      auto copy = std::make_shared<FiniteDifferenceJacobian>(CloneShared(m_func, map), m_parallel);
+      std::lock_guard<std::mutex> guard(m_mutex);
+      copy->m_coloring = m_coloring;
+      return copy;
+    }
+
+  public:
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_func->evaluate(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      evaluateDerivOp(x)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      ScratchVector f(dimF());
+      return evaluateWithDerivOp(x, f);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+
+    // the unperturbed evaluation is needed for the differences anyway;
+    // the Jacobian shares the pattern of the colouring, and the perturbed
+    // points are per-thread scratch vectors, so only the values allocate
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      auto col = coloring(x);
+      size_t n = dimX(), m = dimF();
+      auto jac = std::make_shared<SparseOperator>(m, n, col->rows);
+      const auto & firstinrow = col->rows->firstinrow;
+      const auto & colind = col->rows->colind;
+
+      m_func->evaluate(x, f);
+
+      forEach(col->colors.size(), [&](size_t c)
+      {
+        ScratchVector xc(n), fc(m);
+        xc = x;
+        for (size_t j : col->colors[c])
+          xc(j) += stepSize(x(j));
+        m_func->evaluate(xc, fc);
+
+        // columns of one colour never share a row
+        for (size_t j : col->colors[c])
+          {
+            double h = xc(j) - x(j);
+            for (size_t i : col->colpattern[j])
+              {
+                size_t k = std::lower_bound(colind.begin()+firstinrow[i],
+                                            colind.begin()+firstinrow[i+1], j) - colind.begin();
+                jac->value(k) = (fc(i) - f(i)) / h;
+              }
+          }
+      });
+      return jac;
+    }
+
+    // parameter derivatives are those of the wrapped function
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      m_func->evaluateParamDeriv(x, param, dfdp);
+    }
+
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      m_func->addParamGradient(x, w, params, grad);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef HYPERDUAL_HPP
+#define HYPERDUAL_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <utility>
+
+namespace ASC_ode
+{
+
+  /*
+    Second order forward AutoDiff: value, gradient and Hessian with
+    respect to N seeded variables. The Hessian is symmetric and stored
+    as the packed upper triangle, row by row, so every second derivative
+    is computed once. An operation costs O(N^2).
+  */
+  template <size_t N>
+  class HyperDual
+  {
+    static constexpr size_t NH = N*(N+1)/2;
+    double m_val;
+    std::array<double, N> m_grad;
+    std::array<double, NH> m_hess;
+
+  public:
+    HyperDual (double v = 0) : m_val(v), m_grad{}, m_hess{} { }
+
+    // the variable seeded in slot index
+    HyperDual (double v, size_t index) : m_val(v), m_grad{}, m_hess{}
+    {
+      m_grad[index] = 1;
+    }
+
+    double value() const { return m_val; }
+    double grad (size_t i) const { return m_grad[i]; }
+    double hess (size_t i, size_t j) const
+    {
+      if (i > j) std::swap(i, j);
+      return m_hess[i*N - i*(i-1)/2 + j-i];
+    }
+
+    // r = f(a): r' = f1 a', r'' = f1 a'' + f2 a' a'^T
+    static HyperDual Chain (double val, const HyperDual & a, double f1, double f2)
+    {
+      HyperDual r(val);
+      for (size_t i = 0; i < N; i++)
+        r.m_grad[i] = f1 * a.m_grad[i];
+      for (size_t i = 0, k = 0; i < N; i++)
+        {
+          double ai = f2 * a.m_grad[i];
+          for (size_t j = i; j < N; j++, k++)
+            r.m_hess[k] = f1 * a.m_hess[k] + ai * a.m_grad[j];
+        }
+      return r;
+    }
+
+    // r = fa a + fb b, to first and second order
+    static HyperDual Sum (double val, const HyperDual & a, double fa, const HyperDual & b, double fb)
+    {
+      HyperDual r(val);
+      for (size_t i = 0; i < N; i++)
+        r.m_grad[i] = fa * a.m_grad[i] + fb * b.m_grad[i];
+      for (size_t k = 0; k < NH; k++)
+        r.m_hess[k] = fa * a.m_hess[k] + fb * b.m_hess[k];
+      return r;
+    }
+
+    // r = F(a,b) with first derivatives fa, fb and second faa, fab, fbb
+    static HyperDual Chain (double val, const HyperDual & a, double fa, const HyperDual & b, double fb,
+                            double faa, double fab, double fbb)
+    {
+      HyperDual r(val);
+      for (size_t i = 0; i < N; i++)
+        r.m_grad[i] = fa * a.m_grad[i] + fb * b.m_grad[i];
+      for (size_t i = 0, k = 0; i < N; i++)
+        {
+          double ai = faa * a.m_grad[i] + fab * b.m_grad[i];
+          double bi = fab * a.m_grad[i] + fbb * b.m_grad[i];
+          for (size_t j = i; j < N; j++, k++)
+            r.m_hess[k] = fa * a.m_hess[k] + fb * b.m_hess[k]
+              + ai * a.m_grad[j] + bi * b.m_grad[j];
+        }
+      return r;
+    }
+  };
+
+
+  template <size_t N>
+  std::ostream & operator<< (std::ostream & os, const HyperDual<N> & a)
+  {
+    os << "Value: " << a.value() << ", Grad: [";
+    for (size_t i = 0; i < N; i++)
+      os << (i ? ", " : "") << a.grad(i);
+    os << "], Hess: [";
+    for (size_t i = 0; i < N; i++)
+      for (size_t j = i; j < N; j++)
+        os << (i+j ? ", " : "") << a.hess(i,j);
+    return os << "]";
+  }
+
+  template <size_t N>
+  HyperDual<N> operator+ (const HyperDual<N> & a, const HyperDual<N> & b)
+  { return HyperDual<N>::Sum(a.value()+b.value(), a, 1, b, 1); }
+
+  template <size_t N>
+  HyperDual<N> operator- (const HyperDual<N> & a, const HyperDual<N> & b)
+  { return HyperDual<N>::Sum(a.value()-b.value(), a, 1, b, -1); }
+
+  template <size_t N>
+  HyperDual<N> operator* (const HyperDual<N> & a, const HyperDual<N> & b)
+  { return HyperDual<N>::Chain(a.value()*b.value(), a, b.value(), b, a.value(), 0, 1, 0); }
+
+  template <size_t N>
+  HyperDual<N> operator/ (const HyperDual<N> & a, const HyperDual<N> & b)
+  {
+    double inv = 1 / b.value();
+    double quot = a.value() * inv;
+    // d/db = -a/b^2, d2/da db = -1/b^2, d2/db2 = 2a/b^3
+    return HyperDual<N>::Chain(quot, a, inv, b, -quot*inv, 0, -inv*inv, 2*quot*inv*inv);
+  }
+
+  template <size_t N>
+  HyperDual<N> operator- (const HyperDual<N> & a) { return HyperDual<N>::Chain(-a.value(), a, -1, 0); }
+
+  // constants only touch the value and the factors
+
+  template <size_t N>
+  HyperDual<N> operator+ (const HyperDual<N> & a, double b) { return HyperDual<N>::Chain(a.value()+b, a, 1, 0); }
+  template <size_t N>
+  HyperDual<N> operator+ (double a, const HyperDual<N> & b) { return HyperDual<N>::Chain(a+b.value(), b, 1, 0); }
+  template <size_t N>
+  HyperDual<N> operator- (const HyperDual<N> & a, double b) { return HyperDual<N>::Chain(a.value()-b, a, 1, 0); }
+  template <size_t N>
+  HyperDual<N> operator- (double a, const HyperDual<N> & b) { return HyperDual<N>::Chain(a-b.value(), b, -1, 0); }
+  template <size_t N>
+  HyperDual<N> operator* (const HyperDual<N> & a, double b) { return HyperDual<N>::Chain(a.value()*b, a, b, 0); }
+  template <size_t N>
+  HyperDual<N> operator* (double a, const HyperDual<N> & b) { return HyperDual<N>::Chain(a*b.value(), b, a, 0); }
+  template <size_t N>
+  HyperDual<N> operator/ (const HyperDual<N> & a, double b) { return HyperDual<N>::Chain(a.value()/b, a, 1/b, 0); }
+  template <size_t N>
+  HyperDual<N> operator/ (double a, const HyperDual<N> & b)
+  {
+    double inv = 1 / b.value();
+    double quot = a * inv;
+    return HyperDual<N>::Chain(quot, b, -quot*inv, 2*quot*inv*inv);
+  }
+
+  template <size_t N>
+  HyperDual<N> sin (const HyperDual<N> & a)
+  {
+    double s = std::sin(a.value()), c = std::cos(a.value());
+    return HyperDual<N>::Chain(s, a, c, -s);
+  }
+
+  template <size_t N>
+  HyperDual<N> cos (const HyperDual<N> & a)
+  {
+    double s = std::sin(a.value()), c = std::cos(a.value());
+    return HyperDual<N>::Chain(c, a, -s, -c);
+  }
+
+  template <size_t N>
+  HyperDual<N> tan (const HyperDual<N> & a)
+  {
+    double t = std::tan(a.value());
+    double sec2 = 1 + t*t;
+    return HyperDual<N>::Chain(t, a, sec2, 2*t*sec2);
+  }
+
+  template <size_t N>
+  HyperDual<N> exp (const HyperDual<N> & a)
+  {
+    double e = std::exp(a.value());
+    return HyperDual<N>::Chain(e, a, e, e);
+  }
+
+  template <size_t N>
+  HyperDual<N> log (const HyperDual<N> & a)
+  {
+    double inv = 1 / a.value();
+    return HyperDual<N>::Chain(std::log(a.value()), a, inv, -inv*inv);
+  }
+
+  template <size_t N>
+  HyperDual<N> sqrt (const HyperDual<N> & a)
+  {
+    double r = std::sqrt(a.value());
+    return HyperDual<N>::Chain(r, a, 0.5/r, -0.25/(r*a.value()));
+  }
+
+  template <size_t N>
+  HyperDual<N> pow (const HyperDual<N> & a, double exp)
+  {
+    double v = a.value();
+    return HyperDual<N>::Chain(std::pow(v, exp), a, exp * std::pow(v, exp-1),
+                               exp * (exp-1) * std::pow(v, exp-2));
+  }
+
+  template <size_t N>
+  HyperDual<N> pow (double a, const HyperDual<N> & exp)
+  {
+    double p = std::pow(a, exp.value());
+    double l = std::log(a);
+    return HyperDual<N>::Chain(p, exp, p*l, p*l*l);
+  }
+
+}
+
+#endif
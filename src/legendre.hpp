@@ -0,0 +1,136 @@
+#ifndef LEGENDRE_HPP
+#define LEGENDRE_HPP
+
+#include <cstddef>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+#include "simd.hpp"
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  /*
+    Legendre and Jacobi polynomials with their derivatives by the three
+    term recurrences, the derivative recurrence obtained by differentiating
+    them (no division by 1-x^2, fine at the end points).
+
+    The kernels are templates on V, which is either double or a SIMD
+    register of points (SimdT<double>), so one call runs the recurrence
+    for several x in parallel lanes. They need no memory beyond registers.
+    The batched functions below loop over arrays of points that way.
+  */
+
+  // P_n(x) and P_n'(x)
+  template <typename V>
+  inline void LegendreKernel (size_t n, V x, V & p, V & dp)
+  {
+    V p0 = 1, p1 = x, d0 = 0, d1 = 1;
+    if (n == 0) { p = p0; dp = d0; return; }
+    for (size_t k = 2; k <= n; k++)
+      {
+        // k P_k = (2k-1) x P_{k-1} - (k-1) P_{k-2},  P_k' = k P_{k-1} + x P_{k-1}'
+        V p2 = ((2.0*k-1) * x * p1 - (k-1.0) * p0) * (1.0/k);
+        V d2 = double(k) * p1 + x * d1;
+        p0 = p1; p1 = p2;
+        d0 = d1; d1 = d2;
+      }
+    p = p1; dp = d1;
+  }
+
+  // all P_0..P_n and derivatives, store(k, P_k, P_k') is called for each k
+  template <typename V, typename Store>
+  inline void LegendreKernel (size_t n, V x, Store && store)
+  {
+    V p0 = 1, p1 = x, d0 = 0, d1 = 1;
+    store(0, p0, d0);
+    if (n == 0) return;
+    store(1, p1, d1);
+    for (size_t k = 2; k <= n; k++)
+      {
+        V p2 = ((2.0*k-1) * x * p1 - (k-1.0) * p0) * (1.0/k);
+        V d2 = double(k) * p1 + x * d1;
+        store(k, p2, d2);
+        p0 = p1; p1 = p2;
+        d0 = d1; d1 = d2;
+      }
+  }
+
+
+  /*
+    Jacobi polynomials P_k^(alf,bet), with the recurrence of Numerical
+    Recipes (gaujac): a_k P_k = (b0_k + b1_k x) P_{k-1} - c_k P_{k-2}.
+    store(k, P_k, P_k') for k = 0..n.
+  */
+  template <typename V, typename Store>
+  inline void JacobiKernel (size_t n, double alf, double bet, V x, Store && store)
+  {
+    double alfbet = alf + bet;
+    V p0 = 1, d0 = 0;
+    V p1 = 0.5 * (alf - bet) + (0.5 * (2.0 + alfbet)) * x;
+    V d1 = 0.5 * (2.0 + alfbet);
+    store(0, p0, d0);
+    if (n == 0) return;
+    store(1, p1, d1);
+    for (size_t k = 2; k <= n; k++)
+      {
+        double temp = 2*k + alfbet;
+        double inva = 1.0 / (2*k * (k+alfbet) * (temp-2.0));
+        double b0 = (temp-1.0) * (alf*alf - bet*bet);
+        double b1 = (temp-1.0) * temp * (temp-2.0);
+        double c = 2.0 * (k-1+alf) * (k-1+bet) * temp;
+        V p2 = ((b0 + b1 * x) * p1 - c * p0) * inva;
+        V d2 = (b1 * p1 + (b0 + b1 * x) * d1 - c * d0) * inva;
+        store(k, p2, d2);
+        p0 = p1; p1 = p2;
+        d0 = d1; d1 = d2;
+      }
+  }
+
+
+  // p(k,i) = P_k(x(i)), dp(k,i) = P_k'(x(i)) for k = 0..n
+  inline void LegendrePolynomials (size_t n, VectorView<double> x,
+                                   MatrixView<double> p, MatrixView<double> dp)
+  {
+    SimdLoop<double>(x.size(), [&]<typename V> (size_t i)
+    {
+      LegendreKernel(n, SimdGather<V>(x, i), [&] (size_t k, V pk, V dpk)
+      {
+        SimdScatter(pk, p.row(k), i);
+        SimdScatter(dpk, dp.row(k), i);
+      });
+    });
+  }
+
+  // p(i) = P_n(x(i)), dp(i) = P_n'(x(i))
+  inline void LegendrePolynomial (size_t n, VectorView<double> x,
+                                  VectorView<double> p, VectorView<double> dp)
+  {
+    SimdLoop<double>(x.size(), [&]<typename V> (size_t i)
+    {
+      V pn, dpn;
+      LegendreKernel(n, SimdGather<V>(x, i), pn, dpn);
+      SimdScatter(pn, p, i);
+      SimdScatter(dpn, dp, i);
+    });
+  }
+
+  // p(k,i) = P_k^(alf,bet)(x(i)), dp(k,i) its derivative, k = 0..n
+  inline void JacobiPolynomials (size_t n, double alf, double bet, VectorView<double> x,
+                                 MatrixView<double> p, MatrixView<double> dp)
+  {
+    SimdLoop<double>(x.size(), [&]<typename V> (size_t i)
+    {
+      JacobiKernel(n, alf, bet, SimdGather<V>(x, i), [&] (size_t k, V pk, V dpk)
+      {
+        SimdScatter(pk, p.row(k), i);
+        SimdScatter(dpk, dp.row(k), i);
+      });
+    });
+  }
+
+}
+
+#endif
@@ -0,0 +1,721 @@
+#ifndef LINOP_HPP
+#define LINOP_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+#include <inverse.hpp>
+
+#include "scratch.hpp"
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  /*
+    Linear operators with known structure.
+    NonlinearFunction::evaluateDerivOp returns one of these, so sums,
+    products and inverses of Jacobians can be formed on the structure
+    (diagonal, Kronecker, block-diagonal, zero) instead of on dense
+    n x n matrices. A dense matrix is only assembled where no structured
+    rule applies.
+  */
+  class LinearOperator
+  {
+  public:
+    virtual ~LinearOperator() = default;
+    virtual size_t rows() const = 0;
+    virtual size_t cols() const = 0;
+    // y = A x
+    virtual void mult (VectorView<double> x, VectorView<double> y) const = 0;
+    // y = A^T x, for vector-Jacobian products; default assembles densely
+    virtual void multTrans (VectorView<double> x, VectorView<double> y) const;
+    // m += fac * A
+    virtual void addTo (MatrixView<double> m, double fac = 1) const = 0;
+    // default: assemble and invert densely
+    virtual std::shared_ptr<LinearOperator> inverse() const;
+    virtual bool isZero() const { return false; }
+
+    // structure the operator algebra has rules for; one virtual call per
+    // operand of a sum or product, instead of a chain of dynamic_casts
+    enum class Kind { Generic, Diagonal, BlockDiagonal, Kronecker, Scaled };
+    virtual Kind kind() const { return Kind::Generic; }
+
+    void assemble (MatrixView<double> m) const
+    {
+      m = 0.0;
+      addTo(m);
+    }
+  };
+
+
+  class ZeroOperator : public LinearOperator
+  {
+    size_t m_rows, m_cols;
+  public:
+    ZeroOperator (size_t rows, size_t cols) : m_rows(rows), m_cols(cols) { }
+    size_t rows() const override { return m_rows; }
+    size_t cols() const override { return m_cols; }
+    void mult (VectorView<double> x, VectorView<double> y) const override { y = 0.0; }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override { y = 0.0; }
+    void addTo (MatrixView<double> m, double fac) const override { }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      throw std::domain_error("ZeroOperator is not invertible");
+    }
+    bool isZero() const override { return true; }
+  };
+
+
+  class DenseOperator : public LinearOperator
+  {
+    Matrix<double> m_mat;
+  public:
+    DenseOperator (size_t rows, size_t cols) : m_mat(rows, cols) { m_mat = 0.0; }
+    DenseOperator (Matrix<double> mat) : m_mat(std::move(mat)) { }
+
+    Matrix<double> & matrix() { return m_mat; }
+    const Matrix<double> & matrix() const { return m_mat; }
+
+    size_t rows() const override { return m_mat.rows(); }
+    size_t cols() const override { return m_mat.cols(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = m_mat * x;
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      for (size_t i = 0; i < m_mat.rows(); i++)
+        y += x(i) * m_mat.row(i);
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      m += fac * m_mat;
+    }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      Matrix<double> inv = m_mat;
+      calcInverse(inv);
+      return std::make_shared<DenseOperator>(std::move(inv));
+    }
+  };
+
+
+  inline void LinearOperator :: multTrans (VectorView<double> x, VectorView<double> y) const
+  {
+    Matrix<double> mat(rows(), cols());
+    assemble(mat);
+    DenseOperator(std::move(mat)).multTrans(x, y);
+  }
+
+  inline std::shared_ptr<LinearOperator> LinearOperator :: inverse() const
+  {
+    Matrix<double> mat(rows(), cols());
+    assemble(mat);
+    calcInverse(mat);
+    return std::make_shared<DenseOperator>(std::move(mat));
+  }
+
+
+  class DiagonalOperator : public LinearOperator
+  {
+    Vector<> m_diag;
+  public:
+    DiagonalOperator (size_t n, double val) : m_diag(n) { m_diag = val; }
+    DiagonalOperator (Vector<> diag) : m_diag(std::move(diag)) { }
+
+    VectorView<double> diag() const { return m_diag; }
+    Kind kind() const override { return Kind::Diagonal; }
+
+    size_t rows() const override { return m_diag.size(); }
+    size_t cols() const override { return m_diag.size(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      for (size_t i = 0; i < m_diag.size(); i++)
+        y(i) = m_diag(i) * x(i);
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      mult(x, y);
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      for (size_t i = 0; i < m_diag.size(); i++)
+        m(i,i) += fac * m_diag(i);
+    }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      Vector<> inv(m_diag.size());
+      for (size_t i = 0; i < m_diag.size(); i++)
+        {
+          if (m_diag(i) == 0.0)
+            throw std::domain_error("DiagonalOperator is singular");
+          inv(i) = 1.0 / m_diag(i);
+        }
+      return std::make_shared<DiagonalOperator>(std::move(inv));
+    }
+  };
+
+
+  // compressed row storage; operators with the same pattern may share it
+  class SparseOperator : public LinearOperator
+  {
+  public:
+    struct Pattern
+    {
+      std::vector<size_t> firstinrow, colind;
+    };
+  private:
+    size_t m_rows, m_cols;
+    std::shared_ptr<const Pattern> m_pattern;
+    std::vector<double> m_values;
+  public:
+    SparseOperator (size_t rows, size_t cols, std::shared_ptr<const Pattern> pattern)
+      : m_rows(rows), m_cols(cols), m_pattern(std::move(pattern)),
+        m_values(m_pattern->colind.size(), 0.0) { }
+
+    SparseOperator (size_t rows, size_t cols,
+                    std::vector<size_t> firstinrow, std::vector<size_t> colind)
+      : SparseOperator(rows, cols, std::make_shared<Pattern>(Pattern{ std::move(firstinrow), std::move(colind) })) { }
+
+    size_t nze() const { return m_values.size(); }
+    size_t firstInRow (size_t i) const { return m_pattern->firstinrow[i]; }
+    size_t colIndex (size_t k) const { return m_pattern->colind[k]; }
+    double & value (size_t k) { return m_values[k]; }
+    double value (size_t k) const { return m_values[k]; }
+
+    size_t rows() const override { return m_rows; }
+    size_t cols() const override { return m_cols; }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      for (size_t i = 0; i < m_rows; i++)
+        {
+          double sum = 0;
+          for (size_t k = m_pattern->firstinrow[i]; k < m_pattern->firstinrow[i+1]; k++)
+            sum += m_values[k] * x(m_pattern->colind[k]);
+          y(i) = sum;
+        }
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      for (size_t i = 0; i < m_rows; i++)
+        for (size_t k = m_pattern->firstinrow[i]; k < m_pattern->firstinrow[i+1]; k++)
+          y(m_pattern->colind[k]) += m_values[k] * x(i);
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      for (size_t i = 0; i < m_rows; i++)
+        for (size_t k = m_pattern->firstinrow[i]; k < m_pattern->firstinrow[i+1]; k++)
+          m(i, m_pattern->colind[k]) += fac * m_values[k];
+    }
+    // banded LU if the pattern has a narrow band, dense otherwise
+    std::shared_ptr<LinearOperator> inverse() const override;
+  };
+
+
+  /*
+    Inverse of a banded matrix by LU with partial pivoting, stored in the
+    band (kl sub- and kl + ku superdiagonals after pivoting). Costs
+    n kl (kl + ku) to factor and n (2 kl + ku) per solve, instead of the
+    n^3 of a dense inverse, e.g. for chains of masses and springs.
+  */
+  class BandedLUInverse : public LinearOperator
+  {
+    size_t m_n, m_kl, m_ku, m_width;
+    std::vector<double> m_band;       // row i holds columns i-kl .. i+kl+ku
+    std::vector<double> m_lower;      // multipliers of step k, kl per step
+    std::vector<size_t> m_pivot;
+
+    double & at (size_t i, size_t j) { return m_band[i*m_width + j + m_kl - i]; }
+    double at (size_t i, size_t j) const { return m_band[i*m_width + j + m_kl - i]; }
+
+  public:
+    BandedLUInverse (const SparseOperator & a, size_t kl, size_t ku)
+      : m_n(a.rows()), m_kl(kl), m_ku(ku), m_width(2*kl+ku+1),
+        m_band(m_n*m_width, 0.0), m_lower(m_n*kl, 0.0), m_pivot(m_n)
+    {
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t k = a.firstInRow(i); k < a.firstInRow(i+1); k++)
+          at(i, a.colIndex(k)) += a.value(k);
+
+      for (size_t k = 0; k < m_n; k++)
+        {
+          size_t last = std::min(m_n-1, k+m_kl), lastcol = std::min(m_n-1, k+m_kl+m_ku);
+          size_t p = k;
+          for (size_t i = k+1; i <= last; i++)
+            if (std::abs(at(i,k)) > std::abs(at(p,k))) p = i;
+          if (at(p,k) == 0.0)
+            throw std::domain_error("BandedLUInverse: matrix is singular");
+          m_pivot[k] = p;
+          if (p != k)
+            for (size_t j = k; j <= lastcol; j++)
+              std::swap(at(k,j), at(p,j));
+
+          for (size_t i = k+1; i <= last; i++)
+            {
+              double l = at(i,k) / at(k,k);
+              m_lower[k*m_kl + i-k-1] = l;
+              at(i,k) = 0.0;
+              if (l != 0.0)
+                for (size_t j = k+1; j <= lastcol; j++)
+                  at(i,j) -= l * at(k,j);
+            }
+        }
+    }
+
+    size_t rows() const override { return m_n; }
+    size_t cols() const override { return m_n; }
+
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = x;
+      for (size_t k = 0; k < m_n; k++)
+        {
+          std::swap(y(k), y(m_pivot[k]));
+          for (size_t i = k+1; i <= std::min(m_n-1, k+m_kl); i++)
+            y(i) -= m_lower[k*m_kl + i-k-1] * y(k);
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          double sum = y(i);
+          for (size_t j = i+1; j <= std::min(m_n-1, i+m_kl+m_ku); j++)
+            sum -= at(i,j) * y(j);
+          y(i) = sum / at(i,i);
+        }
+    }
+
+    // column by column, only for dense fallbacks
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      Vector<> e(m_n), col(m_n);
+      for (size_t j = 0; j < m_n; j++)
+        {
+          e = 0.0;
+          e(j) = 1;
+          mult(e, col);
+          for (size_t i = 0; i < m_n; i++)
+            m(i,j) += fac * col(i);
+        }
+    }
+  };
+
+
+  inline std::shared_ptr<LinearOperator> SparseOperator :: inverse() const
+  {
+    size_t kl = 0, ku = 0;
+    for (size_t i = 0; i < m_rows; i++)
+      for (size_t k = m_pattern->firstinrow[i]; k < m_pattern->firstinrow[i+1]; k++)
+        {
+          size_t j = m_pattern->colind[k];
+          if (i > j) kl = std::max(kl, i-j);
+          else ku = std::max(ku, j-i);
+        }
+    if (m_rows != m_cols || 4 * (2*kl+ku+1) > m_rows)
+      return LinearOperator::inverse();
+    return std::make_shared<BandedLUInverse>(*this, kl, ku);
+  }
+
+
+  // A (x) I_n, as it appears in the stage coupling of Runge-Kutta methods
+  class KroneckerOperator : public LinearOperator
+  {
+    Matrix<double> m_a;
+    size_t m_n;
+  public:
+    KroneckerOperator (Matrix<double> a, size_t n) : m_a(std::move(a)), m_n(n) { }
+
+    const Matrix<double> & factor() const { return m_a; }
+    size_t blockSize() const { return m_n; }
+    Kind kind() const override { return Kind::Kronecker; }
+
+    size_t rows() const override { return m_a.rows() * m_n; }
+    size_t cols() const override { return m_a.cols() * m_n; }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            y.range(i*m_n, (i+1)*m_n) += m_a(i,j) * x.range(j*m_n, (j+1)*m_n);
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            y.range(j*m_n, (j+1)*m_n) += m_a(i,j) * x.range(i*m_n, (i+1)*m_n);
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          for (size_t k = 0; k < m_n; k++)
+            m(i*m_n+k, j*m_n+k) += fac * m_a(i,j);
+    }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      Matrix<double> inv = m_a;
+      calcInverse(inv);
+      return std::make_shared<KroneckerOperator>(std::move(inv), m_n);
+    }
+  };
+
+
+  class BlockDiagonalOperator : public LinearOperator
+  {
+    std::vector<std::shared_ptr<LinearOperator>> m_blocks;
+    std::vector<size_t> m_firstrow, m_firstcol;
+  public:
+    BlockDiagonalOperator (std::vector<std::shared_ptr<LinearOperator>> blocks)
+      : m_blocks(std::move(blocks))
+    {
+      size_t r = 0, c = 0;
+      for (auto & block : m_blocks)
+        {
+          m_firstrow.push_back(r);
+          m_firstcol.push_back(c);
+          r += block->rows();
+          c += block->cols();
+        }
+      m_firstrow.push_back(r);
+      m_firstcol.push_back(c);
+    }
+
+    size_t numBlocks() const { return m_blocks.size(); }
+    std::shared_ptr<LinearOperator> block (size_t i) const { return m_blocks[i]; }
+    Kind kind() const override { return Kind::BlockDiagonal; }
+
+    size_t rows() const override { return m_firstrow.back(); }
+    size_t cols() const override { return m_firstcol.back(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      for (size_t i = 0; i < m_blocks.size(); i++)
+        m_blocks[i]->mult(x.range(m_firstcol[i], m_firstcol[i+1]),
+                          y.range(m_firstrow[i], m_firstrow[i+1]));
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      for (size_t i = 0; i < m_blocks.size(); i++)
+        m_blocks[i]->multTrans(x.range(m_firstrow[i], m_firstrow[i+1]),
+                               y.range(m_firstcol[i], m_firstcol[i+1]));
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      for (size_t i = 0; i < m_blocks.size(); i++)
+        m_blocks[i]->addTo(m.rows(m_firstrow[i], m_firstrow[i+1]).cols(m_firstcol[i], m_firstcol[i+1]), fac);
+    }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      // blocks shared by several stages are inverted only once
+      std::vector<std::shared_ptr<LinearOperator>> inv(m_blocks.size());
+      for (size_t i = 0; i < m_blocks.size(); i++)
+        {
+          for (size_t j = 0; j < i && !inv[i]; j++)
+            if (m_blocks[j] == m_blocks[i])
+              inv[i] = inv[j];
+          if (!inv[i])
+            inv[i] = m_blocks[i]->inverse();
+        }
+      return std::make_shared<BlockDiagonalOperator>(std::move(inv));
+    }
+    bool isZero() const override
+    {
+      for (auto & block : m_blocks)
+        if (!block->isZero()) return false;
+      return true;
+    }
+  };
+
+
+  // op placed at (firstrow, firstcol) inside a zero rows x cols operator
+  class EmbeddedOperator : public LinearOperator
+  {
+    std::shared_ptr<LinearOperator> m_op;
+    size_t m_rows, m_cols, m_firstrow, m_firstcol;
+  public:
+    EmbeddedOperator (std::shared_ptr<LinearOperator> op,
+                      size_t rows, size_t cols, size_t firstrow, size_t firstcol)
+      : m_op(op), m_rows(rows), m_cols(cols), m_firstrow(firstrow), m_firstcol(firstcol) { }
+
+    size_t rows() const override { return m_rows; }
+    size_t cols() const override { return m_cols; }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      m_op->mult(x.range(m_firstcol, m_firstcol+m_op->cols()),
+                 y.range(m_firstrow, m_firstrow+m_op->rows()));
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      y = 0.0;
+      m_op->multTrans(x.range(m_firstrow, m_firstrow+m_op->rows()),
+                      y.range(m_firstcol, m_firstcol+m_op->cols()));
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      m_op->addTo(m.rows(m_firstrow, m_firstrow+m_op->rows()).cols(m_firstcol, m_firstcol+m_op->cols()), fac);
+    }
+    bool isZero() const override { return m_op->isZero(); }
+  };
+
+
+  class ScaledOperator : public LinearOperator
+  {
+    std::shared_ptr<LinearOperator> m_op;
+    double m_fac;
+  public:
+    ScaledOperator (std::shared_ptr<LinearOperator> op, double fac)
+      : m_op(op), m_fac(fac) { }
+
+    std::shared_ptr<LinearOperator> base() const { return m_op; }
+    double factor() const { return m_fac; }
+    Kind kind() const override { return Kind::Scaled; }
+
+    // strips nested scalings from op, multiplying them into fac
+    static void Unscale (std::shared_ptr<LinearOperator> & op, double & fac)
+    {
+      while (op->kind() == Kind::Scaled)
+        {
+          auto scaled = static_cast<const ScaledOperator*>(op.get());
+          fac *= scaled->m_fac;
+          op = scaled->m_op;
+        }
+    }
+
+    size_t rows() const override { return m_op->rows(); }
+    size_t cols() const override { return m_op->cols(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      m_op->mult(x, y);
+      y *= m_fac;
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      m_op->multTrans(x, y);
+      y *= m_fac;
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      m_op->addTo(m, fac*m_fac);
+    }
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      if (m_fac == 0.0)
+        throw std::domain_error("ScaledOperator with factor 0 is not invertible");
+      return std::make_shared<ScaledOperator>(m_op->inverse(), 1.0/m_fac);
+    }
+    bool isZero() const override { return m_fac == 0.0 || m_op->isZero(); }
+  };
+
+
+  class SumOperator : public LinearOperator
+  {
+    std::shared_ptr<LinearOperator> m_opa, m_opb;
+    double m_faca, m_facb;
+  public:
+    SumOperator (std::shared_ptr<LinearOperator> opa,
+                 std::shared_ptr<LinearOperator> opb,
+                 double faca, double facb)
+      : m_opa(opa), m_opb(opb), m_faca(faca), m_facb(facb) { }
+
+    size_t rows() const override { return m_opa->rows(); }
+    size_t cols() const override { return m_opa->cols(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      m_opa->mult(x, y);
+      y *= m_faca;
+      ScratchVector tmp(rows());
+      m_opb->mult(x, tmp);
+      y += m_facb*tmp;
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      m_opa->multTrans(x, y);
+      y *= m_faca;
+      ScratchVector tmp(cols());
+      m_opb->multTrans(x, tmp);
+      y += m_facb*tmp;
+    }
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      m_opa->addTo(m, fac*m_faca);
+      m_opb->addTo(m, fac*m_facb);
+    }
+  };
+
+
+  // opa * opb
+  class ProductOperator : public LinearOperator
+  {
+    std::shared_ptr<LinearOperator> m_opa, m_opb;
+  public:
+    ProductOperator (std::shared_ptr<LinearOperator> opa,
+                     std::shared_ptr<LinearOperator> opb)
+      : m_opa(opa), m_opb(opb) { }
+
+    size_t rows() const override { return m_opa->rows(); }
+    size_t cols() const override { return m_opb->cols(); }
+    void mult (VectorView<double> x, VectorView<double> y) const override
+    {
+      ScratchVector tmp(m_opb->rows());
+      m_opb->mult(x, tmp);
+      m_opa->mult(tmp, y);
+    }
+    void multTrans (VectorView<double> x, VectorView<double> y) const override
+    {
+      ScratchVector tmp(m_opa->cols());
+      m_opa->multTrans(x, tmp);
+      m_opb->multTrans(tmp, y);
+    }
+
+    void addTo (MatrixView<double> m, double fac) const override
+    {
+      // BlockDiag(J_i) * (A (x) I): block (i,j) is a_ij J_i
+      double facb = 1;
+      auto opb = m_opb;
+      ScaledOperator::Unscale(opb, facb);
+      if (m_opa->kind() == Kind::BlockDiagonal && opb->kind() == Kind::Kronecker)
+        {
+          auto blocks = static_cast<const BlockDiagonalOperator*>(m_opa.get());
+          auto kron = static_cast<const KroneckerOperator*>(opb.get());
+          size_t n = kron->blockSize();
+          auto & a = kron->factor();
+          bool fits = blocks->numBlocks() == a.rows();
+          for (size_t i = 0; i < blocks->numBlocks(); i++)
+            if (blocks->block(i)->rows() != n || blocks->block(i)->cols() != n)
+              fits = false;
+          if (fits)
+            {
+              for (size_t i = 0; i < a.rows(); i++)
+                for (size_t j = 0; j < a.cols(); j++)
+                  if (a(i,j) != 0.0)
+                    blocks->block(i)->addTo(m.rows(i*n, (i+1)*n).cols(j*n, (j+1)*n), fac*facb*a(i,j));
+              return;
+            }
+        }
+
+      // generic: one column at a time
+      Vector<> ej(m_opb->cols()), colb(m_opb->rows()), col(rows());
+      ej = 0.0;
+      for (size_t j = 0; j < cols(); j++)
+        {
+          ej(j) = 1;
+          m_opb->mult(ej, colb);
+          m_opa->mult(colb, col);
+          m.col(j) += fac * col;
+          ej(j) = 0;
+        }
+    }
+
+    std::shared_ptr<LinearOperator> inverse() const override
+    {
+      if (m_opa->rows() == m_opa->cols() && m_opb->rows() == m_opb->cols())
+        return std::make_shared<ProductOperator>(m_opb->inverse(), m_opa->inverse());
+      return LinearOperator::inverse();
+    }
+  };
+
+
+  // operator algebra, dropping zero operands on the way
+
+  inline std::shared_ptr<LinearOperator> operator* (double fac, std::shared_ptr<LinearOperator> op)
+  {
+    if (fac == 1.0 || op->isZero()) return op;
+    if (fac == 0.0) return std::make_shared<ZeroOperator>(op->rows(), op->cols());
+    return std::make_shared<ScaledOperator>(op, fac);
+  }
+
+  /*
+    faca D + facb BlockDiag(B_i) = BlockDiag(faca D_i + facb B_i) for a
+    diagonal D, e.g. I - tau J for a block diagonal J. Blocks shared in
+    the input (with equal diagonal parts) stay shared, so inverse() still
+    factors them once. nullptr if the operands do not have this form.
+  */
+  inline std::shared_ptr<LinearOperator> SumOnBlocks (std::shared_ptr<LinearOperator> opa, double faca,
+                                                      std::shared_ptr<LinearOperator> opb, double facb)
+  {
+    using Kind = LinearOperator::Kind;
+    ScaledOperator::Unscale(opa, faca);
+    ScaledOperator::Unscale(opb, facb);
+    if (opb->kind() == Kind::Diagonal)
+      {
+        std::swap(opa, opb);
+        std::swap(faca, facb);
+      }
+    if (opa->kind() != Kind::Diagonal || opb->kind() != Kind::BlockDiagonal)
+      return nullptr;
+    auto diag = static_cast<const DiagonalOperator*>(opa.get());
+    auto blocks = static_cast<const BlockDiagonalOperator*>(opb.get());
+    if (blocks->rows() != diag->rows() || blocks->cols() != diag->cols())
+      return nullptr;
+
+    size_t nb = blocks->numBlocks();
+    std::vector<size_t> first(nb+1, 0);
+    for (size_t i = 0; i < nb; i++)
+      {
+        if (blocks->block(i)->rows() != blocks->block(i)->cols())
+          return nullptr;
+        first[i+1] = first[i] + blocks->block(i)->rows();
+      }
+
+    auto d = diag->diag();
+    auto sameDiag = [&] (size_t i, size_t j)
+    {
+      for (size_t k = 0; k < first[i+1]-first[i]; k++)
+        if (d(first[i]+k) != d(first[j]+k)) return false;
+      return true;
+    };
+
+    std::vector<std::shared_ptr<LinearOperator>> sums(nb);
+    for (size_t i = 0; i < nb; i++)
+      {
+        for (size_t j = 0; j < i && !sums[i]; j++)
+          if (blocks->block(j) == blocks->block(i) && sameDiag(i, j))
+            sums[i] = sums[j];
+        if (sums[i]) continue;
+
+        Vector<> di(first[i+1]-first[i]);
+        for (size_t k = 0; k < di.size(); k++)
+          di(k) = faca * d(first[i]+k);
+        sums[i] = std::make_shared<SumOperator>(std::make_shared<DiagonalOperator>(std::move(di)),
+                                                blocks->block(i), 1, facb);
+      }
+    return std::make_shared<BlockDiagonalOperator>(std::move(sums));
+  }
+
+  inline std::shared_ptr<LinearOperator> operator+ (std::shared_ptr<LinearOperator> opa, std::shared_ptr<LinearOperator> opb)
+  {
+    if (opb->isZero()) return opa;
+    if (opa->isZero()) return opb;
+    if (auto sum = SumOnBlocks(opa, 1, opb, 1)) return sum;
+    return std::make_shared<SumOperator>(opa, opb, 1, 1);
+  }
+
+  inline std::shared_ptr<LinearOperator> operator- (std::shared_ptr<LinearOperator> opa, std::shared_ptr<LinearOperator> opb)
+  {
+    if (opb->isZero()) return opa;
+    if (opa->isZero()) return -1.0 * opb;
+    if (auto sum = SumOnBlocks(opa, 1, opb, -1)) return sum;
+    return std::make_shared<SumOperator>(opa, opb, 1, -1);
+  }
+
+  inline std::shared_ptr<LinearOperator> operator* (std::shared_ptr<LinearOperator> opa, std::shared_ptr<LinearOperator> opb)
+  {
+    if (opa->isZero() || opb->isZero())
+      return std::make_shared<ZeroOperator>(opa->rows(), opb->cols());
+    return std::make_shared<ProductOperator>(opa, opb);
+  }
+
+}
+
+#endif
@@ -1,18 +1,93 @@
 #ifndef NONLINFUNC_H
 #define NONLINFUNC_H
 
+#include <algorithm>
+#include <concepts>
 #include <cstddef>
+#include <map>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
 
 #include <vector.hpp>
 #include <matrix.hpp>
 #include "autodiff.hpp"
+#include "hyperdual.hpp"
+#include "linop.hpp"
+#include "parallel.hpp"
 
 namespace ASC_ode
 {
   using namespace nanoblas;
 
-  class NonlinearFunction
+  class Parameter 
+  {
+    double m_value;
+  public:
+    Parameter(double value) : m_value(value) {}
+    double get() const { return m_value; }
+    void set(double value) { m_value = value; }
+  };
+
+  /*
+    Positions of the Parameters in a gradient vector, built once for
+    addParamGradient, so that every node finds its own Parameter in O(1)
+    instead of scanning the whole list.
+  */
+  class ParamIndex
+  {
+    std::unordered_map<const Parameter*, size_t> m_pos;
+  public:
+    static constexpr size_t None = size_t(-1);
+
+    explicit ParamIndex (const std::vector<std::shared_ptr<Parameter>> & params)
+    {
+      for (size_t k = 0; k < params.size(); k++)
+        m_pos.emplace(params[k].get(), k);
+    }
+
+    // position of param, or None if its gradient is not requested
+    size_t find (const Parameter & param) const
+    {
+      auto it = m_pos.find(&param);
+      return it == m_pos.end() ? None : it->second;
+    }
+  };
+
+  /*
+    Copies of the nodes met while a function graph is cloned. A node that
+    is shared in the original (a Parameter, the ConstantFunction holding
+    the old state, the rhs inside an implicit equation) is copied once and
+    shared the same way in the clone.
+  */
+  class CloneMap
+  {
+    std::map<const void*, std::shared_ptr<void>> m_copies;
+  public:
+    template <typename T>
+    std::shared_ptr<T> find (const T * orig) const
+    {
+      auto it = m_copies.find(orig);
+      if (it == m_copies.end()) return nullptr;
+      return std::static_pointer_cast<T>(it->second);
+    }
+    template <typename T>
+    void insert (const T * orig, std::shared_ptr<T> copy) { m_copies[orig] = copy; }
+  };
+
+
+  /*
+    Evaluation is const: evaluate, evaluateDeriv and their variants do not
+    modify the function and may be called concurrently from several
+    threads. Temporaries come from per-thread ScratchVectors, never from
+    members. Mutable state (Parameter, ConstantFunction::set, a referenced
+    MassSpringSystem) must not change while other threads evaluate; give
+    every thread its own clone() instead.
+  */
+  class NonlinearFunction : public std::enable_shared_from_this<NonlinearFunction>
   {
   public:
     virtual ~NonlinearFunction() = default;
@@ -20,6 +95,154 @@ namespace ASC_ode
     virtual size_t dimF() const = 0;
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const = 0;
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // Jacobian as a structured operator, dense unless overridden
+    virtual std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const
+    {
+      auto jac = std::make_shared<DenseOperator>(dimF(), dimX());
+      evaluateDeriv(x, jac->matrix());
+      return jac;
+    }
+
+    /*
+      Value and Jacobian at the same point, for functions that share work
+      between both. Models with dense Jacobians override evaluateWithDeriv,
+      functions with structured Jacobians override evaluateWithDerivOp.
+    */
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    virtual std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const
+    {
+      auto jac = std::make_shared<DenseOperator>(dimF(), dimX());
+      evaluateWithDeriv(x, f, jac->matrix());
+      return jac;
+    }
+
+    /*
+      Derivative of f(x) with respect to the value of param, with x fixed.
+      The default zero is for functions without Parameters; leaves that
+      hold Parameters derive from ParametricFunction, which requires it,
+      and combinators pass it on by the chain rule.
+    */
+    virtual void evaluateParamDeriv (VectorView<double> x, const Parameter & param,
+                                     VectorView<double> dfdp) const
+    {
+      dfdp = 0.0;
+    }
+
+    // g = f'(x)^T w, the vector-Jacobian product of adjoint methods
+    virtual void evaluateDerivTrans (VectorView<double> x, VectorView<double> w,
+                                     VectorView<double> g) const
+    {
+      evaluateDerivOp(x)->multTrans(w, g);
+    }
+
+    /*
+      grad(k) += w . df/dp_k for all params at once. Combinators pass w
+      down the graph in reverse, so the cost does not grow with the number
+      of parameters. Functions without Parameters add nothing.
+    */
+    virtual void addParamGradient (VectorView<double> x, VectorView<double> w,
+                                   const ParamIndex & params,
+                                   VectorView<double> grad) const
+    { }
+
+    // deep copy of the graph below this node, keeping its internal sharing
+    std::shared_ptr<NonlinearFunction> clone() const
+    {
+      CloneMap map;
+      return cloneShared(map);
+    }
+
+    // copy through map, so shared nodes are copied once
+    std::shared_ptr<NonlinearFunction> cloneShared (CloneMap & map) const
+    {
+      if (auto copy = map.find(this))
+        return copy;
+      auto copy = cloneNode(map);
+      map.insert(this, copy);
+      return copy;
+    }
+
+  protected:
+    /*
+      Copy of this node, with its children copied through map. There is
+      no default: nodes with state return an independent copy, immutable
+      nodes opt in to being shared by returning shareInClone().
+    */
+    virtual std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const
+    {
+      throw std::logic_error(std::string("NonlinearFunction::clone: ") + typeid(*this).name()
+                             + " does not implement cloneNode");
+    }
+
+    // this node itself, for immutable nodes the clones may share
+    std::shared_ptr<NonlinearFunction> shareInClone () const
+    {
+      auto self = weak_from_this().lock();
+      if (!self)
+        throw std::logic_error(std::string("NonlinearFunction::clone: ") + typeid(*this).name()
+                               + " is not owned by a shared_ptr and cannot be shared");
+      return std::const_pointer_cast<NonlinearFunction>(self);
+    }
+  };
+
+
+  template <typename T>
+  std::shared_ptr<T> CloneShared (const std::shared_ptr<T> & func, CloneMap & map)
+  {
+    return std::dynamic_pointer_cast<T>(func->cloneShared(map));
+  }
+
+  // functor of a cloned adapter; functors referring to external state
+  // (e.g. MSS_Energy) provide clone() returning an independent copy
+  template <typename Functor>
+  Functor CloneFunctor (const Functor & func)
+  {
+    if constexpr (requires { { func.clone() } -> std::convertible_to<Functor>; })
+      return func.clone();
+    else
+      return func;
+  }
+
+
+  /*
+    Base of leaf functions that depend on Parameters of their own, e.g.
+    a model with a stiffness Parameter inside. evaluateParamDeriv has no
+    default here, so a missing derivative is a compile error instead of
+    a silent zero sensitivity.
+  */
+  class ParametricFunction : public NonlinearFunction
+  {
+    std::vector<std::shared_ptr<Parameter>> m_ownParams;
+  public:
+    ParametricFunction (std::vector<std::shared_ptr<Parameter>> params)
+      : m_ownParams(std::move(params)) { }
+
+    const std::vector<std::shared_ptr<Parameter>> & ownParameters() const { return m_ownParams; }
+
+    // df/dparam, zero for Parameters not in ownParameters()
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param,
+                             VectorView<double> dfdp) const override = 0;
+
+    // only the own Parameters contribute
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      ScratchVector dfdp(dimF());
+      for (auto & own : m_ownParams)
+        if (size_t k = params.find(*own); k != ParamIndex::None)
+          {
+            evaluateParamDeriv(x, *own, dfdp);
+            for (size_t i = 0; i < dfdp.size(); i++)
+              grad(k) += w(i) * dfdp(i);
+          }
+    }
   };
 
 
@@ -40,6 +263,19 @@ namespace ASC_ode
       df = 0.0;
       df.diag() = 1.0;
     }
+
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return std::make_shared<DiagonalOperator>(m_n, 1.0);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      f = x;
+      return evaluateDerivOp(x);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override { return shareInClone(); }
   };
 
 
@@ -52,6 +288,12 @@ namespace ASC_ode
     ConstantFunction(VectorView<double> val) : m_val(val) { }
     void set(VectorView<double> val) { m_val = val; }
     VectorView<double> get() const { return m_val; }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<ConstantFunction>(m_val);
+    }
+  public:
     size_t dimX() const override { return m_val.size(); }
     size_t dimF() const override { return m_val.size(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
@@ -62,6 +304,15 @@ namespace ASC_ode
     {
       df = 0.0;
     }
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return std::make_shared<ZeroOperator>(dimF(), dimX());
+    }
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      f = m_val;
+      return evaluateDerivOp(x);
+    }
   };
 
   
@@ -82,7 +333,7 @@ namespace ASC_ode
     {
       m_fa->evaluate(x, f);
       f *= m_faca;
-      Vector<> tmp(dimF());
+      ScratchVector tmp(dimF());
       m_fb->evaluate(x, tmp);
       f += m_facb*tmp;
     }
@@ -94,8 +345,219 @@ namespace ASC_ode
       m_fb->evaluateDeriv(x, tmp);
       df += m_facb*tmp;
     }
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return m_faca * m_fa->evaluateDerivOp(x) + m_facb * m_fb->evaluateDerivOp(x);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      auto jaca = m_fa->evaluateWithDerivOp(x, f);
+      f *= m_faca;
+      ScratchVector tmp(dimF());
+      auto jacb = m_fb->evaluateWithDerivOp(x, tmp);
+      f += m_facb*tmp;
+      return m_faca * jaca + m_facb * jacb;
+    }
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      m_fa->evaluateParamDeriv(x, param, dfdp);
+      dfdp *= m_faca;
+      ScratchVector tmp(dimF());
+      m_fb->evaluateParamDeriv(x, param, tmp);
+      dfdp += m_facb*tmp;
+    }
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      ScratchVector wa(dimF());
+      wa = m_faca * w;
+      m_fa->addParamGradient(x, wa, params, grad);
+      wa = m_facb * w;
+      m_fb->addParamGradient(x, wa, params, grad);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<SumFunction>(CloneShared(m_fa, map), CloneShared(m_fb, map), m_faca, m_facb);
+    }
   };
 
+  /*
+    Value and Jacobian of model.T_evaluate<T> in one forward pass.
+    Derivatives are seeded CHUNK columns at a time, so the AutoDiff
+    temporaries stay bounded for large dimensions; the values come out
+    of the first chunk.
+  */
+  template <size_t CHUNK, typename Model>
+  void EvaluateWithAutoDiff (const Model & model, VectorView<double> x,
+                             VectorView<double> f, MatrixView<double> df)
+  {
+    size_t dimx = x.size(), dimf = f.size();
+    Vector<AutoDiff<CHUNK>> x_ad(dimx);
+    Vector<AutoDiff<CHUNK>> f_ad(dimf);
+
+    for (size_t first = 0; first < dimx; first += CHUNK)
+      {
+        size_t next = std::min(first+CHUNK, dimx);
+        for (size_t j = 0; j < dimx; j++)
+          x_ad(j) = AutoDiff<CHUNK>(x(j));
+        for (size_t j = first; j < next; j++)
+          x_ad(j).deriv()[j-first] = 1;
+
+        model.template T_evaluate<AutoDiff<CHUNK>>(x_ad, f_ad);
+
+        if (first == 0)
+          for (size_t i = 0; i < dimf; i++)
+            f(i) = f_ad(i).value();
+        for (size_t i = 0; i < dimf; i++)
+          for (size_t j = first; j < next; j++)
+            df(i,j) = f_ad(i).deriv()[j-first];
+      }
+    if (dimx == 0)
+      model.template T_evaluate<double>(x, f);
+  }
+
+
+  /*
+    Hessian of a scalar function, given as a generic callable
+      [&]<typename T> (VectorView<T> x) -> T,
+    by second order AutoDiff. Variables are seeded CHUNK at a time:
+    diagonal blocks use HyperDual<CHUNK>, each pair of different blocks
+    HyperDual<2*CHUNK>. Returns the value of the function.
+  */
+  template <size_t CHUNK, typename Scalar>
+  double EvaluateHessianWithAutoDiff (Scalar && scalar, VectorView<double> x, MatrixView<double> hess)
+  {
+    size_t n = x.size();
+    size_t nblocks = (n + CHUNK-1) / CHUNK;
+    double value = scalar.template operator()<double>(x);
+
+    // slots offset..offset+CHUNK hold the variables of block b
+    auto seed = [&]<typename HD> (Vector<HD> & x_ad, size_t b, size_t offset)
+    {
+      for (size_t j = b*CHUNK; j < std::min(n, (b+1)*CHUNK); j++)
+        x_ad(j) = HD(x(j), offset + j-b*CHUNK);
+    };
+
+    for (size_t bi = 0; bi < nblocks; bi++)
+      {
+        size_t firsti = bi*CHUNK, nexti = std::min(n, firsti+CHUNK);
+        {
+          using HD = HyperDual<CHUNK>;
+          Vector<HD> x_ad(n);
+          for (size_t j = 0; j < n; j++)
+            x_ad(j) = HD(x(j));
+          seed(x_ad, bi, 0);
+          HD s = scalar.template operator()<HD>(x_ad);
+          for (size_t i = firsti; i < nexti; i++)
+            for (size_t j = firsti; j < nexti; j++)
+              hess(i,j) = s.hess(i-firsti, j-firsti);
+        }
+
+        for (size_t bj = bi+1; bj < nblocks; bj++)
+          {
+            using HD = HyperDual<2*CHUNK>;
+            size_t firstj = bj*CHUNK, nextj = std::min(n, firstj+CHUNK);
+            Vector<HD> x_ad(n);
+            for (size_t j = 0; j < n; j++)
+              x_ad(j) = HD(x(j));
+            seed(x_ad, bi, 0);
+            seed(x_ad, bj, CHUNK);
+            HD s = scalar.template operator()<HD>(x_ad);
+            for (size_t i = firsti; i < nexti; i++)
+              for (size_t j = firstj; j < nextj; j++)
+                hess(i,j) = hess(j,i) = s.hess(i-firsti, CHUNK+j-firstj);
+          }
+      }
+    return value;
+  }
+
+  // sum_i w_i f_i''(x) for a model with T_evaluate
+  template <size_t CHUNK, typename Model>
+  void EvaluateHessianWithAutoDiff (const Model & model, VectorView<double> x,
+                                    VectorView<double> w, MatrixView<double> hess)
+  {
+    EvaluateHessianWithAutoDiff<CHUNK>([&]<typename T> (VectorView<T> x_ad) -> T
+    {
+      Vector<T> f_ad(w.size());
+      model.template T_evaluate<T>(x_ad, f_ad);
+      T sum = 0;
+      for (size_t i = 0; i < w.size(); i++)
+        sum = sum + w(i) * f_ad(i);
+      return sum;
+    }, x, hess);
+  }
+
+
+  /*
+    NonlinearFunction from a functor providing
+      template <typename T> void T_evaluate (VectorView<T> x, VectorView<T> f) const;
+    with exact Jacobians by forward AutoDiff. Dimensions are given at
+    run time, derivatives are seeded in chunks of CHUNK columns.
+  */
+  template <typename Functor, size_t CHUNK = 8>
+  class DynAutoDiffFunction : public NonlinearFunction
+  {
+  protected:
+    Functor m_func;
+    size_t m_dimx, m_dimf;
+  public:
+    DynAutoDiffFunction (Functor func, size_t dimx, size_t dimf)
+      : m_func(std::move(func)), m_dimx(dimx), m_dimf(dimf) { }
+
+    const Functor & functor() const { return m_func; }
+
+    size_t dimX() const override { return m_dimx; }
+    size_t dimF() const override { return m_dimf; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_func.template T_evaluate<double>(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      Vector<> f(m_dimf);
+      evaluateWithDeriv(x, f, df);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      EvaluateWithAutoDiff<CHUNK>(m_func, x, f, df);
+    }
+
+    // Hessian of w . f, exact by second order AutoDiff
+    void evaluateHessian (VectorView<double> x, VectorView<double> w, MatrixView<double> hess) const
+    {
+      EvaluateHessianWithAutoDiff<CHUNK>(m_func, x, w, hess);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<DynAutoDiffFunction>(CloneFunctor(m_func), m_dimx, m_dimf);
+    }
+  };
+
+  // compile-time dimension N, a single pass for N <= 16
+  template <typename Functor, size_t N>
+  class AutoDiffFunction : public DynAutoDiffFunction<Functor, (N < 16 ? N : 16)>
+  {
+  public:
+    AutoDiffFunction (Functor func, size_t dimf = N)
+      : DynAutoDiffFunction<Functor, (N < 16 ? N : 16)>(std::move(func), N, dimf) { }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<AutoDiffFunction>(CloneFunctor(this->m_func), this->m_dimf);
+    }
+  };
+
+
   class PendulumAD : public NonlinearFunction
   {
   private:
@@ -115,16 +577,13 @@ namespace ASC_ode
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
-      Vector<AutoDiff<2>> x_ad(2);
-      Vector<AutoDiff<2>> f_ad(2);
-
-      x_ad(0) = Variable<0>(x(0));
-      x_ad(1) = Variable<1>(x(1));
-      T_evaluate<AutoDiff<2>>(x_ad, f_ad);
+      Vector<> f(2);
+      EvaluateWithAutoDiff<2>(*this, x, f, df);
+    }
 
-      for (size_t i = 0; i < 2; i++)
-        for (size_t j = 0; j < 2; j++)
-          df(i,j) = f_ad(i).deriv()[j];
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      EvaluateWithAutoDiff<2>(*this, x, f, df);
     }
 
     template <typename T>
@@ -133,6 +592,8 @@ namespace ASC_ode
       f(0) = x(1);
       f(1) = -m_gravity/m_length*sin(x(0));
     }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override { return shareInClone(); }
   };
 
 
@@ -146,14 +607,14 @@ namespace ASC_ode
     return std::make_shared<SumFunction>(fa, fb, 1, 1);
   }
 
-  class Parameter 
+  inline std::shared_ptr<Parameter> CloneShared (const std::shared_ptr<Parameter> & param, CloneMap & map)
   {
-    double m_value;
-  public:
-    Parameter(double value) : m_value(value) {}
-    double get() const { return m_value; }
-    void set(double value) { m_value = value; }
-  };
+    if (auto copy = map.find(param.get()))
+      return copy;
+    auto copy = std::make_shared<Parameter>(*param);
+    map.insert(param.get(), copy);
+    return copy;
+  }
 
   class ScaleFunction : public NonlinearFunction
   {
@@ -177,6 +638,55 @@ namespace ASC_ode
       m_fa->evaluateDeriv(x, df);
       df *= m_fac->get();
     }
+
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return m_fac->get() * m_fa->evaluateDerivOp(x);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      auto jac = m_fa->evaluateWithDerivOp(x, f);
+      f *= m_fac->get();
+      return m_fac->get() * jac;
+    }
+
+    // d(p fa)/dq = p dfa/dq, plus fa if q is p itself
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      m_fa->evaluateParamDeriv(x, param, dfdp);
+      dfdp *= m_fac->get();
+      if (&param == m_fac.get())
+        {
+          ScratchVector tmp(dimF());
+          m_fa->evaluate(x, tmp);
+          dfdp += tmp;
+        }
+    }
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      ScratchVector tmp(dimF());
+      tmp = m_fac->get() * w;
+      m_fa->addParamGradient(x, tmp, params, grad);
+      if (size_t k = params.find(*m_fac); k != ParamIndex::None)
+        {
+          m_fa->evaluate(x, tmp);
+          for (size_t i = 0; i < tmp.size(); i++)
+            grad(k) += w(i) * tmp(i);
+        }
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<ScaleFunction>(CloneShared(m_fa, map), CloneShared(m_fac, map));
+    }
   };
 
   inline auto operator* (std::shared_ptr<Parameter> parama, 
@@ -206,13 +716,13 @@ namespace ASC_ode
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
-      Vector<> tmp(m_fb->dimF());
+      ScratchVector tmp(m_fb->dimF());
       m_fb->evaluate (x, tmp);
       m_fa->evaluate (tmp, f);
     }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
-      Vector<> tmp(m_fb->dimF());
+      ScratchVector tmp(m_fb->dimF());
       m_fb->evaluate (x, tmp);
 
       Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
@@ -223,6 +733,49 @@ namespace ASC_ode
 
       df = jaca*jacb;
     }
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      ScratchVector tmp(m_fb->dimF());
+      m_fb->evaluate (x, tmp);
+      return m_fa->evaluateDerivOp(tmp) * m_fb->evaluateDerivOp(x);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      ScratchVector tmp(m_fb->dimF());
+      auto jacb = m_fb->evaluateWithDerivOp(x, tmp);
+      auto jaca = m_fa->evaluateWithDerivOp(tmp, f);
+      return jaca * jacb;
+    }
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      ScratchVector tmp(m_fb->dimF()), dtmp(m_fb->dimF());
+      m_fb->evaluate(x, tmp);
+      m_fa->evaluateParamDeriv(tmp, param, dfdp);
+      m_fb->evaluateParamDeriv(x, param, dtmp);
+      if (norm(dtmp) == 0.0) return;
+      ScratchVector prod(dimF());
+      m_fa->evaluateDerivOp(tmp)->mult(dtmp, prod);
+      dfdp += prod;
+    }
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      ScratchVector tmp(m_fb->dimF()), wb(m_fb->dimF());
+      m_fb->evaluate(x, tmp);
+      m_fa->addParamGradient(tmp, w, params, grad);
+      m_fa->evaluateDerivTrans(tmp, w, wb);
+      m_fb->addParamGradient(x, wb, params, grad);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<ComposeFunction>(CloneShared(m_fa, map), CloneShared(m_fb, map));
+    }
   };
   
   
@@ -258,6 +811,37 @@ namespace ASC_ode
       m_fa->evaluateDeriv(x.range(m_firstx, m_nextx),
                         df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
     }
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return std::make_shared<EmbeddedOperator>(m_fa->evaluateDerivOp(x.range(m_firstx, m_nextx)),
+                                                m_dimf, m_dimx, m_firstf, m_firstx);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      f = 0.0;
+      auto jac = m_fa->evaluateWithDerivOp(x.range(m_firstx, m_nextx), f.range(m_firstf, m_nextf));
+      return std::make_shared<EmbeddedOperator>(jac, m_dimf, m_dimx, m_firstf, m_firstx);
+    }
+    void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      dfdp = 0.0;
+      m_fa->evaluateParamDeriv(x.range(m_firstx, m_nextx), param, dfdp.range(m_firstf, m_nextf));
+    }
+    void addParamGradient (VectorView<double> x, VectorView<double> w,
+                           const ParamIndex & params,
+                           VectorView<double> grad) const override
+    {
+      m_fa->addParamGradient(x.range(m_firstx, m_nextx), w.range(m_firstf, m_nextf), params, grad);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<EmbedFunction>(CloneShared(m_fa, map), m_firstx, m_dimx, m_firstf, m_dimf);
+    }
   };
 
   
@@ -281,16 +865,45 @@ namespace ASC_ode
       df = 0.0;
       df.diag().range(m_first, m_next) = 1;
     }
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      Vector<> diag(m_size);
+      diag = 0.0;
+      diag.range(m_first, m_next) = 1;
+      return std::make_shared<DiagonalOperator>(std::move(diag));
+    }
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      evaluate(x, f);
+      return evaluateDerivOp(x);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override { return shareInClone(); }
   };
 
   
+  // num copies of func on consecutive blocks; with parallel set the
+  // blocks (e.g. Runge-Kutta stages) are evaluated on the thread pool.
+  // The pool does not nest: called from inside another ParallelFor task
+  // (a stage loop or an ensemble of steppers on the pool) the blocks run
+  // serially, so parallelize at one level only
   class MultipleFunc : public NonlinearFunction
   {
     std::shared_ptr<NonlinearFunction> func;
     size_t num, fdimx, fdimf;
+    bool parallel;
+
+    template <typename F>
+    void forEachBlock (F && f) const
+    {
+      if (parallel)
+        ParallelFor(num, f);
+      else
+        for (size_t i = 0; i < num; i++) f(i);
+    }
   public:
-    MultipleFunc (std::shared_ptr<NonlinearFunction> _func, int _num)
-      : func(_func), num(_num)
+    MultipleFunc (std::shared_ptr<NonlinearFunction> _func, int _num, bool _parallel = false)
+      : func(_func), num(_num), parallel(_parallel)
     {
       fdimx = func->dimX();
       fdimf = func->dimF();
@@ -300,16 +913,62 @@ namespace ASC_ode
     virtual size_t dimF() const override{ return num * fdimf; }
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
-      for (size_t i = 0; i < num; i++)
+      forEachBlock([&] (size_t i)
+      {
         func->evaluate(x.range(i*fdimx, (i+1)*fdimx),
                        f.range(i*fdimf, (i+1)*fdimf));
+      });
     }
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
-      for (size_t i = 0; i < num; i++)
+      forEachBlock([&] (size_t i)
+      {
         func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx),
                             df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
+      });
+    }
+    virtual std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      std::vector<std::shared_ptr<LinearOperator>> blocks(num);
+      forEachBlock([&] (size_t i)
+      {
+        blocks[i] = func->evaluateDerivOp(x.range(i*fdimx, (i+1)*fdimx));
+      });
+      return std::make_shared<BlockDiagonalOperator>(std::move(blocks));
+    }
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+    virtual std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      std::vector<std::shared_ptr<LinearOperator>> blocks(num);
+      forEachBlock([&] (size_t i)
+      {
+        blocks[i] = func->evaluateWithDerivOp(x.range(i*fdimx, (i+1)*fdimx),
+                                              f.range(i*fdimf, (i+1)*fdimf));
+      });
+      return std::make_shared<BlockDiagonalOperator>(std::move(blocks));
+    }
+    virtual void evaluateParamDeriv (VectorView<double> x, const Parameter & param, VectorView<double> dfdp) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->evaluateParamDeriv(x.range(i*fdimx, (i+1)*fdimx), param,
+                                 dfdp.range(i*fdimf, (i+1)*fdimf));
+    }
+    virtual void addParamGradient (VectorView<double> x, VectorView<double> w,
+                                   const ParamIndex & params,
+                                   VectorView<double> grad) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        func->addParamGradient(x.range(i*fdimx, (i+1)*fdimx), w.range(i*fdimf, (i+1)*fdimf),
+                               params, grad);
+    }
+  protected:
+    virtual std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<MultipleFunc>(CloneShared(func, map), num, parallel);
     }
   };
 
@@ -337,6 +996,17 @@ namespace ASC_ode
         for (size_t j = 0; j < m_a.cols(); j++)
           df.rows(i*m_n, (i+1)*m_n).cols(j*m_n, (j+1)*m_n).diag() = m_a(i,j);
     }
+    virtual std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      return std::make_shared<KroneckerOperator>(m_a, m_n);
+    }
+    virtual std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      evaluate(x, f);
+      return evaluateDerivOp(x);
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override { return shareInClone(); }
   };
 
 }
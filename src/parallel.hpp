@@ -0,0 +1,165 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ASC_ode
+{
+
+  /*
+    A persistent pool of worker threads for fine-grained loops
+    (colour groups, Runge-Kutta stages, extrapolation sequences).
+    The calling thread takes part in the work. Calls from inside a task,
+    or while the pool is busy with another loop, run serially, so nested
+    ParallelFor never deadlocks.
+  */
+  class ThreadPool
+  {
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::mutex m_busy;
+    std::condition_variable m_start, m_done;
+    const std::function<void(size_t)> * m_task = nullptr;
+    size_t m_n = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_running = 0;
+    size_t m_generation = 0;
+    bool m_stop = false;
+    std::exception_ptr m_error;
+
+    static bool & insideTask()
+    {
+      thread_local bool inside = false;
+      return inside;
+    }
+
+    void work()
+    {
+      bool outer = insideTask();
+      insideTask() = true;
+      for (size_t i = m_next++; i < m_n; i = m_next++)
+        {
+          try
+            {
+              (*m_task)(i);
+            }
+          catch (...)
+            {
+              std::lock_guard<std::mutex> guard(m_mutex);
+              if (!m_error) m_error = std::current_exception();
+            }
+        }
+      insideTask() = outer;
+    }
+
+    void start (size_t numthreads)
+    {
+      m_stop = false;
+      for (size_t i = 1; i < numthreads; i++)
+        m_workers.emplace_back([this, seen = m_generation]() mutable
+        {
+          while (true)
+            {
+              {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&]() { return m_stop || m_generation != seen; });
+                if (m_stop) return;
+                seen = m_generation;
+              }
+              work();
+              {
+                std::lock_guard<std::mutex> guard(m_mutex);
+                if (--m_running == 0) m_done.notify_all();
+              }
+            }
+        });
+    }
+
+    void stop ()
+    {
+      {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_stop = true;
+      }
+      m_start.notify_all();
+      for (auto & w : m_workers)
+        w.join();
+      m_workers.clear();
+    }
+
+  public:
+    ThreadPool (size_t numthreads = std::max(1u, std::thread::hardware_concurrency()))
+    {
+      start(numthreads);
+    }
+
+    ~ThreadPool() { stop(); }
+
+    ThreadPool (const ThreadPool &) = delete;
+    ThreadPool & operator= (const ThreadPool &) = delete;
+
+    size_t numThreads() const { return m_workers.size()+1; }
+
+    // restart with numthreads threads (the caller included), e.g. for
+    // speedup measurements; waits for a running loop to finish, so it
+    // must not be called from inside a task
+    void setNumThreads (size_t numthreads)
+    {
+      std::lock_guard<std::mutex> busy(m_busy);
+      stop();
+      start(std::max<size_t>(numthreads, 1));
+    }
+
+    void parallelFor (size_t n, const std::function<void(size_t)> & task)
+    {
+      std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+      if (n < 2 || m_workers.empty() || insideTask() || !busy.owns_lock())
+        {
+          for (size_t i = 0; i < n; i++)
+            task(i);
+          return;
+        }
+
+      {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_task = &task;
+        m_n = n;
+        m_next = 0;
+        m_error = nullptr;
+        m_running = m_workers.size();
+        m_generation++;
+      }
+      m_start.notify_all();
+
+      work();
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_done.wait(lock, [&]() { return m_running == 0; });
+      m_task = nullptr;
+      if (m_error) std::rethrow_exception(m_error);
+    }
+
+    static ThreadPool & global()
+    {
+      static ThreadPool pool;
+      return pool;
+    }
+  };
+
+
+  inline void ParallelFor (size_t n, const std::function<void(size_t)> & task)
+  {
+    ThreadPool::global().parallelFor(n, task);
+  }
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef PREDICTOR_HPP
+#define PREDICTOR_HPP
+
+#include <cmath>
+#include <cstddef>
+
+#include <vector.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  /*
+    Initial guess for the stage derivatives K_i of an implicit Runge-Kutta
+    step: the polynomial interpolating the previous step's K_j at its nodes
+    c_j (for collocation methods the derivative of the collocation
+    polynomial) is extrapolated to the new stage times t_n + c_i tau.
+    It is used only if the step starts from the end state of the previous
+    one; otherwise, or for coinciding nodes, the guess is K = 0.
+  */
+  class StagePredictor
+  {
+    Vector<> m_c;
+    size_t m_stages, m_n;
+    bool m_distinct = true;
+    bool m_valid = false;
+    double m_tau = 0;
+    Vector<> m_k, m_yend, m_l;
+
+  public:
+    StagePredictor (VectorView<double> c, size_t n)
+      : m_c(c.size()), m_stages(c.size()), m_n(n),
+        m_k(m_stages*n), m_yend(n), m_l(m_stages)
+    {
+      m_c = c;
+      for (size_t i = 0; i < m_stages; i++)
+        for (size_t j = 0; j < i; j++)
+          if (m_c(i) == m_c(j)) m_distinct = false;
+    }
+
+    // forget the previous step, e.g. when the rhs changed
+    void reset() { m_valid = false; }
+
+    // k = predicted stages of a step of size tau from y; false if k = 0
+    bool predict (double tau, VectorView<double> y, VectorView<double> k)
+    {
+      bool usable = m_valid && m_distinct;
+      for (size_t l = 0; usable && l < m_n; l++)
+        if (y(l) != m_yend(l)) usable = false;
+      if (!usable)
+        {
+          k = 0.0;
+          return false;
+        }
+
+      // new stage i at 1 + c_i tau / tau_old in units of the previous step
+      double ratio = tau / m_tau;
+      for (size_t i = 0; i < m_stages; i++)
+        {
+          double theta = 1 + m_c(i) * ratio;
+          for (size_t j = 0; j < m_stages; j++)
+            {
+              double lj = 1;
+              for (size_t m = 0; m < m_stages; m++)
+                if (m != j)
+                  lj *= (theta - m_c(m)) / (m_c(j) - m_c(m));
+              m_l(j) = lj;
+            }
+          auto ki = k.range(i*m_n, (i+1)*m_n);
+          ki = 0.0;
+          for (size_t j = 0; j < m_stages; j++)
+            ki += m_l(j) * m_k.range(j*m_n, (j+1)*m_n);
+        }
+      return true;
+    }
+
+    // converged stages k of a step of size tau which ended in yend
+    void store (double tau, VectorView<double> k, VectorView<double> yend)
+    {
+      m_tau = tau;
+      m_k = k;
+      m_yend = yend;
+      m_valid = true;
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SCRATCH_HPP
+#define SCRATCH_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <vector.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  /*
+    Temporary vector taken from a per-thread stack of buffers.
+    Nested evaluations use the next level of the stack, so a buffer is
+    never shared between threads or overwritten by an inner call, and
+    repeated evaluations do not allocate once the buffers are large enough.
+  */
+  class ScratchVector : public VectorView<double>
+  {
+    struct Stack
+    {
+      std::vector<std::unique_ptr<Vector<double>>> levels;
+      size_t depth = 0;
+    };
+
+    static Stack & stack()
+    {
+      thread_local Stack s;
+      return s;
+    }
+
+    static VectorView<double> acquire (size_t n)
+    {
+      auto & s = stack();
+      if (s.depth == s.levels.size())
+        s.levels.push_back(nullptr);
+      auto & buffer = s.levels[s.depth++];
+      if (!buffer || buffer->size() < n)
+        buffer = std::make_unique<Vector<double>>(n);
+      return buffer->range(0, n);
+    }
+
+  public:
+    ScratchVector (size_t n) : VectorView<double>(acquire(n)) { }
+    ~ScratchVector() { stack().depth--; }
+
+    ScratchVector (const ScratchVector &) = delete;
+    ScratchVector & operator= (const ScratchVector &) = delete;
+    using VectorView<double>::operator=;
+  };
+
+}
+
+#endif
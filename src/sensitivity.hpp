@@ -0,0 +1,150 @@
+#ifndef SENSITIVITY_HPP
+#define SENSITIVITY_HPP
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "timestepper.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Right hand side of the forward sensitivity system for y' = f(y; p):
+      y' = f(y),   s_k' = f_y(y) s_k + f_{p_k}(y),   k = 0..np-1,
+    on the stacked vector (y, s_0, ..., s_{np-1}). The Jacobian f_y is
+    evaluated once per call and applied to all s_k.
+
+    The Jacobian returned is block diagonal with the same f_y in every
+    block; the coupling f_yy s_k is dropped. Newton iterations on implicit
+    steps then solve the state and the sensitivities staggered, with one
+    factorization of I - tau f_y shared by all blocks.
+  */
+  class SensitivityFunction : public NonlinearFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_rhs;
+    std::vector<std::shared_ptr<Parameter>> m_params;
+    size_t m_n;
+  public:
+    SensitivityFunction (std::shared_ptr<NonlinearFunction> rhs,
+                         std::vector<std::shared_ptr<Parameter>> params)
+      : m_rhs(rhs), m_params(std::move(params)), m_n(rhs->dimX()) { }
+
+    size_t numParams() const { return m_params.size(); }
+
+    size_t dimX() const override { return m_n * (1+m_params.size()); }
+    size_t dimF() const override { return dimX(); }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      evaluateWithDerivOp(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      evaluateDerivOp(x)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      auto jac = m_rhs->evaluateDerivOp(x.range(0, m_n));
+      return std::make_shared<BlockDiagonalOperator>(
+               std::vector<std::shared_ptr<LinearOperator>>(1+m_params.size(), jac));
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      auto y = x.range(0, m_n);
+      auto jac = m_rhs->evaluateWithDerivOp(y, f.range(0, m_n));
+      ScratchVector dfdp(m_n);
+      for (size_t k = 0; k < m_params.size(); k++)
+        {
+          auto fk = f.range((k+1)*m_n, (k+2)*m_n);
+          jac->mult(x.range((k+1)*m_n, (k+2)*m_n), fk);
+          m_rhs->evaluateParamDeriv(y, *m_params[k], dfdp);
+          fk += dfdp;
+        }
+      return std::make_shared<BlockDiagonalOperator>(
+               std::vector<std::shared_ptr<LinearOperator>>(1+m_params.size(), jac));
+    }
+
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      std::vector<std::shared_ptr<Parameter>> params;
+      for (auto & param : m_params)
+        params.push_back(CloneShared(param, map));
+      return std::make_shared<SensitivityFunction>(CloneShared(m_rhs, map), std::move(params));
+    }
+  };
+
+
+  /*
+    Forward sensitivities dy/dp_k along with the state, for any time
+    stepper: makeStepper builds the stepper on the SensitivityFunction,
+    e.g.
+      SensitivityStepper sens(rhs, { k, c },
+        [](auto f) { return std::make_unique<ImplicitEuler>(f); });
+    DoStep advances y as the stepper would and the sensitivities with it;
+    they start at zero unless set by setSensitivity.
+  */
+  class SensitivityStepper : public TimeStepper
+  {
+  public:
+    using StepperFactory = std::function<std::unique_ptr<TimeStepper>(std::shared_ptr<NonlinearFunction>)>;
+
+  private:
+    std::vector<std::shared_ptr<Parameter>> m_params;
+    std::shared_ptr<SensitivityFunction> m_sens;
+    StepperFactory m_make;
+    std::unique_ptr<TimeStepper> m_stepper;
+    size_t m_n;
+    Vector<> m_ys;
+
+  public:
+    SensitivityStepper (std::shared_ptr<NonlinearFunction> rhs,
+                        std::vector<std::shared_ptr<Parameter>> params,
+                        StepperFactory makeStepper)
+      : TimeStepper(rhs), m_params(params),
+        m_sens(std::make_shared<SensitivityFunction>(rhs, std::move(params))),
+        m_make(std::move(makeStepper)), m_stepper(m_make(m_sens)),
+        m_n(rhs->dimX()), m_ys(m_sens->dimX())
+    {
+      m_ys = 0.0;
+    }
+
+    size_t numParams() const { return m_params.size(); }
+
+    // dy/dp_k at the current time
+    VectorView<double> sensitivity (size_t k) const { return m_ys.range((k+1)*m_n, (k+2)*m_n); }
+    void setSensitivity (size_t k, VectorView<double> s) { m_ys.range((k+1)*m_n, (k+2)*m_n) = s; }
+
+    void DoStep (double tau, VectorView<double> y) override
+    {
+      m_ys.range(0, m_n) = y;
+      m_stepper->DoStep(tau, m_ys);
+      y = m_ys.range(0, m_n);
+    }
+
+    std::unique_ptr<TimeStepper> clone() const override
+    {
+      CloneMap map;
+      auto rhs = CloneShared(m_rhs, map);
+      std::vector<std::shared_ptr<Parameter>> params;
+      for (auto & param : m_params)
+        params.push_back(CloneShared(param, map));
+      auto copy = std::make_unique<SensitivityStepper>(rhs, std::move(params), m_make);
+      copy->m_ys = m_ys;
+      return copy;
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <type_traits>
+
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define ASC_ODE_HAVE_SIMD
+#endif
+
+namespace ASC_ode
+{
+
+  /*
+    Vector kernels for short arrays of derivatives. For double they use
+    std::experimental::simd with the widest registers the target allows
+    (SSE2 by default, AVX2 / AVX-512 with -march=native) and a scalar
+    tail; other types (nested AutoDiff) take the plain loop.
+    The size is usually a compile time constant, so the loops unroll.
+  */
+
+#ifdef ASC_ODE_HAVE_SIMD
+  namespace stdx = std::experimental;
+
+  template <typename T>
+  constexpr bool UseSimd = std::is_same_v<T, double>;
+
+  template <typename T>
+  using SimdT = stdx::native_simd<T>;
+#else
+  template <typename T>
+  constexpr bool UseSimd = false;
+#endif
+
+
+  // alignment of one register of T, alignof(T) without simd
+  template <typename T>
+  consteval size_t SimdAlignment ()
+  {
+#ifdef ASC_ODE_HAVE_SIMD
+    if constexpr (UseSimd<T>)
+      return stdx::memory_alignment_v<SimdT<T>>;
+#endif
+    return alignof(T);
+  }
+
+  // one register (V = SimdT<T>) or one element (V = T) at p;
+  // Aligned: p is aligned to SimdAlignment<T>() (vector_aligned)
+  template <typename V, bool Aligned = false, typename T>
+  inline V SimdLoad (const T * p)
+  {
+    if constexpr (std::is_same_v<V, T>)
+      return *p;
+#ifdef ASC_ODE_HAVE_SIMD
+    else if constexpr (Aligned)
+      return V(p, stdx::vector_aligned);
+    else
+      return V(p, stdx::element_aligned);
+#endif
+  }
+
+  template <bool Aligned = false, typename V, typename T>
+  inline void SimdStore (const V & v, T * p)
+  {
+    if constexpr (std::is_same_v<V, T>)
+      *p = v;
+#ifdef ASC_ODE_HAVE_SIMD
+    else if constexpr (Aligned)
+      v.copy_to(p, stdx::vector_aligned);
+    else
+      v.copy_to(p, stdx::element_aligned);
+#endif
+  }
+
+
+  // f.template operator()<V>(i) for i = 0..n, a register V = SimdT<T>
+  // (lanes i..i+size) at a time and V = T for the tail
+  template <typename T, typename F>
+  inline void SimdLoop (size_t n, F && f)
+  {
+    size_t i = 0;
+#ifdef ASC_ODE_HAVE_SIMD
+    if constexpr (UseSimd<T>)
+      for (size_t nv = n - n % SimdT<T>::size(); i < nv; i += SimdT<T>::size())
+        f.template operator()<SimdT<T>>(i);
+#endif
+    for ( ; i < n; i++)
+      f.template operator()<T>(i);
+  }
+
+  // p[i] = f.template operator()<V>(i); registers start at multiples of
+  // their width, so an aligned p gives aligned stores
+  template <bool Aligned = false, typename T, typename F>
+  inline void SimdFill (size_t n, T * p, F && f)
+  {
+    SimdLoop<T>(n, [&]<typename V> (size_t i) { SimdStore<Aligned>(f.template operator()<V>(i), p+i); });
+  }
+
+  // lanes a(i), a(i+1), ... of an indexable a
+  template <typename V, typename A>
+  inline V SimdGather (const A & a, size_t i)
+  {
+    if constexpr (std::is_arithmetic_v<V>)
+      return a(i);
+#ifdef ASC_ODE_HAVE_SIMD
+    else
+      return V([&](auto lane) { return a(i+lane); });
+#endif
+  }
+
+  template <typename V, typename A>
+  inline void SimdScatter (const V & v, A && a, size_t i)
+  {
+    if constexpr (std::is_arithmetic_v<V>)
+      a(i) = v;
+#ifdef ASC_ODE_HAVE_SIMD
+    else
+      for (size_t lane = 0; lane < V::size(); lane++)
+        a(i+lane) = v[lane];
+#endif
+  }
+
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef SPARSEAUTODIFF_HPP
+#define SPARSEAUTODIFF_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Forward AutoDiff that stores only the nonzero derivatives, as sorted
+    (index, value) pairs. Up to K pairs live inside the object, more go
+    to the heap. An operation costs O(nonzeros of its arguments), so for
+    locally coupled models (springs, stencils) the whole Jacobian costs
+    O(nnz) instead of O(n^2).
+  */
+  template <size_t K = 8>
+  class SparseAutoDiff
+  {
+    double m_val;
+    uint32_t m_nnz = 0;
+    std::array<uint32_t, K> m_idx {};
+    std::array<double, K> m_der {};
+    std::vector<uint32_t> m_heapidx;
+    std::vector<double> m_heapder;
+
+    bool onHeap() const { return !m_heapidx.empty(); }
+
+    void reserve (size_t n)
+    {
+      if (n > K && m_heapidx.size() < n)
+        {
+          m_heapidx.resize(n);
+          m_heapder.resize(n);
+        }
+    }
+
+    uint32_t * idx() { return onHeap() ? m_heapidx.data() : m_idx.data(); }
+    double * der() { return onHeap() ? m_heapder.data() : m_der.data(); }
+
+  public:
+    SparseAutoDiff (double v = 0) : m_val(v) { }
+
+    // the independent variable number index
+    SparseAutoDiff (double v, uint32_t index) : m_val(v), m_nnz(1)
+    {
+      m_idx[0] = index;
+      m_der[0] = 1;
+    }
+
+    double value() const { return m_val; }
+    size_t nnz() const { return m_nnz; }
+    const uint32_t * indices() const { return onHeap() ? m_heapidx.data() : m_idx.data(); }
+    const double * derivs() const { return onHeap() ? m_heapder.data() : m_der.data(); }
+
+    // r = (val, fa a')
+    static SparseAutoDiff Chain (double val, const SparseAutoDiff & a, double fa)
+    {
+      SparseAutoDiff r(val);
+      r.reserve(a.m_nnz);
+      const uint32_t * ai = a.indices();
+      const double * ad = a.derivs();
+      uint32_t * ri = r.idx();
+      double * rd = r.der();
+      for (size_t k = 0; k < a.m_nnz; k++)
+        {
+          ri[k] = ai[k];
+          rd[k] = fa * ad[k];
+        }
+      r.m_nnz = a.m_nnz;
+      return r;
+    }
+
+    // r = (val, fa a' + fb b'), merging the sorted index lists
+    static SparseAutoDiff Chain (double val, const SparseAutoDiff & a, double fa,
+                                 const SparseAutoDiff & b, double fb)
+    {
+      SparseAutoDiff r(val);
+      r.reserve(a.m_nnz + b.m_nnz);
+      const uint32_t * ai = a.indices(), * bi = b.indices();
+      const double * ad = a.derivs(), * bd = b.derivs();
+      uint32_t * ri = r.idx();
+      double * rd = r.der();
+      size_t i = 0, j = 0, n = 0;
+      while (i < a.m_nnz && j < b.m_nnz)
+        {
+          if (ai[i] < bi[j])
+            { ri[n] = ai[i]; rd[n++] = fa * ad[i++]; }
+          else if (bi[j] < ai[i])
+            { ri[n] = bi[j]; rd[n++] = fb * bd[j++]; }
+          else
+            { ri[n] = ai[i]; rd[n++] = fa * ad[i++] + fb * bd[j++]; }
+        }
+      for ( ; i < a.m_nnz; i++)
+        { ri[n] = ai[i]; rd[n++] = fa * ad[i]; }
+      for ( ; j < b.m_nnz; j++)
+        { ri[n] = bi[j]; rd[n++] = fb * bd[j]; }
+      r.m_nnz = n;
+      return r;
+    }
+  };
+
+
+  template <size_t K>
+  std::ostream & operator<< (std::ostream & os, const SparseAutoDiff<K> & a)
+  {
+    os << "Value: " << a.value() << ", Deriv: [";
+    for (size_t k = 0; k < a.nnz(); k++)
+      os << (k ? ", " : "") << a.indices()[k] << ": " << a.derivs()[k];
+    return os << "]";
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> operator+ (const SparseAutoDiff<K> & a, const SparseAutoDiff<K> & b)
+  { return SparseAutoDiff<K>::Chain(a.value()+b.value(), a, 1, b, 1); }
+
+  template <size_t K>
+  SparseAutoDiff<K> operator- (const SparseAutoDiff<K> & a, const SparseAutoDiff<K> & b)
+  { return SparseAutoDiff<K>::Chain(a.value()-b.value(), a, 1, b, -1); }
+
+  template <size_t K>
+  SparseAutoDiff<K> operator* (const SparseAutoDiff<K> & a, const SparseAutoDiff<K> & b)
+  { return SparseAutoDiff<K>::Chain(a.value()*b.value(), a, b.value(), b, a.value()); }
+
+  template <size_t K>
+  SparseAutoDiff<K> operator/ (const SparseAutoDiff<K> & a, const SparseAutoDiff<K> & b)
+  {
+    double inv = 1 / b.value();
+    double quot = a.value() * inv;
+    return SparseAutoDiff<K>::Chain(quot, a, inv, b, -quot * inv);
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> operator- (const SparseAutoDiff<K> & a)
+  { return SparseAutoDiff<K>::Chain(-a.value(), a, -1); }
+
+  // constants only touch the value
+
+  template <size_t K>
+  SparseAutoDiff<K> operator+ (const SparseAutoDiff<K> & a, double b) { return SparseAutoDiff<K>::Chain(a.value()+b, a, 1); }
+  template <size_t K>
+  SparseAutoDiff<K> operator+ (double a, const SparseAutoDiff<K> & b) { return SparseAutoDiff<K>::Chain(a+b.value(), b, 1); }
+  template <size_t K>
+  SparseAutoDiff<K> operator- (const SparseAutoDiff<K> & a, double b) { return SparseAutoDiff<K>::Chain(a.value()-b, a, 1); }
+  template <size_t K>
+  SparseAutoDiff<K> operator- (double a, const SparseAutoDiff<K> & b) { return SparseAutoDiff<K>::Chain(a-b.value(), b, -1); }
+  template <size_t K>
+  SparseAutoDiff<K> operator* (const SparseAutoDiff<K> & a, double b) { return SparseAutoDiff<K>::Chain(a.value()*b, a, b); }
+  template <size_t K>
+  SparseAutoDiff<K> operator* (double a, const SparseAutoDiff<K> & b) { return SparseAutoDiff<K>::Chain(a*b.value(), b, a); }
+  template <size_t K>
+  SparseAutoDiff<K> operator/ (const SparseAutoDiff<K> & a, double b) { return SparseAutoDiff<K>::Chain(a.value()/b, a, 1/b); }
+  template <size_t K>
+  SparseAutoDiff<K> operator/ (double a, const SparseAutoDiff<K> & b)
+  {
+    double quot = a / b.value();
+    return SparseAutoDiff<K>::Chain(quot, b, -quot / b.value());
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> sin (const SparseAutoDiff<K> & a)
+  { return SparseAutoDiff<K>::Chain(std::sin(a.value()), a, std::cos(a.value())); }
+
+  template <size_t K>
+  SparseAutoDiff<K> cos (const SparseAutoDiff<K> & a)
+  { return SparseAutoDiff<K>::Chain(std::cos(a.value()), a, -std::sin(a.value())); }
+
+  template <size_t K>
+  SparseAutoDiff<K> tan (const SparseAutoDiff<K> & a)
+  {
+    double t = std::tan(a.value());
+    return SparseAutoDiff<K>::Chain(t, a, 1 + t*t);
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> exp (const SparseAutoDiff<K> & a)
+  {
+    double e = std::exp(a.value());
+    return SparseAutoDiff<K>::Chain(e, a, e);
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> log (const SparseAutoDiff<K> & a)
+  { return SparseAutoDiff<K>::Chain(std::log(a.value()), a, 1 / a.value()); }
+
+  template <size_t K>
+  SparseAutoDiff<K> sqrt (const SparseAutoDiff<K> & a)
+  {
+    double r = std::sqrt(a.value());
+    return SparseAutoDiff<K>::Chain(r, a, 0.5 / r);
+  }
+
+  template <size_t K>
+  SparseAutoDiff<K> pow (const SparseAutoDiff<K> & a, double exp)
+  { return SparseAutoDiff<K>::Chain(std::pow(a.value(), exp), a, exp * std::pow(a.value(), exp-1)); }
+
+  template <size_t K>
+  SparseAutoDiff<K> pow (double a, const SparseAutoDiff<K> & exp)
+  {
+    double p = std::pow(a, exp.value());
+    return SparseAutoDiff<K>::Chain(p, exp, p * std::log(a));
+  }
+
+
+  /*
+    NonlinearFunction from a functor with
+      template <typename T> void T_evaluate (VectorView<T> x, VectorView<T> f) const;
+    whose Jacobian is sparse. One evaluation with SparseAutoDiff gives
+    the Jacobian as a SparseOperator; the pattern may change between
+    calls. K is the number of nonzeros per entry kept without allocation.
+  */
+  template <typename Functor, size_t K = 8>
+  class SparseAutoDiffFunction : public NonlinearFunction
+  {
+    Functor m_func;
+    size_t m_dimx, m_dimf;
+  public:
+    SparseAutoDiffFunction (Functor func, size_t dimx, size_t dimf)
+      : m_func(std::move(func)), m_dimx(dimx), m_dimf(dimf) { }
+
+    const Functor & functor() const { return m_func; }
+
+    size_t dimX() const override { return m_dimx; }
+    size_t dimF() const override { return m_dimf; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_func.template T_evaluate<double>(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      evaluateDerivOp(x)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateDerivOp (VectorView<double> x) const override
+    {
+      Vector<> f(m_dimf);
+      return evaluateWithDerivOp(x, f);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      evaluateWithDerivOp(x, f)->assemble(df);
+    }
+
+    std::shared_ptr<LinearOperator> evaluateWithDerivOp (VectorView<double> x, VectorView<double> f) const override
+    {
+      Vector<SparseAutoDiff<K>> x_ad(m_dimx), f_ad(m_dimf);
+      for (size_t j = 0; j < m_dimx; j++)
+        x_ad(j) = SparseAutoDiff<K>(x(j), uint32_t(j));
+
+      m_func.template T_evaluate<SparseAutoDiff<K>>(x_ad, f_ad);
+
+      std::vector<size_t> firstinrow(m_dimf+1, 0), colind;
+      for (size_t i = 0; i < m_dimf; i++)
+        {
+          f(i) = f_ad(i).value();
+          colind.insert(colind.end(), f_ad(i).indices(), f_ad(i).indices()+f_ad(i).nnz());
+          firstinrow[i+1] = colind.size();
+        }
+
+      auto jac = std::make_shared<SparseOperator>(m_dimf, m_dimx, std::move(firstinrow), std::move(colind));
+      for (size_t i = 0, k = 0; i < m_dimf; i++)
+        for (size_t l = 0; l < f_ad(i).nnz(); l++, k++)
+          jac->value(k) = f_ad(i).derivs()[l];
+      return jac;
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<SparseAutoDiffFunction>(CloneFunctor(m_func), m_dimx, m_dimf);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef TABLEAU_HPP
+#define TABLEAU_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+#include "legendre.hpp"
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+  using Complex = std::complex<double>;
+
+  /*
+    Butcher tableaus of the collocation type methods, computed stably:
+    nodes by Golub-Welsch (eigenvalues of the Jacobi matrix of the
+    orthogonal polynomials) and coefficients a_ij = int_0^c_i l_j,
+    b_j = int_0^1 l_j by Gauss quadrature of the Lagrange polynomials l_j,
+    instead of inverting the Vandermonde matrix of the nodes.
+  */
+
+
+  // eigenvalues of the symmetric tridiagonal matrix with diagonal d and
+  // off-diagonal e(i) = m(i,i+1), by implicit QL (Numerical Recipes, tqli);
+  // d is overwritten by the eigenvalues in ascending order, e is destroyed
+  inline void TridiagonalEigenvalues (VectorView<double> d, VectorView<double> e)
+  {
+    int n = d.size();
+    if (n == 0) return;
+    e(n-1) = 0;
+    for (int l = 0; l < n; l++)
+      {
+        int iter = 0, m;
+        do
+          {
+            for (m = l; m < n-1; m++)
+              if (std::abs(e(m)) <= 1e-16 * (std::abs(d(m)) + std::abs(d(m+1))))
+                break;
+            if (m != l)
+              {
+                if (iter++ == 60)
+                  throw std::domain_error("TridiagonalEigenvalues did not converge");
+                double g = (d(l+1) - d(l)) / (2.0 * e(l));
+                double r = std::hypot(g, 1.0);
+                g = d(m) - d(l) + e(l) / (g + std::copysign(r, g));
+                double s = 1, c = 1, p = 0;
+                int i;
+                for (i = m-1; i >= l; i--)
+                  {
+                    double f = s * e(i), b = c * e(i);
+                    e(i+1) = (r = std::hypot(f, g));
+                    if (r == 0.0)
+                      {
+                        d(i+1) -= p;
+                        e(m) = 0;
+                        break;
+                      }
+                    s = f / r;
+                    c = g / r;
+                    g = d(i+1) - p;
+                    r = (d(i) - g) * s + 2.0 * c * b;
+                    d(i+1) = g + (p = s * r);
+                    g = c * r - b;
+                  }
+                if (r == 0.0 && i >= l) continue;
+                d(l) -= p;
+                e(l) = g;
+                e(m) = 0;
+              }
+          }
+        while (m != l);
+      }
+    for (int i = 1; i < n; i++)
+      for (int j = i; j > 0 && d(j) < d(j-1); j--)
+        std::swap(d(j), d(j-1));
+  }
+
+
+  // zeros of the Jacobi polynomial P_n^(alf,bet) on [-1,1], ascending (Golub-Welsch)
+  inline void JacobiZeros (size_t n, double alf, double bet, VectorView<double> x)
+  {
+    if (n == 0) return;
+    Vector<> e(n);
+    double ab = alf + bet;
+    for (size_t k = 0; k < n; k++)
+      {
+        double t = 2*k + ab;
+        x(k) = (k == 0) ? (bet - alf) / (ab + 2) : (bet*bet - alf*alf) / (t * (t+2));
+        if (k+1 < n)
+          {
+            double j = k+1, tj = 2*j + ab;
+            e(k) = std::sqrt(4*j * (j+alf) * (j+bet) * (j+ab) / (tj*tj * (tj+1) * (tj-1)));
+          }
+      }
+    TridiagonalEigenvalues(x, e);
+  }
+
+
+  // Gauss-Legendre rule on [0,1]; weights from w = 2 / ((1-x^2) P_n'(x)^2) on [-1,1]
+  inline void GaussLegendreRule (VectorView<double> x, VectorView<double> w)
+  {
+    size_t n = x.size();
+    JacobiZeros(n, 0, 0, x);
+    for (size_t i = 0; i < n; i++)
+      {
+        double p, dp;
+        LegendreKernel(n, x(i), p, dp);
+        w(i) = 1.0 / ((1 - x(i)*x(i)) * dp * dp);
+        x(i) = 0.5 * (x(i) + 1);
+      }
+  }
+
+
+  // l(j) = int_0^upper of the Lagrange polynomial of nodes(j)
+  inline void LagrangeIntegrals (VectorView<double> nodes, double upper, VectorView<double> l)
+  {
+    size_t s = nodes.size();
+    size_t nq = s/2 + 1;           // exact for degree s-1
+    Vector<> xq(nq), wq(nq);
+    GaussLegendreRule(xq, wq);
+    l = 0.0;
+    for (size_t q = 0; q < nq; q++)
+      {
+        double t = upper * xq(q);
+        for (size_t j = 0; j < s; j++)
+          {
+            double lj = 1;
+            for (size_t m = 0; m < s; m++)
+              if (m != j)
+                lj *= (t - nodes(m)) / (nodes(j) - nodes(m));
+            l(j) += upper * wq(q) * lj;
+          }
+      }
+  }
+
+  // collocation coefficients a_ij = int_0^c_i l_j, b_j = int_0^1 l_j
+  inline void CollocationCoefficients (VectorView<double> c, MatrixView<double> a, VectorView<double> b)
+  {
+    for (size_t i = 0; i < c.size(); i++)
+      LagrangeIntegrals(c, c(i), a.row(i));
+    LagrangeIntegrals(c, 1, b);
+  }
+
+
+  /*
+    A = T diag(lambda) T^{-1} for a small real matrix A with distinct
+    eigenvalues: eigenvalues by shifted QR on the complex Hessenberg
+    form, eigenvectors by inverse iteration. Matrices are row major.
+  */
+  namespace detail
+  {
+    // solves m x = rhs for nrhs right hand sides (columns of the row major rhs)
+    inline void ComplexSolve (std::vector<Complex> m, std::vector<Complex> & rhs, size_t n, size_t nrhs)
+    {
+      for (size_t k = 0; k < n; k++)
+        {
+          size_t piv = k;
+          for (size_t i = k+1; i < n; i++)
+            if (std::abs(m[i*n+k]) > std::abs(m[piv*n+k])) piv = i;
+          if (m[piv*n+k] == 0.0)
+            throw std::domain_error("ComplexSolve: singular matrix");
+          for (size_t j = 0; j < n; j++) std::swap(m[k*n+j], m[piv*n+j]);
+          for (size_t j = 0; j < nrhs; j++) std::swap(rhs[k*nrhs+j], rhs[piv*nrhs+j]);
+          for (size_t i = k+1; i < n; i++)
+            {
+              Complex f = m[i*n+k] / m[k*n+k];
+              for (size_t j = k; j < n; j++) m[i*n+j] -= f * m[k*n+j];
+              for (size_t j = 0; j < nrhs; j++) rhs[i*nrhs+j] -= f * rhs[k*nrhs+j];
+            }
+        }
+      for (size_t k = n; k-- > 0; )
+        for (size_t j = 0; j < nrhs; j++)
+          {
+            Complex sum = rhs[k*nrhs+j];
+            for (size_t l = k+1; l < n; l++) sum -= m[k*n+l] * rhs[l*nrhs+j];
+            rhs[k*nrhs+j] = sum / m[k*n+k];
+          }
+    }
+
+    inline std::vector<Complex> Eigenvalues (std::vector<Complex> h, size_t n)
+    {
+      auto H = [&] (size_t i, size_t j) -> Complex & { return h[i*n+j]; };
+
+      // Householder reduction to Hessenberg form
+      for (size_t k = 0; k+2 < n; k++)
+        {
+          double norm = 0;
+          for (size_t i = k+1; i < n; i++) norm += std::norm(H(i,k));
+          norm = std::sqrt(norm);
+          if (norm == 0) continue;
+          Complex x0 = H(k+1,k);
+          Complex alpha = -(std::abs(x0) > 0 ? x0 / std::abs(x0) : Complex(1)) * norm;
+          std::vector<Complex> v(n, 0.0);
+          for (size_t i = k+1; i < n; i++) v[i] = H(i,k);
+          v[k+1] -= alpha;
+          double vnorm = 0;
+          for (size_t i = k+1; i < n; i++) vnorm += std::norm(v[i]);
+          vnorm = std::sqrt(vnorm);
+          for (size_t i = k+1; i < n; i++) v[i] /= vnorm;
+          for (size_t j = 0; j < n; j++)
+            {
+              Complex sum = 0;
+              for (size_t i = k+1; i < n; i++) sum += std::conj(v[i]) * H(i,j);
+              for (size_t i = k+1; i < n; i++) H(i,j) -= 2.0 * v[i] * sum;
+            }
+          for (size_t i = 0; i < n; i++)
+            {
+              Complex sum = 0;
+              for (size_t j = k+1; j < n; j++) sum += H(i,j) * v[j];
+              for (size_t j = k+1; j < n; j++) H(i,j) -= 2.0 * sum * std::conj(v[j]);
+            }
+        }
+
+      // single shift QR with Givens rotations and deflation
+      std::vector<Complex> lambda(n);
+      std::vector<Complex> cs(n), sn(n);
+      size_t m = n;
+      int iter = 0;
+      while (m > 0)
+        {
+          if (m == 1) { lambda[0] = H(0,0); break; }
+          size_t l = m-1;
+          while (l > 0 && std::abs(H(l,l-1)) > 1e-16 * (std::abs(H(l,l)) + std::abs(H(l-1,l-1))))
+            l--;
+          if (l > 0) H(l,l-1) = 0;
+          if (l == m-1)
+            {
+              lambda[m-1] = H(m-1,m-1);
+              m--;
+              iter = 0;
+              continue;
+            }
+          if (++iter > 200)
+            throw std::domain_error("Eigenvalues did not converge");
+
+          // Wilkinson shift, an exceptional one now and then
+          Complex a = H(m-2,m-2), b = H(m-2,m-1), c = H(m-1,m-2), d = H(m-1,m-1);
+          Complex disc = std::sqrt(0.25*(a-d)*(a-d) + b*c);
+          Complex mu1 = 0.5*(a+d) + disc, mu2 = 0.5*(a+d) - disc;
+          Complex mu = std::abs(mu1-d) < std::abs(mu2-d) ? mu1 : mu2;
+          if (iter % 11 == 10) mu += std::abs(H(m-1,m-2));
+
+          for (size_t i = l; i < m; i++) H(i,i) -= mu;
+          for (size_t k = l; k+1 < m; k++)
+            {
+              Complex x = H(k,k), y = H(k+1,k);
+              double r = std::sqrt(std::norm(x) + std::norm(y));
+              cs[k] = r > 0 ? x / r : Complex(1);
+              sn[k] = r > 0 ? y / r : Complex(0);
+              for (size_t j = k; j < m; j++)
+                {
+                  Complex hk = H(k,j), hk1 = H(k+1,j);
+                  H(k,j) = std::conj(cs[k]) * hk + std::conj(sn[k]) * hk1;
+                  H(k+1,j) = -sn[k] * hk + cs[k] * hk1;
+                }
+            }
+          for (size_t k = l; k+1 < m; k++)
+            for (size_t i = l; i <= std::min(k+2, m-1); i++)
+              {
+                Complex hk = H(i,k), hk1 = H(i,k+1);
+                H(i,k) = hk * cs[k] + hk1 * sn[k];
+                H(i,k+1) = -hk * std::conj(sn[k]) + hk1 * std::conj(cs[k]);
+              }
+          for (size_t i = l; i < m; i++) H(i,i) += mu;
+        }
+      return lambda;
+    }
+  }
+
+  // a = T diag(lambda) T^-1; T grows ill-conditioned with the number of
+  // stages, and the reconstruction of a deviates by up to 5e-12 at s = 12
+  // and 3e-10 at s = 16 (check_tableau)
+  struct EigenDecomposition
+  {
+    std::vector<Complex> lambda;    // eigenvalues
+    std::vector<Complex> t, tinv;   // eigenvectors as columns of t, row major
+  };
+
+  inline EigenDecomposition Diagonalize (const Matrix<> & a)
+  {
+    size_t n = a.rows();
+    std::vector<Complex> ac(n*n);
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        ac[i*n+j] = a(i,j);
+
+    EigenDecomposition ed;
+    ed.lambda = detail::Eigenvalues(ac, n);
+    std::sort(ed.lambda.begin(), ed.lambda.end(), [] (Complex x, Complex y)
+    {
+      return x.real() != y.real() ? x.real() < y.real() : x.imag() < y.imag();
+    });
+
+    // inverse iteration with a slightly perturbed eigenvalue
+    ed.t.assign(n*n, 0.0);
+    for (size_t k = 0; k < n; k++)
+      {
+        Complex shift = ed.lambda[k] + 1e-10 * (1 + std::abs(ed.lambda[k]));
+        std::vector<Complex> m = ac;
+        for (size_t i = 0; i < n; i++) m[i*n+i] -= shift;
+        std::vector<Complex> v(n);
+        for (size_t i = 0; i < n; i++) v[i] = Complex(1, 0.1*i);
+        size_t imax = 0;
+        for (int it = 0; it < 3; it++)
+          {
+            detail::ComplexSolve(m, v, n, 1);
+            for (size_t i = 0; i < n; i++)
+              if (std::abs(v[i]) > std::abs(v[imax])) imax = i;
+            Complex scale = v[imax];
+            for (auto & vi : v) vi /= scale;
+          }
+
+        // Newton on (A - lambda) v = 0, v(imax) = 1: the eigenvectors are
+        // ill-conditioned for many stages, so the pair is polished to
+        // rounding level residual
+        Complex & lam = ed.lambda[k];
+        for (int it = 0; it < 2; it++)
+          {
+            std::vector<Complex> jac((n+1)*(n+1), 0.0), res(n+1, 0.0);
+            for (size_t i = 0; i < n; i++)
+              {
+                for (size_t j = 0; j < n; j++)
+                  {
+                    jac[i*(n+1)+j] = ac[i*n+j];
+                    res[i] -= ac[i*n+j] * v[j];
+                  }
+                jac[i*(n+1)+i] -= lam;
+                jac[i*(n+1)+n] = -v[i];
+                res[i] += lam * v[i];
+              }
+            jac[n*(n+1)+imax] = 1;
+            detail::ComplexSolve(jac, res, n+1, 1);
+            for (size_t i = 0; i < n; i++) v[i] += res[i];
+            lam += res[n];
+          }
+        for (size_t i = 0; i < n; i++) ed.t[i*n+k] = v[i];
+      }
+
+    ed.tinv.assign(n*n, 0.0);
+    for (size_t i = 0; i < n; i++) ed.tinv[i*n+i] = 1;
+    detail::ComplexSolve(ed.t, ed.tinv, n, n);
+    return ed;
+  }
+
+
+  enum class TableauFamily { GaussLegendre, RadauIIA, LobattoIIIA, LobattoIIIB, LobattoIIIC };
+
+  struct ButcherTableau
+  {
+    Matrix<> a;
+    Vector<> b, c;
+    EigenDecomposition eig;    // of a
+
+    ButcherTableau (size_t s) : a(s,s), b(s), c(s) { a = 0.0; }
+    size_t stages() const { return c.size(); }
+  };
+
+  inline std::unique_ptr<ButcherTableau> ComputeTableau (TableauFamily family, size_t s)
+  {
+    if (s == 0 || (s < 2 && family >= TableauFamily::LobattoIIIA))
+      throw std::invalid_argument("ComputeTableau: too few stages");
+
+    auto tab = std::make_unique<ButcherTableau>(s);
+    Vector<> & c = tab->c;
+    switch (family)
+      {
+      case TableauFamily::GaussLegendre:
+        JacobiZeros(s, 0, 0, c);
+        break;
+      case TableauFamily::RadauIIA:
+        JacobiZeros(s-1, 1, 0, c.range(0, s-1));
+        c(s-1) = 1;
+        break;
+      default:
+        c(0) = -1;
+        JacobiZeros(s-2, 1, 1, c.range(1, s-1));
+        c(s-1) = 1;
+      }
+    for (size_t i = 0; i < s; i++)
+      c(i) = 0.5 * (c(i) + 1);
+
+    CollocationCoefficients(c, tab->a, tab->b);
+
+    if (family == TableauFamily::LobattoIIIB)
+      {
+        // b_i a_ij + b_j a^IIIA_ji = b_i b_j
+        Matrix<> aA = tab->a;
+        for (size_t i = 0; i < s; i++)
+          for (size_t j = 0; j < s; j++)
+            tab->a(i,j) = tab->b(j) * (1 - aA(j,i) / tab->b(i));
+      }
+    else if (family == TableauFamily::LobattoIIIC)
+      {
+        // a_i0 = b_0, the rest integrates exactly polynomials of degree
+        // s-2 through the nodes c_1..c_{s-1}
+        Vector<> l(s-1), l0(s-1);
+        auto inner = c.range(1, s);
+        for (size_t j = 0; j < s-1; j++)
+          {
+            double lj = 1;
+            for (size_t m = 0; m < s-1; m++)
+              if (m != j) lj *= (0 - inner(m)) / (inner(j) - inner(m));
+            l0(j) = lj;
+          }
+        for (size_t i = 0; i < s; i++)
+          {
+            LagrangeIntegrals(inner, c(i), l);
+            tab->a(i,0) = tab->b(0);
+            for (size_t j = 1; j < s; j++)
+              tab->a(i,j) = l(j-1) - tab->b(0) * l0(j-1);
+          }
+      }
+
+    tab->eig = Diagonalize(tab->a);
+    return tab;
+  }
+
+  // the tableau of the family with s stages, computed on first use
+  inline const ButcherTableau & GetTableau (TableauFamily family, size_t s)
+  {
+    static std::mutex mutex;
+    static std::map<std::pair<TableauFamily, size_t>, std::unique_ptr<ButcherTableau>> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto & tab = cache[{ family, s }];
+    if (!tab)
+      tab = ComputeTableau(family, s);
+    return *tab;
+  }
+
+}
+
+#endif
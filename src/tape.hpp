@@ -0,0 +1,360 @@
+#ifndef TAPE_HPP
+#define TAPE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Tape for reverse mode differentiation. Every operation on ReverseAD
+    variables appends one entry holding the indices of its (at most two)
+    arguments and the partial derivatives with respect to them. One
+    reverse sweep then gives the gradient of a scalar with respect to all
+    variables, at a small constant times the cost of the evaluation.
+
+    Storage grows with the first recording and is kept: checkpoint()
+    marks the start of a segment, backward(out, 1, from) sweeps only that
+    segment and accumulates into the entries before it, and rewind()
+    drops the segment without freeing memory, so later recordings of the
+    same size do not allocate. Entries are indexed by uint32_t; a
+    recording beyond that throws std::length_error.
+
+    S is the scalar of values, partials and adjoints: double, or
+    AutoDiff<K> to differentiate the reverse sweep forward in K
+    directions (forward-over-reverse Hessians).
+  */
+  template <typename S>
+  class BasicTape
+  {
+  public:
+    static constexpr uint32_t None = uint32_t(-1);
+
+  private:
+    struct Entry
+    {
+      uint32_t arg[2];
+      S partial[2];
+    };
+    std::vector<Entry> m_entries;
+    std::vector<S> m_adjoints;
+
+    static BasicTape *& activePtr()
+    {
+      thread_local BasicTape * tape = nullptr;
+      return tape;
+    }
+
+  public:
+    explicit BasicTape (size_t capacity = 0)
+    {
+      m_entries.reserve(capacity);
+      m_adjoints.reserve(capacity);
+    }
+
+    BasicTape (const BasicTape &) = delete;
+    BasicTape & operator= (const BasicTape &) = delete;
+
+    // the tape ReverseAD operations of this thread record on
+    static BasicTape & active()
+    {
+      if (!activePtr())
+        throw std::logic_error("ReverseAD: operation on variables outside of a recording Tape::Activate");
+      return *activePtr();
+    }
+
+    size_t checkpoint() const { return m_entries.size(); }
+    void rewind (size_t pos) { m_entries.resize(pos); }
+
+    uint32_t record (uint32_t a, const S & pa, uint32_t b = None, const S & pb = S(0))
+    {
+      if (m_entries.size() >= None)
+        throw std::length_error("ReverseAD: tape exceeds 2^32-1 entries");
+      m_entries.push_back({ { a, b }, { pa, pb } });
+      return uint32_t(m_entries.size()-1);
+    }
+
+    uint32_t newVariable() { return record(None, S(0)); }
+
+    // reverse sweep seeded with d out = seed, over the entries from..out
+    void backward (uint32_t out, const S & seed = S(1), size_t from = 0)
+    {
+      m_adjoints.resize(m_entries.size());
+      std::fill(m_adjoints.begin()+from, m_adjoints.end(), S(0));
+      m_adjoints[out] = seed;
+      for (size_t i = out+1; i-- > from; )
+        {
+          const S & adj = m_adjoints[i];
+          if (adj == S(0)) continue;
+          const Entry & e = m_entries[i];
+          for (int k = 0; k < 2; k++)
+            if (e.arg[k] != None)
+              m_adjoints[e.arg[k]] = m_adjoints[e.arg[k]] + adj * e.partial[k];
+        }
+    }
+
+    const S & adjoint (uint32_t index) const { return m_adjoints[index]; }
+
+    // makes this the active tape of the thread while in scope
+    class Activate
+    {
+      BasicTape * m_prev;
+    public:
+      Activate (BasicTape & tape) : m_prev(activePtr()) { activePtr() = &tape; }
+      ~Activate() { activePtr() = m_prev; }
+    };
+  };
+
+  using Tape = BasicTape<double>;
+
+
+  /*
+    Scalar for reverse mode: a value and its entry on the active tape.
+    Constants (converted from double) have no entry and are never recorded.
+    The operations are hidden friends, so doubles convert to constants.
+  */
+  template <typename S>
+  class BasicReverseAD
+  {
+    S m_val;
+    uint32_t m_index;
+
+    // result of a unary operation with partial derivative pa
+    static BasicReverseAD record (const S & val, const BasicReverseAD & a, const S & pa)
+    {
+      if (a.isConstant()) return BasicReverseAD(val);
+      return BasicReverseAD(val, BasicTape<S>::active().record(a.m_index, pa));
+    }
+
+    static BasicReverseAD record (const S & val, const BasicReverseAD & a, const S & pa,
+                                  const BasicReverseAD & b, const S & pb)
+    {
+      if (a.isConstant()) return record(val, b, pb);
+      if (b.isConstant()) return record(val, a, pa);
+      return BasicReverseAD(val, BasicTape<S>::active().record(a.m_index, pa, b.m_index, pb));
+    }
+
+  public:
+    BasicReverseAD (const S & v = S(0), uint32_t index = BasicTape<S>::None) : m_val(v), m_index(index) { }
+    BasicReverseAD (double v) requires (!std::is_same_v<S, double>) : m_val(v), m_index(BasicTape<S>::None) { }
+
+    const S & value() const { return m_val; }
+    uint32_t index() const { return m_index; }
+    bool isConstant() const { return m_index == BasicTape<S>::None; }
+
+    friend BasicReverseAD operator+ (const BasicReverseAD & a, const BasicReverseAD & b)
+    { return record(a.m_val + b.m_val, a, S(1), b, S(1)); }
+
+    friend BasicReverseAD operator- (const BasicReverseAD & a, const BasicReverseAD & b)
+    { return record(a.m_val - b.m_val, a, S(1), b, S(-1)); }
+
+    friend BasicReverseAD operator* (const BasicReverseAD & a, const BasicReverseAD & b)
+    { return record(a.m_val * b.m_val, a, b.m_val, b, a.m_val); }
+
+    friend BasicReverseAD operator/ (const BasicReverseAD & a, const BasicReverseAD & b)
+    {
+      S inv = S(1) / b.m_val;
+      S quot = a.m_val * inv;
+      return record(quot, a, inv, b, S(-quot * inv));
+    }
+
+    friend BasicReverseAD operator- (const BasicReverseAD & a) { return record(S(-a.m_val), a, S(-1)); }
+
+    friend BasicReverseAD sin (const BasicReverseAD & a) { return record(S(sin(a.m_val)), a, S(cos(a.m_val))); }
+    friend BasicReverseAD cos (const BasicReverseAD & a) { return record(S(cos(a.m_val)), a, S(-sin(a.m_val))); }
+
+    friend BasicReverseAD tan (const BasicReverseAD & a)
+    {
+      S t = tan(a.m_val);
+      return record(t, a, S(1 + t*t));
+    }
+
+    friend BasicReverseAD exp (const BasicReverseAD & a)
+    {
+      S e = exp(a.m_val);
+      return record(e, a, e);
+    }
+
+    friend BasicReverseAD log (const BasicReverseAD & a) { return record(S(log(a.m_val)), a, S(S(1) / a.m_val)); }
+
+    friend BasicReverseAD sqrt (const BasicReverseAD & a)
+    {
+      S r = sqrt(a.m_val);
+      return record(r, a, S(0.5 / r));
+    }
+
+    friend BasicReverseAD pow (const BasicReverseAD & a, double exp)
+    {
+      return record(S(pow(a.m_val, exp)), a, S(exp * pow(a.m_val, exp-1)));
+    }
+
+    friend BasicReverseAD pow (double a, const BasicReverseAD & exp)
+    {
+      S p = pow(a, exp.m_val);
+      return record(p, exp, S(p * std::log(a)));
+    }
+  };
+
+  using ReverseAD = BasicReverseAD<double>;
+
+  template <typename S>
+  std::ostream & operator<< (std::ostream & os, const BasicReverseAD<S> & a)
+  {
+    return os << a.value();
+  }
+
+
+  /*
+    Value and gradient of a scalar model providing
+      template <typename T> T T_energy (VectorView<T> x) const;
+    by one forward evaluation on the tape and one reverse sweep.
+    Each thread records on its own tape, which is rewound afterwards.
+  */
+  template <typename Model>
+  double EvaluateGradient (const Model & model, VectorView<double> x, VectorView<double> grad)
+  {
+    thread_local Tape tape;
+    Tape::Activate active(tape);
+    size_t start = tape.checkpoint();
+
+    Vector<ReverseAD> x_ad(x.size());
+    for (size_t i = 0; i < x.size(); i++)
+      x_ad(i) = ReverseAD(x(i), tape.newVariable());
+
+    ReverseAD energy = model.template T_energy<ReverseAD>(x_ad);
+
+    grad = 0.0;
+    if (!energy.isConstant())
+      {
+        tape.backward(energy.index(), 1, start);
+        for (size_t i = 0; i < x.size(); i++)
+          grad(i) = tape.adjoint(x_ad(i).index());
+      }
+    tape.rewind(start);
+    return energy.value();
+  }
+
+
+  /*
+    Hessian of a scalar model with T_energy by forward-over-reverse: the
+    tape records on AutoDiff<CHUNK> values seeded with CHUNK unit
+    directions, and each reverse sweep gives the gradient together with
+    its derivatives in these directions, i.e. CHUNK columns of the
+    Hessian, exactly. The gradient is stored in grad unless grad is
+    empty. Returns the value of the energy.
+  */
+  template <size_t CHUNK = 8, typename Model>
+  double EvaluateHessian (const Model & model, VectorView<double> x,
+                          VectorView<double> grad, MatrixView<double> hess)
+  {
+    using S = AutoDiff<CHUNK>;
+    using AD = BasicReverseAD<S>;
+    thread_local BasicTape<S> tape;
+    typename BasicTape<S>::Activate active(tape);
+    size_t start = tape.checkpoint();
+    size_t n = x.size();
+    double value = 0;
+
+    Vector<AD> x_ad(n);
+    for (size_t first = 0; first < std::max<size_t>(n, 1); first += CHUNK)
+      {
+        size_t next = std::min(first+CHUNK, n);
+        for (size_t i = 0; i < n; i++)
+          {
+            S xi(x(i));
+            if (i >= first && i < next)
+              xi.deriv()[i-first] = 1;
+            x_ad(i) = AD(xi, tape.newVariable());
+          }
+
+        AD energy = model.template T_energy<AD>(x_ad);
+        value = energy.value().value();
+
+        if (energy.isConstant())
+          {
+            for (size_t i = 0; i < n; i++)
+              for (size_t j = first; j < next; j++)
+                hess(i,j) = 0;
+            if (first == 0 && grad.size())
+              grad = 0.0;
+          }
+        else
+          {
+            tape.backward(energy.index(), S(1), start);
+            for (size_t i = 0; i < n; i++)
+              for (size_t j = first; j < next; j++)
+                hess(i,j) = tape.adjoint(x_ad(i).index()).deriv()[j-first];
+            if (first == 0 && grad.size())
+              for (size_t i = 0; i < n; i++)
+                grad(i) = tape.adjoint(x_ad(i).index()).value();
+          }
+        tape.rewind(start);
+      }
+    return value;
+  }
+
+  template <size_t CHUNK = 8, typename Model>
+  double EvaluateHessian (const Model & model, VectorView<double> x, MatrixView<double> hess)
+  {
+    return EvaluateHessian<CHUNK>(model, x, x.range(0, 0), hess);
+  }
+
+
+  /*
+    f = fac * grad E(x) for a scalar energy E given by a functor with
+    T_energy, e.g. forces with fac = -1. The Jacobian (fac times the
+    Hessian) is exact by forward-over-reverse, at the cost of n / 8
+    taped gradients.
+  */
+  template <typename Functor>
+  class GradientFunction : public NonlinearFunction
+  {
+    Functor m_func;
+    size_t m_dim;
+    double m_fac;
+  public:
+    GradientFunction (Functor func, size_t dim, double fac = 1)
+      : m_func(std::move(func)), m_dim(dim), m_fac(fac) { }
+
+    const Functor & functor() const { return m_func; }
+
+    size_t dimX() const override { return m_dim; }
+    size_t dimF() const override { return m_dim; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      EvaluateGradient(m_func, x, f);
+      f *= m_fac;
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      EvaluateHessian(m_func, x, df);
+      df *= m_fac;
+    }
+
+    // the reverse sweeps of the Hessian give the gradient as well
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f, MatrixView<double> df) const override
+    {
+      EvaluateHessian(m_func, x, f, df);
+      f *= m_fac;
+      df *= m_fac;
+    }
+  protected:
+    std::shared_ptr<NonlinearFunction> cloneNode (CloneMap & map) const override
+    {
+      return std::make_shared<GradientFunction>(CloneFunctor(m_func), m_dim, m_fac);
+    }
+  };
+
+}
+
+#endif
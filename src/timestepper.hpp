@@ -3,6 +3,8 @@
 
 #include <functional>
 #include <exception>
+#include <memory>
+#include <stdexcept>
 
 #include "Newton.hpp"
 
@@ -15,6 +17,12 @@ class TimeStepper {
     TimeStepper(std::shared_ptr<NonlinearFunction> rhs) : m_rhs(rhs) {}
     virtual ~TimeStepper() = default;
     virtual void DoStep(double tau, VectorView<double> y) = 0;
+    std::shared_ptr<NonlinearFunction> rhs() const { return m_rhs; }
+
+    // independent stepper on a cloned rhs, for use on another thread
+    virtual std::unique_ptr<TimeStepper> clone() const {
+      throw std::logic_error("TimeStepper::clone not implemented");
+    }
 };
     //virtual void doStep(double tau, VectorView<double> y) = 0;
   //};
@@ -30,6 +38,9 @@ class ExplicitEuler : public TimeStepper {
       this->m_rhs->evaluate(y, m_vecf);
       y += tau * m_vecf;
     }
+    std::unique_ptr<TimeStepper> clone() const override {
+      return std::make_unique<ExplicitEuler>(m_rhs->clone());
+    }
 };
 
 class ImprovedEuler : public TimeStepper {
@@ -45,6 +56,9 @@ class ImprovedEuler : public TimeStepper {
     this->m_rhs->evaluate(ytil, m_vecf_til);
     y += tau * m_vecf_til;
   }
+  std::unique_ptr<TimeStepper> clone() const override {
+    return std::make_unique<ImprovedEuler>(m_rhs->clone());
+  }
 };
 
 class ImplicitEuler : public TimeStepper {
@@ -64,6 +78,9 @@ class ImplicitEuler : public TimeStepper {
     m_tau->set(tau);
     NewtonSolver(m_equ, y);
   }
+  std::unique_ptr<TimeStepper> clone() const override {
+    return std::make_unique<ImplicitEuler>(m_rhs->clone());
+  }
 };
 
 class CrankNicolson : public TimeStepper
@@ -86,6 +103,11 @@ public:
     m_tau->set(tau);
     NewtonSolver(m_equ, y);
   }
+
+  std::unique_ptr<TimeStepper> clone() const override
+  {
+    return std::make_unique<CrankNicolson>(m_rhs->clone());
+  }
 };
 }  // namespace ASC_ode
    /* void doStep(double tau, VectorView<double> y) override